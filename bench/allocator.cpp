@@ -0,0 +1,70 @@
+/* sdatabase - Simple database abstraction for SQLite3 and PostgreSQL
+ * Licensed under the MIT license
+ * Copyright (c) 2024-2025 Jacob Nilsson
+ *
+ * Multi-threaded insert/query benchmark comparing SQLite's default
+ * allocator against sdatabase::install_pool_allocator().
+ *
+ * Usage: sdb-bench-allocator [threads] [rows per thread]
+ */
+
+#include <sdatabase.hpp>
+
+#include <chrono>
+#include <thread>
+
+static double run(int threads, int rows) {
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> workers{};
+    for (int t{0}; t < threads; ++t) {
+        workers.emplace_back([rows]() {
+            sdatabase::SQLite3Database db{":memory:"};
+            db.exec("CREATE TABLE kv (id INTEGER PRIMARY KEY, k TEXT, v TEXT);");
+
+            db.exec("BEGIN;");
+            for (int i{0}; i < rows; ++i) {
+                db.exec("INSERT INTO kv (k, v) VALUES (?, ?);", "key" + std::to_string(i), std::string(32 + i % 200, 'x'));
+            }
+            db.exec("COMMIT;");
+
+            for (int i{0}; i < rows; ++i) {
+                db.query("SELECT k, v FROM kv WHERE id = ?;", i + 1);
+            }
+        });
+    }
+
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+int main(int argc, char** argv) {
+    int threads = argc > 1 ? std::stoi(argv[1]) : static_cast<int>(std::thread::hardware_concurrency());
+    int rows = argc > 2 ? std::stoi(argv[2]) : 20000;
+    double ops = 2.0 * threads * rows;
+
+    double seconds = run(threads, rows);
+    std::cout << "default allocator: " << seconds << " s, " << ops / seconds << " ops/s\n";
+
+    sqlite3_shutdown();
+    if (!sdatabase::install_pool_allocator()) {
+        std::cerr << "Failed to install pool allocator\n";
+        return 1;
+    }
+    sqlite3_initialize();
+
+    seconds = run(threads, rows);
+    std::cout << "pool allocator:    " << seconds << " s, " << ops / seconds << " ops/s\n\n";
+
+    std::cout << "size\tallocations\tfrees\tpool_hits\tin_use\tcached\n";
+    for (const sdatabase::PoolAllocatorStats& stats : sdatabase::get_pool_allocator_stats()) {
+        std::cout << stats.size << "\t" << stats.allocations << "\t" << stats.frees << "\t" << stats.pool_hits
+                  << "\t" << stats.in_use << "\t" << stats.cached << "\n";
+    }
+
+    return 0;
+}
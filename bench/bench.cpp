@@ -0,0 +1,277 @@
+/* sdatabase - Simple database abstraction for SQLite3 and PostgreSQL
+ * Licensed under the MIT license
+ * Copyright (c) 2024-2025 Jacob Nilsson
+ *
+ * Microbenchmarks for the public hot paths, run against an in-memory
+ * SQLite3 database and, when a local server socket exists, PostgreSQL.
+ *
+ * Usage: sdb-bench --benchmark_format=json --benchmark_out=bench.json
+ *
+ * PostgreSQL connection settings are read from SDB_BENCH_PG_HOST
+ * (default /var/run/postgresql), SDB_BENCH_PG_USER, SDB_BENCH_PG_PASSWORD,
+ * SDB_BENCH_PG_DATABASE (default postgres) and SDB_BENCH_PG_PORT.
+ */
+
+#include <sdatabase.hpp>
+
+#include <benchmark/benchmark.h>
+#include <sys/stat.h>
+
+#include <utility>
+
+namespace {
+    constexpr int max_rows{1000000};
+
+    std::string env(const char* name, const std::string& fallback) {
+        const char* value = std::getenv(name);
+        return value ? value : fallback;
+    }
+
+    sdatabase::SQLite3Database& sqlite3_db() {
+        static sdatabase::SQLite3Database* db = []() {
+            auto* db = new sdatabase::SQLite3Database{":memory:"};
+            db->exec("CREATE TABLE one (id INTEGER PRIMARY KEY, v TEXT);");
+            db->exec("CREATE TABLE rows (id INTEGER PRIMARY KEY, k INTEGER, v TEXT);");
+            db->exec("CREATE TABLE sink (v TEXT);");
+            db->exec("INSERT INTO one (id, v) VALUES (1, 'x');");
+            db->exec("BEGIN;");
+            for (int i{1}; i <= max_rows; ++i) {
+                db->exec("INSERT INTO rows (id, k, v) VALUES (?, ?, ?);", i, i * 7, "value-" + std::to_string(i));
+            }
+            db->exec("COMMIT;");
+            return db;
+        }();
+        return *db;
+    }
+
+    std::string invalid_utf8(std::size_t size) {
+        std::string ret{};
+        while (ret.size() < size) {
+            ret += "abc\xff\xfe" "def\xc3\x28";
+        }
+        ret.resize(size);
+        return ret;
+    }
+
+    template <typename DB, std::size_t... I>
+    bool exec_n(DB& db, const std::string& query, std::index_sequence<I...>) {
+        return db.exec(query, static_cast<int>(I)...);
+    }
+
+    template <typename DB, std::size_t... I>
+    auto query_n(DB& db, const std::string& query, std::index_sequence<I...>) {
+        return db.query(query, static_cast<int>(I)...);
+    }
+
+    /* "UPDATE one SET v = v WHERE id = 1 AND ? IS NOT NULL AND ..." with N placeholders */
+    std::string n_params(const std::string& prefix, std::size_t n) {
+        std::string ret = prefix;
+        for (std::size_t i{0}; i < n; ++i) {
+            ret += " AND ? IS NOT NULL";
+        }
+        return ret + ";";
+    }
+}
+
+static void BM_SQLite3ExecNoParams(benchmark::State& state) {
+    auto& db = sqlite3_db();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(db.exec("UPDATE one SET v = v WHERE id = 1;"));
+    }
+}
+BENCHMARK(BM_SQLite3ExecNoParams);
+
+template <std::size_t N>
+static void BM_SQLite3ExecParams(benchmark::State& state) {
+    auto& db = sqlite3_db();
+    const std::string query = n_params("UPDATE one SET v = v WHERE id = 1", N);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(exec_n(db, query, std::make_index_sequence<N>{}));
+    }
+}
+BENCHMARK_TEMPLATE(BM_SQLite3ExecParams, 1);
+BENCHMARK_TEMPLATE(BM_SQLite3ExecParams, 4);
+BENCHMARK_TEMPLATE(BM_SQLite3ExecParams, 16);
+
+static void BM_SQLite3QueryNoParams(benchmark::State& state) {
+    auto& db = sqlite3_db();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(db.query("SELECT id, v FROM one WHERE id = 1;"));
+    }
+}
+BENCHMARK(BM_SQLite3QueryNoParams);
+
+template <std::size_t N>
+static void BM_SQLite3QueryParams(benchmark::State& state) {
+    auto& db = sqlite3_db();
+    const std::string query = n_params("SELECT id, v FROM one WHERE id = 1", N);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(query_n(db, query, std::make_index_sequence<N>{}));
+    }
+}
+BENCHMARK_TEMPLATE(BM_SQLite3QueryParams, 1);
+BENCHMARK_TEMPLATE(BM_SQLite3QueryParams, 4);
+BENCHMARK_TEMPLATE(BM_SQLite3QueryParams, 16);
+
+/* bind_parameter is private, so each type is measured through a one-parameter exec */
+template <typename T>
+static void BM_SQLite3Bind(benchmark::State& state, T value) {
+    auto& db = sqlite3_db();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(db.exec("UPDATE one SET v = v WHERE id = 0 AND ? IS NOT NULL;", value));
+    }
+}
+BENCHMARK_CAPTURE(BM_SQLite3Bind, int, 42);
+BENCHMARK_CAPTURE(BM_SQLite3Bind, int64, std::int64_t{42});
+BENCHMARK_CAPTURE(BM_SQLite3Bind, double, 42.0);
+BENCHMARK_CAPTURE(BM_SQLite3Bind, string, std::string(64, 'x'));
+BENCHMARK_CAPTURE(BM_SQLite3Bind, cstring, "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx");
+
+static void BM_RemoveNonUTF8Valid(benchmark::State& state) {
+    const std::string input(static_cast<std::size_t>(state.range(0)), 'x');
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(sdatabase::remove_non_utf8(input));
+    }
+    state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations()) * state.range(0));
+}
+BENCHMARK(BM_RemoveNonUTF8Valid)->Arg(16)->Arg(1024)->Arg(65536);
+
+static void BM_RemoveNonUTF8Invalid(benchmark::State& state) {
+    const std::string input = invalid_utf8(static_cast<std::size_t>(state.range(0)));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(sdatabase::remove_non_utf8(input));
+    }
+    state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations()) * state.range(0));
+}
+BENCHMARK(BM_RemoveNonUTF8Invalid)->Arg(16)->Arg(1024)->Arg(65536);
+
+static void BM_SQLite3Materialise(benchmark::State& state) {
+    auto& db = sqlite3_db();
+    const int rows = static_cast<int>(state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(db.query("SELECT id, k, v FROM rows WHERE id <= ?;", rows));
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations()) * rows);
+}
+BENCHMARK(BM_SQLite3Materialise)->Arg(1)->Arg(1000)->Arg(max_rows)->Unit(benchmark::kMicrosecond);
+
+static void BM_SQLite3GetLastInsertion(benchmark::State& state) {
+    auto& db = sqlite3_db();
+    db.exec("INSERT INTO sink (v) VALUES ('x');");
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(db.get_last_insertion());
+    }
+}
+BENCHMARK(BM_SQLite3GetLastInsertion);
+
+#ifdef SDB_POSTGRESQL
+namespace {
+    sdatabase::PostgreSQLDatabase* postgresql_db() {
+        static sdatabase::PostgreSQLDatabase* db = []() -> sdatabase::PostgreSQLDatabase* {
+            const std::string host = env("SDB_BENCH_PG_HOST", "/var/run/postgresql");
+            const int port = std::stoi(env("SDB_BENCH_PG_PORT", "5432"));
+            struct stat st{};
+            if (host.front() == '/' && stat((host + "/.s.PGSQL." + std::to_string(port)).c_str(), &st) != 0) {
+                return nullptr;
+            }
+
+            auto* db = new sdatabase::PostgreSQLDatabase{host, env("SDB_BENCH_PG_USER", env("USER", "postgres")),
+                env("SDB_BENCH_PG_PASSWORD", ""), env("SDB_BENCH_PG_DATABASE", "postgres"), port};
+            if (!db->good()) {
+                delete db;
+                return nullptr;
+            }
+
+            db->exec("DROP TABLE IF EXISTS sdb_bench_one, sdb_bench_rows, sdb_bench_sink;");
+            db->exec("CREATE TABLE sdb_bench_one (id INTEGER PRIMARY KEY, v TEXT);");
+            db->exec("CREATE TABLE sdb_bench_rows (id INTEGER PRIMARY KEY, k INTEGER, v TEXT);");
+            db->exec("CREATE TABLE sdb_bench_sink (id SERIAL PRIMARY KEY, v TEXT);");
+            db->exec("INSERT INTO sdb_bench_one (id, v) VALUES (1, 'x');");
+            db->exec("INSERT INTO sdb_bench_rows SELECT i, i * 7, 'value-' || i FROM generate_series(1, " + std::to_string(max_rows) + ") AS i;");
+            return db;
+        }();
+        return db;
+    }
+}
+
+#define SDB_BENCH_REQUIRE_POSTGRESQL(state, db) \
+    auto* db = postgresql_db(); \
+    if (!db) { \
+        (state).SkipWithError("no local PostgreSQL server"); \
+        return; \
+    }
+
+static void BM_PostgreSQLExecNoParams(benchmark::State& state) {
+    SDB_BENCH_REQUIRE_POSTGRESQL(state, db);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(db->exec("UPDATE sdb_bench_one SET v = v WHERE id = 1;"));
+    }
+}
+BENCHMARK(BM_PostgreSQLExecNoParams);
+
+template <std::size_t N>
+static void BM_PostgreSQLExecParams(benchmark::State& state) {
+    SDB_BENCH_REQUIRE_POSTGRESQL(state, db);
+    const std::string query = n_params("UPDATE sdb_bench_one SET v = v WHERE id = 1", N);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(exec_n(*db, query, std::make_index_sequence<N>{}));
+    }
+}
+BENCHMARK_TEMPLATE(BM_PostgreSQLExecParams, 1);
+BENCHMARK_TEMPLATE(BM_PostgreSQLExecParams, 4);
+BENCHMARK_TEMPLATE(BM_PostgreSQLExecParams, 16);
+
+static void BM_PostgreSQLQueryNoParams(benchmark::State& state) {
+    SDB_BENCH_REQUIRE_POSTGRESQL(state, db);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(db->query("SELECT id, v FROM sdb_bench_one WHERE id = 1;"));
+    }
+}
+BENCHMARK(BM_PostgreSQLQueryNoParams);
+
+template <std::size_t N>
+static void BM_PostgreSQLQueryParams(benchmark::State& state) {
+    SDB_BENCH_REQUIRE_POSTGRESQL(state, db);
+    const std::string query = n_params("SELECT id, v FROM sdb_bench_one WHERE id = 1", N);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(query_n(*db, query, std::make_index_sequence<N>{}));
+    }
+}
+BENCHMARK_TEMPLATE(BM_PostgreSQLQueryParams, 1);
+BENCHMARK_TEMPLATE(BM_PostgreSQLQueryParams, 4);
+BENCHMARK_TEMPLATE(BM_PostgreSQLQueryParams, 16);
+
+template <typename T>
+static void BM_PostgreSQLBind(benchmark::State& state, T value) {
+    SDB_BENCH_REQUIRE_POSTGRESQL(state, db);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(db->exec("UPDATE sdb_bench_one SET v = v WHERE id = 0 AND ? IS NOT NULL;", value));
+    }
+}
+BENCHMARK_CAPTURE(BM_PostgreSQLBind, int, 42);
+BENCHMARK_CAPTURE(BM_PostgreSQLBind, int64, std::int64_t{42});
+BENCHMARK_CAPTURE(BM_PostgreSQLBind, double, 42.0);
+BENCHMARK_CAPTURE(BM_PostgreSQLBind, string, std::string(64, 'x'));
+BENCHMARK_CAPTURE(BM_PostgreSQLBind, cstring, "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx");
+
+static void BM_PostgreSQLMaterialise(benchmark::State& state) {
+    SDB_BENCH_REQUIRE_POSTGRESQL(state, db);
+    const int rows = static_cast<int>(state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(db->query("SELECT id, k, v FROM sdb_bench_rows WHERE id <= ?;", rows));
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations()) * rows);
+}
+BENCHMARK(BM_PostgreSQLMaterialise)->Arg(1)->Arg(1000)->Arg(max_rows)->Unit(benchmark::kMicrosecond);
+
+static void BM_PostgreSQLGetLastInsertion(benchmark::State& state) {
+    SDB_BENCH_REQUIRE_POSTGRESQL(state, db);
+    db->exec("INSERT INTO sdb_bench_sink (v) VALUES ('x');");
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(db->get_last_insertion());
+    }
+}
+BENCHMARK(BM_PostgreSQLGetLastInsertion);
+#endif
+
+BENCHMARK_MAIN();
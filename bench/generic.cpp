@@ -0,0 +1,113 @@
+/* sdatabase - Simple database abstraction for SQLite3 and PostgreSQL
+ * Licensed under the MIT license
+ * Copyright (c) 2024-2025 Jacob Nilsson
+ *
+ * Times the C++20 generic helpers (transaction, bulk_insert, query_as and
+ * Cursor) against an in-memory SQLite3 database and, when built with libpq
+ * and a server is reachable, PostgreSQL. Built as C++20 so the Database
+ * concept is instantiated for every backend.
+ *
+ * Usage: sdb-bench-generic [rows] [page size]
+ *
+ * PostgreSQL connection settings are read from the same SDB_BENCH_PG_*
+ * variables as sdb-bench.
+ */
+
+#include <sdatabase.hpp>
+
+#include <chrono>
+#include <functional>
+
+static_assert(__cplusplus >= 202002L, "sdb-bench-generic must be built as C++20");
+
+namespace {
+    std::string env(const char* name, const std::string& fallback) {
+        const char* value = std::getenv(name);
+        return value ? value : fallback;
+    }
+
+    double time(const std::function<void()>& fn) {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        return elapsed.count();
+    }
+
+    template <sdatabase::Database DB>
+    bool run(const std::string& name, DB& db, const std::string& table, int rows, std::int64_t page_size) {
+        std::vector<std::tuple<std::int64_t, std::string>> data{};
+        data.reserve(static_cast<std::size_t>(rows));
+        for (int i{1}; i <= rows; ++i) {
+            data.emplace_back(i, "value-" + std::to_string(i));
+        }
+
+        bool inserted{false};
+        double seconds = time([&]() {
+            inserted = sdatabase::bulk_insert(db, table, {"id", "v"}, data);
+        });
+        if (!inserted) {
+            std::cerr << name << ": bulk_insert() failed\n";
+            return false;
+        }
+        std::cout << name << " bulk_insert: " << seconds << " s, " << rows / seconds << " rows/s\n";
+
+        std::int64_t paged{};
+        seconds = time([&]() {
+            sdatabase::Cursor<DB> cursor{db, table, "id", page_size, "id, v"};
+            while (!cursor.exhausted()) {
+                paged += static_cast<std::int64_t>(cursor.next().size());
+            }
+        });
+        if (paged != rows) {
+            std::cerr << name << ": Cursor returned " << paged << " of " << rows << " rows\n";
+            return false;
+        }
+        std::cout << name << " Cursor:      " << seconds << " s, " << rows / seconds << " rows/s\n";
+
+        std::size_t read{};
+        seconds = time([&]() {
+            read = sdatabase::query_as<std::int64_t, std::string>(db, {"id", "v"}, "SELECT id, v FROM " + table + ";").size();
+        });
+        if (read != static_cast<std::size_t>(rows)) {
+            std::cerr << name << ": query_as() returned " << read << " of " << rows << " rows\n";
+            return false;
+        }
+        std::cout << name << " query_as:    " << seconds << " s, " << rows / seconds << " rows/s\n";
+
+        bool committed = sdatabase::transaction(db, [&](DB& db) {
+            return db.exec("DELETE FROM " + table + ";");
+        });
+        if (!committed) {
+            std::cerr << name << ": transaction() failed\n";
+            return false;
+        }
+
+        return true;
+    }
+}
+
+int main(int argc, char** argv) {
+    int rows = argc > 1 ? std::stoi(argv[1]) : 100000;
+    std::int64_t page_size = argc > 2 ? std::stoll(argv[2]) : 1000;
+    bool ok{true};
+
+    sdatabase::SQLite3Database sqlite3{":memory:"};
+    sqlite3.exec("CREATE TABLE sdb_bench_generic (id INTEGER PRIMARY KEY, v TEXT);");
+    ok = run("sqlite3", sqlite3, "sdb_bench_generic", rows, page_size) && ok;
+
+#ifdef SDB_POSTGRESQL
+    sdatabase::PostgreSQLDatabase postgresql{env("SDB_BENCH_PG_HOST", "/var/run/postgresql"),
+        env("SDB_BENCH_PG_USER", env("USER", "postgres")), env("SDB_BENCH_PG_PASSWORD", ""),
+        env("SDB_BENCH_PG_DATABASE", "postgres"), std::stoi(env("SDB_BENCH_PG_PORT", "5432"))};
+    if (postgresql.good()) {
+        postgresql.exec("DROP TABLE IF EXISTS sdb_bench_generic;");
+        postgresql.exec("CREATE TABLE sdb_bench_generic (id BIGINT PRIMARY KEY, v TEXT);");
+        ok = run("postgresql", postgresql, "sdb_bench_generic", rows, page_size) && ok;
+        postgresql.exec("DROP TABLE sdb_bench_generic;");
+    } else {
+        std::cout << "postgresql: no server, skipped\n";
+    }
+#endif
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,397 @@
+/* sdatabase - Simple database abstraction for SQLite3 and PostgreSQL
+ * Licensed under the MIT license
+ * Copyright (c) 2024-2025 Jacob Nilsson
+ *
+ * YCSB-style load generator. Runs the core workloads A-F through the
+ * public API with one connection per thread and reports throughput and
+ * latency percentiles per operation.
+ *
+ * Usage: sdb-loadgen [options]
+ *   --backend sqlite3|postgresql  (default sqlite3)
+ *   --workload a|b|c|d|e|f        (default a)
+ *   --threads N                   (default 4)
+ *   --records N                   records loaded before the run (default 100000)
+ *   --operations N                operations per thread (default 100000)
+ *   --field-length N              bytes per field (default 100)
+ *   --zipf-theta X                zipfian constant (default 0.99)
+ *   --no-load                     reuse an already loaded table
+ *   --sqlite-path PATH            (default sdb-loadgen.db)
+ *   --pg-host, --pg-port, --pg-user, --pg-password, --pg-database
+ */
+
+#include <sdatabase.hpp>
+
+#include <cmath>
+#include <random>
+#include <thread>
+
+namespace {
+    constexpr int field_count{10};
+    constexpr int max_scan_length{100};
+
+    enum class Operation {
+        Read,
+        Update,
+        Insert,
+        Scan,
+        ReadModifyWrite,
+        Count,
+    };
+
+    constexpr const char* operation_names[] = {"READ", "UPDATE", "INSERT", "SCAN", "READ-MODIFY-WRITE"};
+
+    struct Workload {
+        double read{};
+        double update{};
+        double insert{};
+        double scan{};
+        double read_modify_write{};
+        bool latest{false};
+    };
+
+    struct Options {
+        std::string backend{"sqlite3"};
+        char workload{'a'};
+        int threads{4};
+        std::int64_t records{100000};
+        std::int64_t operations{100000};
+        std::size_t field_length{100};
+        double zipf_theta{0.99};
+        bool load{true};
+        std::string sqlite_path{"sdb-loadgen.db"};
+        std::string pg_host{"localhost"};
+        int pg_port{5432};
+        std::string pg_user{"postgres"};
+        std::string pg_password{};
+        std::string pg_database{"postgres"};
+    };
+
+    Workload workload_for(char name) {
+        switch (name) {
+            case 'a': return {0.5, 0.5, 0.0, 0.0, 0.0, false};
+            case 'b': return {0.95, 0.05, 0.0, 0.0, 0.0, false};
+            case 'c': return {1.0, 0.0, 0.0, 0.0, 0.0, false};
+            case 'd': return {0.95, 0.0, 0.05, 0.0, 0.0, true};
+            case 'e': return {0.0, 0.0, 0.05, 0.95, 0.0, false};
+            case 'f': return {0.5, 0.0, 0.0, 0.0, 0.5, false};
+            default: throw std::runtime_error{std::string{"Unknown workload: "} + name};
+        }
+    }
+
+    std::uint64_t fnv1a(std::uint64_t value) {
+        std::uint64_t hash{0xcbf29ce484222325ULL};
+        for (int i{0}; i < 8; ++i) {
+            hash ^= value & 0xff;
+            hash *= 0x100000001b3ULL;
+            value >>= 8;
+        }
+        return hash;
+    }
+
+    std::string key_for(std::int64_t n) {
+        char buf[32];
+        std::snprintf(buf, sizeof(buf), "user%019llu", static_cast<unsigned long long>(fnv1a(static_cast<std::uint64_t>(n))));
+        return buf;
+    }
+
+    /* Gray et al., "Quickly Generating Billion-Record Synthetic Databases", as used by YCSB. */
+    class Zipfian {
+        std::int64_t items{};
+        double theta{};
+        double alpha{};
+        double zetan{};
+        double eta{};
+
+        static double zeta(std::int64_t n, double theta) {
+            double sum{0};
+            for (std::int64_t i{1}; i <= n; ++i) {
+                sum += 1.0 / std::pow(static_cast<double>(i), theta);
+            }
+            return sum;
+        }
+        public:
+            Zipfian(std::int64_t items, double theta) : items(items), theta(theta) {
+                const double zeta2 = zeta(2, theta);
+                alpha = 1.0 / (1.0 - theta);
+                zetan = zeta(items, theta);
+                eta = (1.0 - std::pow(2.0 / static_cast<double>(items), 1.0 - theta)) / (1.0 - zeta2 / zetan);
+            }
+
+            std::int64_t next(std::mt19937_64& rng) const {
+                const double u = std::uniform_real_distribution<double>{0.0, 1.0}(rng);
+                const double uz = u * zetan;
+                if (uz < 1.0) {
+                    return 0;
+                }
+                if (uz < 1.0 + std::pow(0.5, theta)) {
+                    return 1;
+                }
+                auto ret = static_cast<std::int64_t>(static_cast<double>(items) * std::pow(eta * u - eta + 1.0, alpha));
+                return ret < items ? ret : items - 1;
+            }
+    };
+
+    struct ThreadResult {
+        sdatabase::metrics::Histogram latency[static_cast<int>(Operation::Count)]{};
+        std::uint64_t failures{}; // failed writes
+    };
+
+    template <typename DB>
+    void create_table(DB& db) {
+        std::string query = "CREATE TABLE IF NOT EXISTS usertable (ycsb_key VARCHAR(64) PRIMARY KEY";
+        for (int i{0}; i < field_count; ++i) {
+            query += ", field" + std::to_string(i) + " TEXT";
+        }
+        db.exec(query + ");");
+    }
+
+    template <typename DB>
+    bool insert(DB& db, const std::string& key, const std::string& value) {
+        return db.exec("INSERT INTO usertable (ycsb_key, field0, field1, field2, field3, field4, field5, field6, field7, field8, field9)"
+                       " VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);",
+                       key, value, value, value, value, value, value, value, value, value, value);
+    }
+
+    template <typename DB>
+    void load(DB& db, const Options& options) {
+        db.exec("DROP TABLE IF EXISTS usertable;");
+        create_table(db);
+
+        const std::string value(options.field_length, 'v');
+        db.exec("BEGIN;");
+        for (std::int64_t i{0}; i < options.records; ++i) {
+            insert(db, key_for(i), value);
+            if (i % 10000 == 9999) {
+                db.exec("COMMIT;");
+                db.exec("BEGIN;");
+            }
+        }
+        db.exec("COMMIT;");
+    }
+
+    template <typename DB>
+    void worker(DB& db, const Options& options, const Workload& workload, const Zipfian& zipfian,
+                std::atomic<std::int64_t>& inserted, int seed, ThreadResult& result) {
+        using clock = std::chrono::steady_clock;
+
+        std::mt19937_64 rng{static_cast<std::uint64_t>(seed) * 0x9e3779b97f4a7c15ULL};
+        std::uniform_real_distribution<double> choose{0.0, 1.0};
+        std::uniform_int_distribution<int> field{0, field_count - 1};
+        std::uniform_int_distribution<int> scan_length{1, max_scan_length};
+        const std::string value(options.field_length, 'u');
+
+        auto next_key = [&]() {
+            const std::int64_t count = inserted.load(std::memory_order_relaxed);
+            std::int64_t n = zipfian.next(rng);
+            if (workload.latest) {
+                n = count - 1 - n;
+                return n < 0 ? std::int64_t{0} : n;
+            }
+            /* scatter the popular items over the keyspace */
+            return static_cast<std::int64_t>(fnv1a(static_cast<std::uint64_t>(n)) % static_cast<std::uint64_t>(count));
+        };
+
+        for (std::int64_t i{0}; i < options.operations; ++i) {
+            const double p = choose(rng);
+            Operation op{};
+            if (p < workload.read) {
+                op = Operation::Read;
+            } else if (p < workload.read + workload.update) {
+                op = Operation::Update;
+            } else if (p < workload.read + workload.update + workload.insert) {
+                op = Operation::Insert;
+            } else if (p < workload.read + workload.update + workload.insert + workload.scan) {
+                op = Operation::Scan;
+            } else {
+                op = Operation::ReadModifyWrite;
+            }
+
+            const clock::time_point start = clock::now();
+            bool ok{true};
+            switch (op) {
+                case Operation::Read:
+                    db.query("SELECT * FROM usertable WHERE ycsb_key = ?;", key_for(next_key()));
+                    break;
+                case Operation::Update:
+                    ok = db.exec("UPDATE usertable SET field" + std::to_string(field(rng)) + " = ? WHERE ycsb_key = ?;", value, key_for(next_key()));
+                    break;
+                case Operation::Insert:
+                    ok = insert(db, key_for(inserted.fetch_add(1, std::memory_order_relaxed)), value);
+                    break;
+                case Operation::Scan:
+                    db.query("SELECT * FROM usertable WHERE ycsb_key >= ? ORDER BY ycsb_key LIMIT ?;", key_for(next_key()), scan_length(rng));
+                    break;
+                case Operation::ReadModifyWrite: {
+                    const std::string key = key_for(next_key());
+                    db.query("SELECT * FROM usertable WHERE ycsb_key = ?;", key);
+                    ok = db.exec("UPDATE usertable SET field" + std::to_string(field(rng)) + " = ? WHERE ycsb_key = ?;", value, key);
+                    break;
+                }
+                case Operation::Count:
+                    break;
+            }
+            const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+
+            result.latency[static_cast<int>(op)].record(static_cast<std::uint64_t>(elapsed));
+            if (!ok) {
+                ++result.failures;
+            }
+        }
+    }
+
+    void report(const std::vector<ThreadResult>& results, double seconds) {
+        sdatabase::metrics::Histogram total{};
+        std::uint64_t failures{0};
+
+        std::cout << "operation\tcount\tp50_us\tp99_us\tp999_us\tmax_us\n";
+        for (int op{0}; op < static_cast<int>(Operation::Count); ++op) {
+            sdatabase::metrics::Histogram merged{};
+            for (const ThreadResult& result : results) {
+                merged.merge(result.latency[op]);
+            }
+            if (merged.count() == 0) {
+                continue;
+            }
+            total.merge(merged);
+            std::cout << operation_names[op] << "\t" << merged.count()
+                      << "\t" << static_cast<double>(merged.percentile(50)) / 1e3
+                      << "\t" << static_cast<double>(merged.percentile(99)) / 1e3
+                      << "\t" << static_cast<double>(merged.percentile(99.9)) / 1e3
+                      << "\t" << static_cast<double>(merged.max()) / 1e3 << "\n";
+        }
+        for (const ThreadResult& result : results) {
+            failures += result.failures;
+        }
+
+        std::cout << "\nruntime: " << seconds << " s\n"
+                  << "throughput: " << static_cast<double>(total.count()) / seconds << " ops/s\n"
+                  << "p50/p99/p999: " << static_cast<double>(total.percentile(50)) / 1e3 << " / "
+                  << static_cast<double>(total.percentile(99)) / 1e3 << " / "
+                  << static_cast<double>(total.percentile(99.9)) / 1e3 << " us\n"
+                  << "failed writes: " << failures << "\n";
+    }
+
+    template <typename DB, typename Connect>
+    int run(const Options& options, Connect connect) {
+        const Workload workload = workload_for(options.workload);
+
+        {
+            std::unique_ptr<DB> db = connect();
+            if (!db->good()) {
+                std::cerr << "Failed to connect to database\n";
+                return 1;
+            }
+            if (options.load) {
+                std::cout << "loading " << options.records << " records\n";
+                load(*db, options);
+            }
+        }
+
+        std::vector<std::unique_ptr<DB>> connections{};
+        for (int i{0}; i < options.threads; ++i) {
+            connections.push_back(connect());
+            if (!connections.back()->good()) {
+                std::cerr << "Failed to connect to database\n";
+                return 1;
+            }
+        }
+
+        const Zipfian zipfian{options.records, options.zipf_theta};
+        std::atomic<std::int64_t> inserted{options.records};
+        std::vector<ThreadResult> results(static_cast<std::size_t>(options.threads));
+        std::vector<std::thread> threads{};
+
+        const auto start = std::chrono::steady_clock::now();
+        for (int i{0}; i < options.threads; ++i) {
+            threads.emplace_back([&, i]() {
+                worker(*connections[static_cast<std::size_t>(i)], options, workload, zipfian, inserted, i + 1, results[static_cast<std::size_t>(i)]);
+            });
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        std::cout << "workload " << static_cast<char>(options.workload - 'a' + 'A') << ", " << options.backend
+                  << ", " << options.threads << " threads\n\n";
+        report(results, elapsed.count());
+        return 0;
+    }
+
+    Options parse(int argc, char** argv) {
+        Options options{};
+        for (int i{1}; i < argc; ++i) {
+            const std::string arg = argv[i];
+            auto value = [&]() -> std::string {
+                if (i + 1 >= argc) {
+                    throw std::runtime_error{"Missing value for " + arg};
+                }
+                return argv[++i];
+            };
+
+            if (arg == "--backend") {
+                options.backend = value();
+            } else if (arg == "--workload") {
+                options.workload = static_cast<char>(std::tolower(static_cast<unsigned char>(value().at(0))));
+            } else if (arg == "--threads") {
+                options.threads = std::stoi(value());
+            } else if (arg == "--records") {
+                options.records = std::stoll(value());
+            } else if (arg == "--operations") {
+                options.operations = std::stoll(value());
+            } else if (arg == "--field-length") {
+                options.field_length = std::stoul(value());
+            } else if (arg == "--zipf-theta") {
+                options.zipf_theta = std::stod(value());
+            } else if (arg == "--no-load") {
+                options.load = false;
+            } else if (arg == "--sqlite-path") {
+                options.sqlite_path = value();
+            } else if (arg == "--pg-host") {
+                options.pg_host = value();
+            } else if (arg == "--pg-port") {
+                options.pg_port = std::stoi(value());
+            } else if (arg == "--pg-user") {
+                options.pg_user = value();
+            } else if (arg == "--pg-password") {
+                options.pg_password = value();
+            } else if (arg == "--pg-database") {
+                options.pg_database = value();
+            } else {
+                throw std::runtime_error{"Unknown option: " + arg};
+            }
+        }
+        return options;
+    }
+}
+
+int main(int argc, char** argv) {
+    Options options{};
+    try {
+        options = parse(argc, argv);
+        workload_for(options.workload);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+
+    if (options.backend == "sqlite3") {
+        return run<sdatabase::SQLite3Database>(options, [&]() {
+            auto db = std::make_unique<sdatabase::SQLite3Database>(options.sqlite_path);
+            db->exec("PRAGMA journal_mode = WAL;");
+            db->exec("PRAGMA synchronous = NORMAL;");
+            db->exec("PRAGMA busy_timeout = 10000;");
+            return db;
+        });
+    }
+#ifdef SDB_POSTGRESQL
+    if (options.backend == "postgresql") {
+        return run<sdatabase::PostgreSQLDatabase>(options, [&]() {
+            return std::make_unique<sdatabase::PostgreSQLDatabase>(options.pg_host, options.pg_user, options.pg_password, options.pg_database, options.pg_port);
+        });
+    }
+#endif
+
+    std::cerr << "Unsupported backend: " << options.backend << "\n";
+    return 1;
+}
@@ -10,8 +10,41 @@
 #include <vector>
 #include <fstream>
 #include <unordered_map>
+#include <unordered_set>
 #include <stdexcept>
+#if __cplusplus >= 202002L
+#include <concepts>
+#endif
 #include <cstdint>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <functional>
+#include <future>
+#include <iterator>
+#include <list>
+#include <optional>
+#include <queue>
+#include <random>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <string_view>
+#include <utility>
 
 #ifndef SDB_SQLITE3
 #ifndef SDB_POSTGRESQL
@@ -22,11 +55,36 @@
 #define SDB_ENABLE_ICONV
 #endif
 
+#ifndef SDB_POSIX
+#if defined(__unix__) || defined(__APPLE__)
+#define SDB_POSIX
+#endif
+#endif
+
+#ifdef SDB_POSIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #ifdef SDB_SQLITE3
 #include <sqlite3.h>
+#if defined(SQLITE_ENABLE_SESSION) && defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+#define SDB_SQLITE3_SESSION
+#endif
 #endif
 #ifdef SDB_POSTGRESQL
 #include <libpq-fe.h>
+#include <libpq/libpq-fs.h>
+#ifdef SDB_POSIX
+#include <poll.h>
+#elif defined(_WIN32)
+#include <winsock2.h>
+#endif
 #endif
 
 #ifdef SDB_ENABLE_ICONV
@@ -37,706 +95,9905 @@
  * @brief Namespace for database related functions and classes.
  */
 namespace sdatabase {
-#ifdef SDB_SQLITE3
     /**
-     * @brief Temporary storage for data. Do not use this directly.
+     * @brief Remove invalid UTF-8 sequences from a string. Returns the input unchanged unless SDB_ENABLE_ICONV is defined.
+     * @param input String to clean.
+     * @return std::string Valid UTF-8 string.
      */
-    inline std::vector<std::unordered_map<std::string, std::string>> tmp{};
+    std::string remove_non_utf8(const std::string& input);
     /**
-     * @brief Callback function for sqlite3_exec.
-     *
-     * @param data Pointer to data.
-     * @param argc Number of columns.
-     * @param argv Column values.
-     * @param name Column names.
-     * @return int 0.
+     * @brief Parameter that binds a zero-filled blob of the given size, to preallocate space for SQLite3Blob writes.
      */
-    int callback(void* data, int argc, char** argv, char** name);
-#endif
-#ifdef SDB_SQLITE3
+    struct ZeroBlob {
+        std::uint64_t size{};
+    };
     /**
-     * @brief Class for database operations.
+     * @brief Parameter that binds raw bytes as a blob (SQLite3) or a binary bytea (PostgreSQL), without text conversion.
+     * The data must stay valid until the call returns. An empty view binds an empty blob, not NULL, and
+     * PostgreSQL calls fail for views larger than INT32_MAX bytes.
      */
-    class SQLite3Database {
-        sqlite3* sqlite3_db{};
-        std::string database{};
-        bool is_good{false};
+    struct BlobView {
+        const void* data{};
+        std::size_t size{};
+    };
+    /**
+     * @brief Namespace for query latency instrumentation.
+     */
+    namespace metrics {
+        /**
+         * @brief Log-bucketed latency histogram, 8 linear sub-buckets per power of two.
+         */
+        class Histogram {
+            static constexpr std::size_t sub_buckets{8};
+            static constexpr std::size_t bucket_count{62 * sub_buckets};
 
-        template<typename T, typename... Args>
-        void bind_parameters(sqlite3_stmt* stmt, int index, T value, Args... args) {
-            if constexpr (std::is_same_v<T, int>) {
-                bind_parameter(stmt, index, value);
-            } else if constexpr (std::is_same_v<T, int64_t>) {
-                bind_parameter(stmt, index, value);
-            } else if constexpr (std::is_same_v<T, double>) {
-                bind_parameter(stmt, index, value);
-            } else if constexpr (std::is_same_v<T, std::string>) {
-                bind_parameter(stmt, index, value);
-            } else if constexpr (std::is_same_v<T, const char*>) {
-                bind_parameter(stmt, index, value);
-            }
-            bind_parameters(stmt, index + 1, args...);
-        }
+            std::array<std::uint64_t, bucket_count> buckets{};
+            std::uint64_t total{};
+            std::uint64_t sum_value{};
+            std::uint64_t min_value{};
+            std::uint64_t max_value{};
 
-        std::string remove_non_utf8(const std::string& input) {
-#ifdef SDB_ENABLE_ICONV
-            iconv_t cd = iconv_open("UTF-8//IGNORE", "UTF-8");
-            if (cd == (iconv_t)-1) {
-                throw std::runtime_error("iconv_open failed");
-            }
-
-            std::vector<char> output(input.size() * 2);
-            char* inbuf = const_cast<char*>(input.data());
-            size_t inbytesleft = input.size();
-            char* outbuf = output.data();
-            size_t outbytesleft = output.size();
-
-            while (inbytesleft > 0) {
-                size_t result = iconv(cd, &inbuf, &inbytesleft, &outbuf, &outbytesleft);
-                if (result == (size_t)-1) {
-                    if (errno == EILSEQ || errno == EINVAL) {
-                        ++inbuf;
-                        --inbytesleft;
-                    } else if (errno == E2BIG) {
-                        size_t used = output.size() - outbytesleft;
-                        output.resize(output.size() * 2);
-                        outbuf = output.data() + used;
-                        outbytesleft = output.size() - used;
-                    } else {
-                        iconv_close(cd);
-                        return "";
-                    }
-                }
-            }
+            static std::size_t index_of(std::uint64_t value);
+            static std::uint64_t upper_bound_of(std::size_t index);
+            public:
+                /**
+                 * @brief Record a value.
+                 * @param value Value, in nanoseconds for latencies.
+                 */
+                void record(std::uint64_t value);
+                /**
+                 * @brief Add the contents of another histogram.
+                 * @param other Histogram to merge.
+                 */
+                void merge(const Histogram& other);
+                /**
+                 * @brief Get an approximate percentile.
+                 * @param percentile Percentile in the range [0, 100].
+                 * @return std::uint64_t Upper bound of the bucket holding the percentile.
+                 */
+                std::uint64_t percentile(double percentile) const;
+                /**
+                 * @brief Count the values strictly below a power of two.
+                 * @param exponent Exponent of the bound.
+                 * @return std::uint64_t Number of values below 2^exponent.
+                 */
+                std::uint64_t count_below_pow2(unsigned exponent) const;
+                std::uint64_t count() const;
+                std::uint64_t sum() const;
+                std::uint64_t min() const;
+                std::uint64_t max() const;
+        };
+        /**
+         * @brief Counters for one statement.
+         */
+        struct StatementStats {
+            std::uint64_t calls{};
+            std::uint64_t errors{};
+            std::uint64_t rows{};
+            std::uint64_t bytes{};
+            Histogram prepare{};
+            Histogram execute{};
+            Histogram fetch{};
 
-            iconv_close(cd);
-            return std::string(output.data(), output.size() - outbytesleft);
-#else
-            return input;
-#endif
-        }
+            void merge(const StatementStats& other);
+        };
+        /**
+         * @brief Counters for one normalised statement.
+         */
+        struct StatementMetrics {
+            std::string statement{};
+            StatementStats stats{};
+        };
+        /**
+         * @brief Distinct normalised statements tracked per thread. Further statements are counted under other_statement.
+         */
+        inline constexpr std::size_t max_statements{1000};
+        /**
+         * @brief Statement name of the counters past max_statements.
+         */
+        inline constexpr const char* other_statement{"(other)"};
+        /**
+         * @brief Merged view of all per-thread shards.
+         */
+        struct Snapshot {
+            std::vector<StatementMetrics> statements{};
+        };
+        /**
+         * @brief Enable or disable metrics collection. Disabled by default.
+         * @param enable True to enable.
+         */
+        void enable(bool enable = true);
+        /**
+         * @brief Check if metrics collection is enabled.
+         * @return bool True if enabled.
+         */
+        bool enabled();
+        /**
+         * @brief Normalise a statement, replacing literals and placeholders with '?' and collapsing whitespace.
+         * @param query Statement to normalise.
+         * @return std::string Normalised statement.
+         */
+        std::string normalize(const std::string& query);
+        /**
+         * @brief Merge all per-thread shards into a snapshot.
+         * @return Snapshot Snapshot, one entry per normalised statement.
+         */
+        Snapshot snapshot();
+        /**
+         * @brief Clear all collected metrics.
+         */
+        void reset();
+        /**
+         * @brief Write a snapshot in Prometheus text exposition format.
+         * @param path File to write. Written to a temporary file and renamed into place.
+         * @return bool True if successful.
+         */
+        bool write_prometheus(const std::string& path);
+    }
+    /**
+     * @brief Namespace for implementation details. Do not use this directly.
+     */
+    namespace detail {
+        /**
+         * @brief Times the phases of one statement and records them on destruction.
+         */
+        class QueryProbe {
+            using clock = std::chrono::steady_clock;
 
-        void bind_parameters(sqlite3_stmt* stmt, int index) {}
+            const std::string& query;
+            bool record{false};
+            bool active{false};
+            bool ok{false};
+            clock::time_point last{};
+            std::uint64_t prepare_ns{};
+            std::uint64_t execute_ns{};
+            std::uint64_t fetch_ns{};
+            std::uint64_t rows{};
+            std::uint64_t bytes{};
 
-        void bind_parameter(sqlite3_stmt* stmt, int index, int value) {
-#ifdef SDB_ENABLE_PRINTDEBUG
-            std::cerr << "Binding int: " << value << " to index: " << index << "\n";
-#endif
-            sqlite3_bind_int(stmt, index, value);
-        }
+            std::uint64_t lap() {
+                clock::time_point now = clock::now();
+                auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(now - last).count();
+                last = now;
+                return static_cast<std::uint64_t>(elapsed);
+            }
+            public:
+                explicit QueryProbe(const std::string& query, bool timed = false) : query(query), record(metrics::enabled()), active(record || timed) {
+                    if (active) {
+                        last = clock::now();
+                    }
+                }
+                void prepared() {
+                    if (active) {
+                        prepare_ns = lap();
+                    }
+                }
+                void executed() {
+                    if (active) {
+                        execute_ns = lap();
+                    }
+                }
+                void fetched(std::uint64_t rows, std::uint64_t bytes) {
+                    if (active) {
+                        fetch_ns = lap();
+                        this->rows = rows;
+                        this->bytes = bytes;
+                    }
+                }
+                void succeeded() {
+                    ok = true;
+                }
+                std::uint64_t elapsed_ns() const {
+                    return prepare_ns + execute_ns + fetch_ns;
+                }
+                std::uint64_t row_count() const {
+                    return rows;
+                }
+                ~QueryProbe();
+        };
 
-        void bind_parameter(sqlite3_stmt* stmt, int index, int64_t value) {
-#ifdef SDB_ENABLE_PRINTDEBUG
-            std::cerr << "Binding int: " << value << " to index: " << index << "\n";
-#endif
-            sqlite3_bind_int64(stmt, index, value);
+        template <typename T>
+        constexpr const char* param_type_name() {
+            if constexpr (std::is_same_v<T, int>) {
+                return "int";
+            } else if constexpr (std::is_same_v<T, int64_t>) {
+                return "int64";
+            } else if constexpr (std::is_floating_point_v<T>) {
+                return "double";
+            } else if constexpr (std::is_same_v<T, std::string> || std::is_same_v<T, const char*> || std::is_same_v<T, char*>) {
+                return "text";
+            } else if constexpr (std::is_integral_v<T>) {
+                return "integer";
+            } else if constexpr (std::is_same_v<T, ZeroBlob>) {
+                return "zeroblob";
+            } else if constexpr (std::is_same_v<T, BlobView>) {
+                return "blob";
+            } else {
+                return "unknown";
+            }
         }
 
-        void bind_parameter(sqlite3_stmt* stmt, int index, double value) {
-#ifdef SDB_ENABLE_PRINTDEBUG
-            std::cerr << "Binding double: " << value << " to index: " << index << "\n";
-#endif
-            sqlite3_bind_double(stmt, index, value);
-        }
+        std::string json_escape(const std::string& value);
 
-        void bind_parameter(sqlite3_stmt* stmt, int index, const std::string& value) {
-#ifdef SDB_ENABLE_PRINTDEBUG
-            std::cerr << "Binding string: " << value << " to index: " << index << "\n";
-#endif
-            sqlite3_bind_text(stmt, index, remove_non_utf8(value).c_str(), -1, SQLITE_TRANSIENT);
+        template <typename T>
+        void append_cache_key(std::string& key, const T& value) {
+            key += '\x1f';
+            key += param_type_name<T>();
+            key += ':';
+            if constexpr (std::is_same_v<T, std::string>) {
+                key += std::to_string(value.size()) + ':' + value;
+            } else if constexpr (std::is_same_v<T, const char*> || std::is_same_v<T, char*>) {
+                const std::string str{value ? value : ""};
+                key += std::to_string(str.size()) + ':' + str;
+            } else if constexpr (std::is_same_v<T, ZeroBlob>) {
+                key += std::to_string(value.size);
+            } else if constexpr (std::is_same_v<T, BlobView>) {
+                key += std::to_string(value.size) + ':';
+                key.append(static_cast<const char*>(value.data), value.data ? value.size : 0);
+            } else if constexpr (std::is_arithmetic_v<T>) {
+                key += std::to_string(value);
+            }
         }
 
-        void bind_parameter(sqlite3_stmt* stmt, int index, const char* value) {
-#ifdef SDB_ENABLE_PRINTDEBUG
-            std::cerr << "Binding string: " << value << " to index: " << index << "\n";
-#endif
-            sqlite3_bind_text(stmt, index, remove_non_utf8(value).c_str(), -1, SQLITE_TRANSIENT);
+        template <typename... Args>
+        std::string cache_key(const std::string& query, const Args&... args) {
+            std::string key{query};
+            (append_cache_key(key, args), ...);
+            return key;
         }
-
-        public:
-            template <typename... Args>
-            bool exec(const std::string& query, Args... args) {
-                static_assert(sizeof...(args) > 0, "exec() requires more parameters");
-                sqlite3_stmt* stmt;
-
-                std::string nq{};
-                for (size_t i = 0; i < query.size(); ++i) {
-                    if (query[i] == '$' && i + 1 < query.size() && isdigit(query[i + 1])) {
-                        nq += '?';
-                        while (i + 1 < query.size() && isdigit(query[i + 1])) {
-                            ++i;
-                        }
-                    } else {
-                        nq += query[i];
+    }
+    namespace detail {
+        /**
+         * @brief Fixed-size pool of worker threads running queued tasks in FIFO order.
+         */
+        class ThreadPool {
+            std::mutex mutex{};
+            std::condition_variable cv{};
+            std::queue<std::function<void()>> tasks{};
+            std::vector<std::thread> workers{};
+            bool stop{false};
+            public:
+                explicit ThreadPool(std::size_t threads) {
+                    threads = threads ? threads : std::max<std::size_t>(1, std::thread::hardware_concurrency());
+                    for (std::size_t i{0}; i < threads; ++i) {
+                        workers.emplace_back([this]() {
+                            for (;;) {
+                                std::function<void()> task{};
+                                {
+                                    std::unique_lock<std::mutex> lock(mutex);
+                                    cv.wait(lock, [this]() { return stop || !tasks.empty(); });
+                                    if (tasks.empty()) {
+                                        return;
+                                    }
+                                    task = std::move(tasks.front());
+                                    tasks.pop();
+                                }
+                                task();
+                            }
+                        });
                     }
                 }
-
-                if (sqlite3_prepare_v2(sqlite3_db, nq.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-                    std::cerr << "Failed to prepare statement\n";
-                    return false;
+                ThreadPool(const ThreadPool&) = delete;
+                ThreadPool& operator=(const ThreadPool&) = delete;
+                template <typename F>
+                std::future<std::invoke_result_t<F>> submit(F&& f) {
+                    auto task = std::make_shared<std::packaged_task<std::invoke_result_t<F>()>>(std::forward<F>(f));
+                    auto future = task->get_future();
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        tasks.emplace([task]() { (*task)(); });
+                    }
+                    cv.notify_one();
+                    return future;
                 }
-
-                bind_parameters(stmt, 1, args...);
-
-                if (sqlite3_step(stmt) != SQLITE_DONE) {
-                    std::cerr << "Failed to step statement" << sqlite3_errmsg(sqlite3_db) << "\n";
-                    return false;
+                std::size_t size() const {
+                    return workers.size();
                 }
-
-                sqlite3_finalize(stmt);
-
-                return true;
-            }
-            template <typename... Args>
-            std::vector<std::unordered_map<std::string, std::string>> query(const std::string& query, Args... args) {
-                static_assert(sizeof...(args) > 0, "query() requires more parameters");
-                if (!this->is_good) {
-                    return {};
+                ~ThreadPool() {
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        stop = true;
+                    }
+                    cv.notify_all();
+                    for (auto& worker : workers) {
+                        worker.join();
+                    }
                 }
-
-                std::string nq{};
-                for (size_t i = 0; i < query.size(); ++i) {
-                    if (query[i] == '$' && i + 1 < query.size() && isdigit(query[i + 1])) {
-                        nq += '?';
-                        while (i + 1 < query.size() && isdigit(query[i + 1])) {
-                            ++i;
-                        }
-                    } else {
-                        nq += query[i];
+        };
+        /**
+         * @brief Blocking queue of fixed capacity between one producer and one consumer thread.
+         */
+        template <typename T>
+        class BoundedQueue {
+            std::mutex mutex{};
+            std::condition_variable not_empty{};
+            std::condition_variable not_full{};
+            std::deque<T> items{};
+            std::size_t capacity{};
+            bool closed{false};
+            public:
+                explicit BoundedQueue(std::size_t capacity) : capacity(std::max<std::size_t>(1, capacity)) {}
+                /**
+                 * @brief Wait for room and append an item.
+                 * @return bool False if the queue was closed.
+                 */
+                bool push(T item) {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    not_full.wait(lock, [this]() { return closed || items.size() < capacity; });
+                    if (closed) {
+                        return false;
                     }
+                    items.push_back(std::move(item));
+                    not_empty.notify_one();
+                    return true;
                 }
-
-                sqlite3_stmt* stmt;
-                if (sqlite3_prepare_v2(sqlite3_db, nq.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-                    return {};
+                /**
+                 * @brief Wait for an item and remove it.
+                 * @return bool False once the queue is closed and empty.
+                 */
+                bool pop(T& item) {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    not_empty.wait(lock, [this]() { return closed || !items.empty(); });
+                    if (items.empty()) {
+                        return false;
+                    }
+                    item = std::move(items.front());
+                    items.pop_front();
+                    not_full.notify_one();
+                    return true;
                 }
-
-                bind_parameters(stmt, 1, args...);
-
-                std::vector<std::unordered_map<std::string, std::string>> result;
-                int status;
-                while ((status = sqlite3_step(stmt)) == SQLITE_ROW) {
-                    std::unordered_map<std::string, std::string> row;
-                    for (int i = 0; i < sqlite3_column_count(stmt); ++i) {
-                        row[sqlite3_column_name(stmt, i)] = reinterpret_cast<const char*>(sqlite3_column_text(stmt, i));
+                /**
+                 * @brief Wake both sides. Queued items can still be popped, further pushes fail.
+                 */
+                void close() {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    closed = true;
+                    not_empty.notify_all();
+                    not_full.notify_all();
+                }
+        };
+        /**
+         * @brief Lock-free ring buffer for exactly one producer and one consumer thread.
+         */
+        template <typename T>
+        class SpscRing {
+            std::vector<T> slots{};
+            std::size_t mask{};
+            alignas(64) std::atomic<std::size_t> head{0}; // next slot to pop, written by the consumer
+            alignas(64) std::atomic<std::size_t> tail{0}; // next slot to push, written by the producer
+            public:
+                /**
+                 * @param capacity Rounded up to a power of two.
+                 */
+                explicit SpscRing(std::size_t capacity) {
+                    std::size_t size{1};
+                    while (size < capacity) {
+                        size <<= 1;
                     }
-                    result.push_back(std::move(row));
+                    slots.resize(size);
+                    mask = size - 1;
+                }
+                SpscRing(const SpscRing&) = delete;
+                SpscRing& operator=(const SpscRing&) = delete;
+                /**
+                 * @brief Append an item, from the producer thread.
+                 * @return bool False if the ring is full.
+                 */
+                bool push(const T& item) {
+                    const std::size_t t = tail.load(std::memory_order_relaxed);
+                    if (t - head.load(std::memory_order_acquire) == slots.size()) {
+                        return false;
+                    }
+                    slots[t & mask] = item;
+                    tail.store(t + 1, std::memory_order_release);
+                    return true;
+                }
+                /**
+                 * @brief Remove the oldest item, from the consumer thread.
+                 * @return bool False if the ring is empty.
+                 */
+                bool pop(T& item) {
+                    const std::size_t h = head.load(std::memory_order_relaxed);
+                    if (h == tail.load(std::memory_order_acquire)) {
+                        return false;
+                    }
+                    item = slots[h & mask];
+                    head.store(h + 1, std::memory_order_release);
+                    return true;
+                }
+                /**
+                 * @brief Approximate number of queued items, from any thread.
+                 */
+                std::size_t size() const {
+                    return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
                 }
+        };
+    }
+    /**
+     * @brief Configuration for a slow-query log.
+     */
+    struct SlowQueryLogConfig {
+        /**
+         * @brief File to append JSON lines to.
+         */
+        std::string path{};
+        /**
+         * @brief Statements taking at least this long are logged.
+         */
+        std::chrono::microseconds threshold{100000};
+        /**
+         * @brief Capture the query plan of slow statements.
+         *
+         * EXPLAIN QUERY PLAN on SQLite3. On PostgreSQL, SELECT statements, and WITH statements without
+         * INSERT, UPDATE, DELETE or MERGE, get EXPLAIN (ANALYZE, BUFFERS), which runs them a second time:
+         * effects that a rollback does not undo, such as nextval() or volatile functions, happen twice.
+         * Other statements get a plain EXPLAIN, which does not run them. Either way the EXPLAIN runs behind
+         * a savepoint that is rolled back, so an open transaction survives it. Failed statements are logged
+         * without a plan.
+         */
+        bool capture_plan{false};
+        /**
+         * @brief Fraction of slow statements that get a plan captured, in the range [0, 1].
+         */
+        double plan_sample_rate{1.0};
+        /**
+         * @brief Rotate the file once it grows past this size.
+         */
+        std::size_t max_file_size{64 * 1024 * 1024};
+        /**
+         * @brief Number of rotated files (path.1 through path.N) to keep.
+         */
+        std::size_t max_files{5};
+    };
+    /**
+     * @brief One slow-query log record.
+     */
+    struct SlowQueryEntry {
+        std::string backend{};
+        std::string database{};
+        std::string statement{};
+        std::vector<std::string> parameter_types{};
+        std::uint64_t rows{};
+        std::uint64_t duration_ns{};
+        std::string plan{};
+        std::string error{}; // empty if the statement succeeded
+    };
+    /**
+     * @brief Rotating JSON lines log of slow statements. May be shared between connections.
+     */
+    class SlowQueryLog {
+        SlowQueryLogConfig config{};
+        std::mutex mutex{};
+        std::ofstream file{};
+        std::size_t size{};
+        std::atomic<std::uint64_t> slow_count{};
 
-                sqlite3_finalize(stmt);
-                return result;
-            }
+        void rotate();
+        public:
             /**
-             * @brief Query the database, returning data.
-             * @param query Query to execute.
-             * @return std::vector<std::unordered_map<std::string, std::string>> Data.
+             * @brief Constructor.
+             * @param config Log configuration.
              */
-            std::vector<std::unordered_map<std::string, std::string>> query(const std::string& query);
+            explicit SlowQueryLog(SlowQueryLogConfig config);
             /**
-             * @brief Execute an SQL command.
-             * @param query Query to execute.
-             * @return bool True if successful.
+             * @brief Get the latency threshold.
+             * @return std::uint64_t Threshold in nanoseconds.
              */
-            bool exec(const std::string& query);
+            std::uint64_t threshold_ns() const;
             /**
-             * @brief Check if the database is good.
-             * @return bool True if good.
+             * @brief Decide whether the next slow statement gets its plan captured.
+             * @return bool True if the plan should be captured.
              */
-            bool good();
+            bool sample_plan();
             /**
-             * @brief Check if the database is open.
-             * @return bool True if open.
+             * @brief Append an entry to the log.
+             * @param entry Entry to write.
              */
-            bool is_open();
+            void write(const SlowQueryEntry& entry);
+    };
+    /**
+     * @brief Result cache counters.
+     */
+    struct ResultCacheStats {
+        std::uint64_t hits{};
+        std::uint64_t misses{};
+        std::uint64_t insertions{};
+        std::uint64_t evictions{};
+        std::uint64_t invalidations{}; // entries dropped by invalidate() and clear()
+        std::size_t entries{};
+        std::size_t bytes{};
+        std::size_t max_bytes{};
+
+        /**
+         * @brief Get the fraction of lookups that were hits.
+         * @return double Hit ratio in the range [0, 1].
+         */
+        double hit_ratio() const {
+            return hits + misses ? static_cast<double>(hits) / static_cast<double>(hits + misses) : 0.0;
+        }
+    };
+    /**
+     * @brief Thread-safe LRU cache of immutable query results, bounded by an approximate memory budget.
+     *
+     * Every entry carries a set of tags (table names, notification channels) and invalidate() drops
+     * all entries with a tag. Results computed before an invalidation are rejected by put(), so a
+     * reader racing a writer cannot reinsert stale data.
+     */
+    class ResultCache {
+        public:
+            using Result = std::vector<std::unordered_map<std::string, std::string>>;
+        private:
+            struct Entry {
+                std::string key{};
+                std::shared_ptr<const Result> result{};
+                std::vector<std::string> tags{};
+                std::size_t bytes{};
+            };
+
+            mutable std::mutex mutex{};
+            std::list<Entry> entries{}; // most recently used first
+            std::unordered_map<std::string, std::list<Entry>::iterator> index{};
+            std::unordered_map<std::string, std::unordered_set<std::string>> tagged{};
+            std::unordered_map<std::string, std::uint64_t> invalidated_at{};
+            std::uint64_t epoch{};
+            std::uint64_t cleared_at{};
+            std::size_t max_bytes{};
+            ResultCacheStats counters{};
+
+            void erase(std::list<Entry>::iterator it);
+        public:
             /**
-             * @brief Open a database from file.
-             * @param database Database to open.
+             * @brief Constructor.
+             * @param max_bytes Memory budget. Least recently used entries are evicted past it.
              */
-            void open(const std::string& database);
+            explicit ResultCache(std::size_t max_bytes = 16 * 1024 * 1024);
             /**
-             * @brief Close the open database.
+             * @brief Look up a result.
+             * @param key Cache key.
+             * @return std::shared_ptr<const Result> The cached result, nullptr on a miss.
              */
-            void close();
+            std::shared_ptr<const Result> get(const std::string& key);
             /**
-             * @brief Check if the database is empty.
-             * @return bool
+             * @brief Get the current generation. Take it before running a query and pass it to put().
+             * @return std::uint64_t Generation.
              */
-            bool empty();
+            std::uint64_t generation() const;
             /**
-             * @brief Validate an SQL statement.
-             * @param query Query to validate.
-             * @return bool True if valid.
+             * @brief Insert a result.
+             * @param key Cache key.
+             * @param result Result to cache.
+             * @param tags Tags to invalidate the result by.
+             * @param generation Generation taken before the result was computed.
+             * @return bool True if inserted, false if a tag was invalidated since generation or the result is over budget.
              */
-            bool validate(const std::string& query);
+            bool put(const std::string& key, std::shared_ptr<const Result> result, std::vector<std::string> tags, std::uint64_t generation);
             /**
-             * @brief Get the last insertion.
-             * @return std::int64_t Last insertion.
+             * @brief Drop all entries with a tag.
+             * @param tag Tag to invalidate.
              */
-            std::int64_t get_last_insertion();
+            void invalidate(const std::string& tag);
             /**
-             * @brief Constructor.
+             * @brief Drop all entries.
              */
-            SQLite3Database();
+            void clear();
             /**
-             * @brief Constructor.
-             * @param database Database to open.
+             * @brief Get the cache counters.
+             * @return ResultCacheStats Counters.
              */
-            SQLite3Database(const std::string& database);
+            ResultCacheStats stats() const;
             /**
-             * @brief Destructor.
+             * @brief Estimate the memory used by a result.
+             * @param result Result to measure.
+             * @return std::size_t Approximate size in bytes.
              */
-            ~SQLite3Database();
+            static std::size_t estimate_size(const Result& result);
     };
-#endif
-
-#ifdef SDB_POSTGRESQL
-    class PostgreSQLDatabase {
-            PGconn* pg_conn{};
-            std::string host{};
-            std::string user{};
-            std::string password{};
-            std::string database{};
-            bool is_good{false};
-            int port{5432};
-
-            template <typename T>
-            std::string to_string(const T& value) {
-                if constexpr (std::is_same_v<T, std::string>) {
-                    return value;
-                } else if constexpr (std::is_same_v<T, const char*>) {
-                    return std::string(value);
-                } else {
-                    return std::to_string(value);
+    /**
+     * @brief Output format of copy_out().
+     */
+    enum class ExportFormat {
+        Text, // PostgreSQL text COPY format: tab separated, \N for NULL
+        CSV,
+        Binary, // PostgreSQL binary COPY format, PostgreSQL only
+        NDJSON, // one JSON object per line, SQLite3 only
+    };
+    /**
+     * @brief Receives exported data in chunks. Return false to abort the export.
+     */
+    using ExportSink = std::function<bool(const char* data, std::size_t size)>;
+    /**
+     * @brief Input format of import_file().
+     */
+    enum class ImportFormat {
+        CSV,
+        NDJSON, // one flat JSON object per line, nested values are imported as their JSON text
+    };
+    /**
+     * @brief Type an imported or migrated column is converted to.
+     * PostgreSQL binary COPY sends these as text, bigint, double precision, boolean and bytea, so the
+     * target columns must have exactly those types; import into a staging table otherwise.
+     */
+    enum class ColumnType {
+        Text,
+        Integer,
+        Real,
+        Boolean,
+        Blob,
+    };
+    /**
+     * @brief Options for import_file().
+     */
+    struct ImportOptions {
+        ImportFormat format{ImportFormat::CSV};
+        /**
+         * @brief Field delimiter for CSV.
+         */
+        char delimiter{','};
+        /**
+         * @brief The first CSV record holds the column names.
+         */
+        bool header{true};
+        /**
+         * @brief Target columns, inserted verbatim. Empty to use the CSV header or the keys of the first NDJSON object.
+         * Without either, CSV fields are inserted into the table's columns in order.
+         */
+        std::vector<std::string> columns{};
+        /**
+         * @brief Type per column, missing entries are Text.
+         */
+        std::vector<ColumnType> types{};
+        /**
+         * @brief Rows per transaction on SQLite3, rows per COPY on PostgreSQL.
+         */
+        std::size_t batch_size{100000};
+        /**
+         * @brief Parser threads, 0 for one per hardware thread.
+         */
+        std::size_t threads{0};
+        /**
+         * @brief Approximate bytes of input per parse task.
+         */
+        std::size_t chunk_size{8 * 1024 * 1024};
+        /**
+         * @brief Create the table from columns and types if it does not exist.
+         */
+        bool create_table{false};
+    };
+    /**
+     * @brief Result of import_file().
+     */
+    struct ImportStats {
+        bool ok{false};
+        std::uint64_t rows{};    // rows in committed batches, or written into the caller's transaction
+        std::uint64_t skipped{}; // malformed records, or values that could not be converted for binary COPY
+        std::uint64_t bytes{};
+        std::string error{};
+    };
+    namespace detail {
+        /**
+         * @brief One parsed value, pointing into the mapped input or into the chunk's arena.
+         */
+        struct ImportField {
+            const char* data{};
+            std::size_t size{};
+            bool null{false};
+        };
+        /**
+         * @brief Records parsed from one chunk of input, row-major.
+         */
+        struct ImportChunk {
+            std::vector<ImportField> fields{};
+            std::deque<std::string> arena{}; // unescaped values, stable while the chunk lives
+            std::size_t rows{};
+            std::uint64_t skipped{};
+        };
+        /**
+         * @brief Read-only mapping of a whole file, unmapped on destruction. Without SDB_POSIX the file is read into memory.
+         */
+        struct MappedFile {
+            const char* data{};
+            std::size_t size{};
+            bool ok{false};
+#ifdef SDB_POSIX
+            explicit MappedFile(const std::string& path) {
+                const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+                if (fd < 0) {
+                    return;
                 }
-            }
 
-        std::string remove_non_utf8(const std::string& input) {
-#ifdef SDB_ENABLE_ICONV
-                iconv_t cd = iconv_open("UTF-8//IGNORE", "UTF-8");
-                if (cd == (iconv_t)-1) {
-                    throw std::runtime_error("iconv_open failed");
-                }
-
-                std::vector<char> output(input.size() * 2);
-                char* inbuf = const_cast<char*>(input.data());
-                size_t inbytesleft = input.size();
-                char* outbuf = output.data();
-                size_t outbytesleft = output.size();
-
-                while (inbytesleft > 0) {
-                    size_t result = iconv(cd, &inbuf, &inbytesleft, &outbuf, &outbytesleft);
-                    if (result == (size_t)-1) {
-                        if (errno == EILSEQ || errno == EINVAL) {
-                            ++inbuf;
-                            --inbytesleft;
-                        } else if (errno == E2BIG) {
-                            size_t used = output.size() - outbytesleft;
-                            output.resize(output.size() * 2);
-                            outbuf = output.data() + used;
-                            outbytesleft = output.size() - used;
+                struct stat st{};
+                if (fstat(fd, &st) == 0) {
+                    size = static_cast<std::size_t>(st.st_size);
+                    ok = true;
+                    if (size > 0) {
+                        void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+                        if (map == MAP_FAILED) {
+                            ok = false;
+                            size = 0;
                         } else {
-                            iconv_close(cd);
-                            return "";
+                            madvise(map, size, MADV_SEQUENTIAL);
+                            data = static_cast<const char*>(map);
                         }
                     }
                 }
-
-                iconv_close(cd);
-                return std::string(output.data(), output.size() - outbytesleft);
-#else
-                return input;
-#endif
+                ::close(fd);
             }
-        public:
-            template <typename... Args>
-            bool exec(const std::string& query, Args... args) {
-                static_assert(sizeof...(args) > 0, "exec() requires more parameters");
-                if (!this->is_good) {
-                    return false;
+            MappedFile(const MappedFile&) = delete;
+            MappedFile& operator=(const MappedFile&) = delete;
+            ~MappedFile() {
+                if (data) {
+                    munmap(const_cast<char*>(data), size);
                 }
+            }
+#else
+            std::string buffer{};
 
-                int i{1};
-                std::string nq{};
-                for (char ch : query) {
-                    if (ch == '?') {
-                        nq += "$" + std::to_string(i++);
-                    } else {
-                        nq += ch;
-                    }
+            explicit MappedFile(const std::string& path) {
+                std::ifstream file(path, std::ios::binary);
+                if (!file) {
+                    return;
                 }
+                buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+                data = buffer.empty() ? nullptr : buffer.data();
+                size = buffer.size();
+                ok = !file.bad();
+            }
+            MappedFile(const MappedFile&) = delete;
+            MappedFile& operator=(const MappedFile&) = delete;
+#endif
+        };
 
-                std::vector<std::string> str{remove_non_utf8(to_string(args))...};
-                std::vector<const char*> param_v{};
-                for (const std::string& s : str) {
-#ifdef SDB_ENABLE_PRINTDEBUG
-                    std::cerr << "Binding string: " << s << "\n";
+        const char* find_any(const char* p, const char* end, char a, char b, char c, char d);
+        const char* next_record(const char* from, const char* target, const char* end, bool csv);
+        const char* parse_csv_record(const char* p, const char* end, char delimiter, std::vector<ImportField>& row, std::deque<std::string>& arena);
+        void parse_csv(const char* begin, const char* end, char delimiter, std::size_t columns, ImportChunk& out);
+        const char* parse_json_string(const char* p, const char* end, ImportField& field, std::deque<std::string>& arena);
+        template <typename F>
+        bool parse_json_object(const char* p, const char* end, std::deque<std::string>& arena, F&& on_field);
+        void parse_ndjson(const char* begin, const char* end, const std::unordered_map<std::string, std::size_t>& index, std::size_t columns, ImportChunk& out);
+        bool import_integer(const ImportField& field, std::int64_t& value);
+        std::string quote_name(const std::string& name);
+        bool import_real(const ImportField& field, double& value);
+        bool import_boolean(const ImportField& field, bool& value);
+        template <typename Writer>
+        ImportStats run_import(const std::string& path, const ImportOptions& options, Writer& writer);
+        struct TableMigration;
+
+        void append_csv_field(std::string& out, const char* data, std::size_t size);
+        void append_text_field(std::string& out, const char* data, std::size_t size);
+        void append_json_string(std::string& out, const char* data, std::size_t size);
+        void append_hex(std::string& out, const unsigned char* data, std::size_t size);
+#ifdef SDB_POSIX
+        ExportSink fd_sink(int fd);
+#endif
+    }
+#ifdef SDB_SQLITE3
+    /**
+     * @brief Temporary storage for data. Do not use this directly.
+     */
+    inline std::vector<std::unordered_map<std::string, std::string>> tmp{};
+    /**
+     * @brief Callback function for sqlite3_exec.
+     *
+     * @param data Pointer to the result vector, or nullptr to append to tmp.
+     * @param argc Number of columns.
+     * @param argv Column values.
+     * @param name Column names.
+     * @return int 0.
+     */
+    int callback(void* data, int argc, char** argv, char** name);
+    /**
+     * @brief Configuration for the SQLite3 pool allocator, which serves every SQLite heap allocation in the process.
+     */
+    struct PoolAllocatorConfig {
+        /**
+         * @brief Block sizes served from the thread-local pools, in ascending order.
+         * Allocations larger than the last size go straight to the system allocator.
+         */
+        std::vector<std::size_t> size_classes{16, 32, 64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384};
+        /**
+         * @brief Maximum number of free blocks each thread keeps per size class.
+         */
+        std::size_t max_cached_per_class{256};
+        /**
+         * @brief Page cache slot size for SQLITE_CONFIG_PAGECACHE, 0 to leave unset.
+         * Added as an extra size class so overflow pages are pooled too.
+         */
+        int page_cache_size{0};
+        /**
+         * @brief Number of page cache slots for SQLITE_CONFIG_PAGECACHE.
+         */
+        int page_cache_count{0};
+        /**
+         * @brief Lookaside slot size for SQLITE_CONFIG_LOOKASIDE, 0 to leave unset.
+         */
+        int lookaside_size{0};
+        /**
+         * @brief Number of lookaside slots per connection for SQLITE_CONFIG_LOOKASIDE.
+         */
+        int lookaside_count{0};
+    };
+    /**
+     * @brief Counters for one size class of the SQLite3 pool allocator.
+     */
+    struct PoolAllocatorStats {
+        std::size_t size{}; // block size, 0 for oversized allocations
+        std::uint64_t allocations{};
+        std::uint64_t frees{};
+        std::uint64_t pool_hits{}; // allocations served from a thread-local free list
+        std::uint64_t in_use{};
+        std::uint64_t cached{}; // free blocks currently held by thread-local pools
+    };
+    /**
+     * @brief Install a size-class pool allocator as SQLite's memory allocator.
+     *
+     * The allocator replaces sqlite3_malloc() for the whole process, so it backs the allocations of
+     * every connection: prepared statements, result rows, schema, and page cache and lookaside
+     * overflow. Blocks are pooled per thread and size class, not per connection or statement.
+     * Must be called before any database is opened (or after sqlite3_shutdown()),
+     * since SQLite only accepts SQLITE_CONFIG_* changes while uninitialized.
+     * @param config Allocator configuration.
+     * @return bool True if SQLite accepted the configuration.
+     */
+    bool install_pool_allocator(const PoolAllocatorConfig& config = {});
+    /**
+     * @brief Get per-size-class statistics for the pool allocator.
+     * @return std::vector<PoolAllocatorStats> One entry per size class, followed by oversized allocations.
+     */
+    std::vector<PoolAllocatorStats> get_pool_allocator_stats();
 #endif
-                    param_v.push_back(s.c_str());
+#ifdef SDB_SQLITE3
+    /**
+     * @brief Profile of one normalized SQLite3 statement text, accumulated over all executions.
+     */
+    struct SQLite3ProfileEntry {
+        std::string statement{};
+        std::uint64_t calls{};
+        std::uint64_t total_ns{};
+        std::uint64_t max_ns{};
+        std::uint64_t fullscan_steps{}; // SQLITE_STMTSTATUS_FULLSCAN_STEP
+        std::uint64_t sorts{}; // SQLITE_STMTSTATUS_SORT
+        std::uint64_t autoindexes{}; // SQLITE_STMTSTATUS_AUTOINDEX
+        std::uint64_t vm_steps{}; // SQLITE_STMTSTATUS_VM_STEP
+
+        /**
+         * @brief Check if the statement stepped through a full table scan.
+         * @return bool True if a full scan was seen.
+         */
+        bool full_scan() const {
+            return fullscan_steps > 0;
+        }
+        /**
+         * @brief Check if SQLite had to build an automatic index, which usually means an index is missing.
+         * @return bool True if an automatic index was created.
+         */
+        bool auto_index() const {
+            return autoindexes > 0;
+        }
+    };
+    /**
+     * @brief Policy of the background WAL checkpointer, see SQLite3Database::start_checkpointer().
+     */
+    struct CheckpointOptions {
+        /**
+         * @brief Frames appended to the WAL since the last checkpoint that trigger a PASSIVE checkpoint.
+         */
+        int wal_frames{1000};
+        /**
+         * @brief WAL size in frames past which a PASSIVE checkpoint that could not finish escalates to RESTART.
+         */
+        int restart_frames{10000};
+        /**
+         * @brief WAL file size past which a TRUNCATE checkpoint shrinks the file, 0 to never truncate.
+         */
+        std::int64_t truncate_bytes{64 * 1024 * 1024};
+        /**
+         * @brief Longest time between checkpoints while the WAL has changed, including writes from other connections.
+         */
+        std::chrono::milliseconds interval{1000};
+        /**
+         * @brief Longest a RESTART or TRUNCATE checkpoint waits for readers and writers.
+         */
+        std::chrono::milliseconds busy_timeout{100};
+    };
+    /**
+     * @brief Counters of the background WAL checkpointer.
+     */
+    struct CheckpointStats {
+        std::uint64_t checkpoints{};
+        std::uint64_t passive{};
+        std::uint64_t restart{};
+        std::uint64_t truncate{};
+        std::uint64_t busy{};                     // checkpoints that returned SQLITE_BUSY and were left for the next run
+        std::int64_t wal_frames{};                // frames in the WAL after the last checkpoint
+        std::int64_t checkpointed_frames{};       // of which copied back into the database
+        std::int64_t wal_bytes{};                 // size of the -wal file
+        std::chrono::nanoseconds last_duration{};
+        std::chrono::nanoseconds max_duration{};
+        std::chrono::nanoseconds total_duration{};
+        std::string error{};                      // last error, empty once a checkpoint succeeds
+    };
+    /**
+     * @brief Backoff of the busy handler, see SQLite3Database::enable_busy_handler().
+     */
+    struct BusyOptions {
+        /**
+         * @brief Sleep before the first retry of a locked statement.
+         */
+        std::chrono::microseconds initial_delay{100};
+        /**
+         * @brief Longest sleep between two retries.
+         */
+        std::chrono::microseconds max_delay{50000};
+        /**
+         * @brief Growth of the sleep per retry.
+         */
+        double multiplier{2.0};
+        /**
+         * @brief Fraction of each sleep that is randomized, 0 for none, 1 for full jitter.
+         */
+        double jitter{0.5};
+        /**
+         * @brief Longest total wait for one lock before SQLITE_BUSY is returned.
+         */
+        std::chrono::milliseconds max_wait{5000};
+        /**
+         * @brief Attempts of transaction() at BEGIN and COMMIT before it gives up.
+         */
+        int max_attempts{5};
+    };
+    /**
+     * @brief Lock contention counters of one connection.
+     */
+    struct BusyStats {
+        std::uint64_t busy_events{};          // statements that found the database locked
+        std::uint64_t retries{};              // sleeps in the busy handler
+        std::uint64_t timeouts{};             // busy events that gave up after max_wait
+        std::uint64_t transaction_retries{};  // BEGIN or COMMIT retried by transaction()
+        std::chrono::nanoseconds wait_time{}; // total time slept in the busy handler
+        std::chrono::nanoseconds max_wait_time{}; // longest single busy event
+    };
+    namespace detail {
+        /**
+         * @brief Background checkpointer of one connection, which checkpoints through its own connection.
+         */
+        struct SQLite3CheckpointState {
+            CheckpointOptions options{};
+            std::string wal_path{};
+            std::mutex mutex{};
+            std::condition_variable cv{};
+            CheckpointStats stats{};
+            std::thread thread{};
+            bool stop{false};
+
+            // written by the WAL hook on the writer's thread
+            std::atomic<int> frames{0};
+            std::atomic<int> base{0}; // WAL size at the last checkpoint
+            std::atomic<bool> signaled{false};
+
+            /**
+             * @brief Count the frames of a commit and wake the thread once enough have accumulated.
+             */
+            void committed(int count) {
+                if (count < frames.exchange(count, std::memory_order_relaxed)) {
+                    base.store(0, std::memory_order_relaxed); // a writer restarted the WAL from the beginning
                 }
+                if (count - base.load(std::memory_order_relaxed) >= options.wal_frames && !signaled.exchange(true)) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    cv.notify_one();
+                }
+            }
+        };
+        /**
+         * @brief Return and argument types of a callable, deduced from its call operator.
+         */
+        template <typename F>
+        struct FunctionTraits : FunctionTraits<decltype(&F::operator())> {};
+        template <typename R, typename... Args>
+        struct FunctionTraits<R(*)(Args...)> {
+            using result = R;
+            using args = std::tuple<std::decay_t<Args>...>;
+        };
+        template <typename C, typename R, typename... Args>
+        struct FunctionTraits<R(C::*)(Args...)> : FunctionTraits<R(*)(Args...)> {};
+        template <typename C, typename R, typename... Args>
+        struct FunctionTraits<R(C::*)(Args...) const> : FunctionTraits<R(*)(Args...)> {};
 
-                PGresult* res = PQexecParams(pg_conn, nq.c_str(), param_v.size(), nullptr, param_v.data(), nullptr, nullptr, 0);
+        template <typename T>
+        struct is_optional : std::false_type {};
+        template <typename T>
+        struct is_optional<std::optional<T>> : std::true_type {};
 
-                if (PQresultStatus(res) != PGRES_COMMAND_OK) {
-                    PQclear(res);
-                    return false;
+        /**
+         * @brief Convert an SQL function argument. Text and blob views are valid for the duration of the call.
+         */
+        template <typename T>
+        T sqlite3_argument(sqlite3_value* value) {
+            if constexpr (std::is_same_v<T, sqlite3_value*>) {
+                return value;
+            } else if constexpr (is_optional<T>::value) {
+                if (sqlite3_value_type(value) == SQLITE_NULL) {
+                    return std::nullopt;
+                }
+                return sqlite3_argument<typename T::value_type>(value);
+            } else if constexpr (std::is_same_v<T, bool>) {
+                return sqlite3_value_int64(value) != 0;
+            } else if constexpr (std::is_integral_v<T>) {
+                return static_cast<T>(sqlite3_value_int64(value));
+            } else if constexpr (std::is_floating_point_v<T>) {
+                return static_cast<T>(sqlite3_value_double(value));
+            } else if constexpr (std::is_same_v<T, std::string> || std::is_same_v<T, std::string_view>) {
+                const auto* text = reinterpret_cast<const char*>(sqlite3_value_text(value));
+                return T(text ? text : "", static_cast<std::size_t>(sqlite3_value_bytes(value)));
+            } else if constexpr (std::is_same_v<T, BlobView>) {
+                const void* data = sqlite3_value_blob(value);
+                return BlobView{data, static_cast<std::size_t>(sqlite3_value_bytes(value))};
+            } else {
+                static_assert(sizeof(T) == 0, "unsupported SQL function argument type");
+            }
+        }
+        /**
+         * @brief Set the result of an SQL function from a C++ value.
+         */
+        template <typename T>
+        void sqlite3_set_result(sqlite3_context* ctx, const T& value) {
+            if constexpr (is_optional<T>::value) {
+                if (!value) {
+                    sqlite3_result_null(ctx);
+                } else {
+                    sqlite3_set_result(ctx, *value);
                 }
+            } else if constexpr (std::is_same_v<T, std::nullptr_t>) {
+                sqlite3_result_null(ctx);
+            } else if constexpr (std::is_integral_v<T>) {
+                sqlite3_result_int64(ctx, static_cast<sqlite3_int64>(value));
+            } else if constexpr (std::is_floating_point_v<T>) {
+                sqlite3_result_double(ctx, static_cast<double>(value));
+            } else if constexpr (std::is_same_v<T, std::string> || std::is_same_v<T, std::string_view>) {
+                sqlite3_result_text64(ctx, value.data(), value.size(), SQLITE_TRANSIENT, SQLITE_UTF8);
+            } else if constexpr (std::is_convertible_v<T, const char*>) {
+                sqlite3_result_text(ctx, value, -1, SQLITE_TRANSIENT);
+            } else if constexpr (std::is_same_v<T, BlobView>) {
+                sqlite3_result_blob64(ctx, value.data ? value.data : "", value.size, SQLITE_TRANSIENT);
+            } else {
+                static_assert(sizeof(T) == 0, "unsupported SQL function result type");
+            }
+        }
+        /**
+         * @brief Call a function with its leading arguments followed by the converted SQL arguments.
+         */
+        template <typename Args, typename F, std::size_t... I, typename... Leading>
+        decltype(auto) sqlite3_invoke(F& fn, sqlite3_value** argv, std::index_sequence<I...>, Leading&... leading) {
+            return fn(leading..., sqlite3_argument<std::tuple_element_t<I, Args>>(argv[I])...);
+        }
+        /**
+         * @brief Tuple without its first element, the state parameter of an aggregate step function.
+         */
+        template <typename T>
+        struct TupleTail;
+        template <typename T, typename... Ts>
+        struct TupleTail<std::tuple<T, Ts...>> {
+            using type = std::tuple<Ts...>;
+        };
+        /**
+         * @brief State of the current group of an aggregate. The aggregate context only holds a pointer,
+         * so the state can be any C++ type.
+         */
+        template <typename State>
+        State* sqlite3_aggregate_state(sqlite3_context* ctx, bool create) {
+            auto** slot = static_cast<State**>(sqlite3_aggregate_context(ctx, create ? static_cast<int>(sizeof(State*)) : 0));
+            if (!slot) {
+                return nullptr;
+            }
+            if (!*slot && create) {
+                *slot = new State();
+            }
+            return *slot;
+        }
+        /**
+         * @brief Step and final functions of a registered aggregate.
+         */
+        template <typename Step, typename Final>
+        struct SQLite3Aggregate {
+            Step step;
+            Final final;
+        };
+        /**
+         * @brief Busy handler state of one connection.
+         */
+        struct SQLite3BusyState {
+            BusyOptions options{};
+            std::mutex mutex{};
+            BusyStats stats{};
+            std::minstd_rand rng{std::random_device{}()};
+            std::chrono::steady_clock::time_point event_start{};
 
-                PQclear(res);
-                return true;
+            /**
+             * @brief Sleep for a retry, exponential in the attempt and jittered so that contending processes spread out.
+             */
+            std::chrono::microseconds delay(int attempt) {
+                const double base = std::min(static_cast<double>(options.max_delay.count()),
+                    static_cast<double>(options.initial_delay.count()) * std::pow(std::max(options.multiplier, 1.0), attempt));
+                const double jitter = std::clamp(options.jitter, 0.0, 1.0);
+
+                std::lock_guard<std::mutex> lock(mutex);
+                const double random = std::uniform_real_distribution<double>(1.0 - jitter, 1.0)(rng);
+                return std::chrono::microseconds(static_cast<std::int64_t>(base * random));
             }
+        };
+        struct SQLite3Profiler {
+            std::mutex mutex{};
+            std::unordered_map<std::string, SQLite3ProfileEntry> entries{};
+        };
+        /**
+         * @brief Tables a statement reads and writes, collected by the authorizer while it is prepared.
+         */
+        struct SQLite3TableCollector {
+            std::vector<std::string> reads{};
+            std::vector<std::string> writes{};
+            bool schema_change{false};
+            bool read_only{true};
+            bool deterministic{true}; // false if the statement calls a function whose result may change between calls
+        };
+        /**
+         * @brief Collector for the statement being prepared on this thread, nullptr when not collecting.
+         */
+        inline thread_local SQLite3TableCollector* table_collector{};
+        /**
+         * @brief Result cache of one connection plus the tables written by its open transaction.
+         */
+        struct SQLite3CacheState {
+            ResultCache cache;
+            std::mutex mutex{};
+            std::unordered_set<std::string> pending{};
+            bool pending_all{false};
 
-            template <typename... Args>
-            std::vector<std::unordered_map<std::string, std::string>> query(const std::string& query, Args... args) {
-                static_assert(sizeof...(args) > 0, "query() requires more parameters");
-                if (!this->is_good) {
-                    return {};
-                }
+            explicit SQLite3CacheState(std::size_t max_bytes) : cache(max_bytes) {}
 
-                int n{1};
-                std::string nq{};
-                for (char ch : query) {
-                    if (ch == '?') {
-                        nq += "$" + std::to_string(n++);
-                    } else {
-                        nq += ch;
-                    }
+            void mark_dirty(const SQLite3TableCollector& tables) {
+                std::lock_guard<std::mutex> lock(mutex);
+                pending.insert(tables.writes.begin(), tables.writes.end());
+                pending_all = pending_all || tables.schema_change;
+            }
+            void mark_dirty(const std::string& table) {
+                std::lock_guard<std::mutex> lock(mutex);
+                pending.insert(table);
+            }
+            void flush() {
+                std::unordered_set<std::string> tables{};
+                bool all{};
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    tables.swap(pending);
+                    all = std::exchange(pending_all, false);
                 }
-
-                std::vector<std::string> str{to_string(args)...};
-                std::vector<const char*> param_v{};
-                for (const std::string& s : str) {
-                    param_v.push_back(s.c_str());
+                if (all) {
+                    cache.clear();
+                    return;
+                }
+                for (const auto& table : tables) {
+                    cache.invalidate(table);
                 }
+            }
+            void discard() {
+                std::lock_guard<std::mutex> lock(mutex);
+                pending.clear();
+                pending_all = false;
+            }
+        };
+        /**
+         * @brief A committed row change, identified by table and rowid.
+         */
+        struct SQLite3Change {
+            std::uint32_t table{};
+            std::int64_t rowid{};
+            std::int64_t commit_ns{};
+        };
+        /**
+         * @brief Row changes recorded by the update hook, queued for a consumer thread when their transaction commits.
+         *
+         * The commit hook runs before the commit is visible to other connections, so it only stages the
+         * changes; the WAL hook, which runs once the commit is done, publishes them. The hooks run under the
+         * connection's mutex, so pushes come from one thread at a time and the ring's single-producer side
+         * holds. When the ring is full, changes go to a locked overflow list.
+         */
+        struct SQLite3ChangeCapture {
+            static constexpr std::uint32_t ignored{UINT32_MAX};
 
-                PGresult* res = PQexecParams(pg_conn, nq.c_str(), param_v.size(), nullptr, param_v.data(), nullptr, nullptr, 0);
+            SpscRing<SQLite3Change> ring;
+            std::unordered_set<std::string> filter{};
+            std::vector<SQLite3Change> pending{};
+            std::vector<SQLite3Change> staged{}; // committing, not yet visible to other connections
+            std::string last_name{};
+            std::uint32_t last_id{ignored};
+            std::mutex overflow_mutex{};
+            std::vector<SQLite3Change> overflow{};
+            std::mutex names_mutex{};
+            std::vector<std::string> names{};
+            std::unordered_map<std::string, std::uint32_t> ids{};
+            std::atomic<std::uint64_t> captured{0};
+            std::atomic<std::uint64_t> overflowed{0};
 
-                if (PQresultStatus(res) != PGRES_TUPLES_OK) {
-                    PQclear(res);
-                    return {};
+            SQLite3ChangeCapture(std::size_t capacity, const std::vector<std::string>& tables) : ring(capacity) {
+                for (const auto& it : tables) {
+                    filter.insert(lower(it));
+                }
+            }
+            static std::string lower(std::string name) {
+                std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+                return name;
+            }
+            void record(const char* schema, const char* table, std::int64_t rowid) {
+                if (!schema || !table || std::strcmp(schema, "main") != 0) {
+                    return;
+                }
+                if (last_name != table) {
+                    last_name = table;
+                    last_id = intern(last_name);
+                }
+                if (last_id != ignored) {
+                    pending.push_back({last_id, rowid, 0});
+                }
+            }
+            std::uint32_t intern(const std::string& table) {
+                std::string key = lower(table);
+                if (!filter.empty() && filter.find(key) == filter.end()) {
+                    return ignored;
                 }
 
-                std::vector<std::unordered_map<std::string, std::string>> result;
-                int nrows = PQntuples(res);
-                int nfields = PQnfields(res);
+                std::lock_guard<std::mutex> lock(names_mutex);
+                if (const auto it = ids.find(key); it != ids.end()) {
+                    return it->second;
+                }
+                const auto id = static_cast<std::uint32_t>(names.size());
+                names.push_back(table);
+                ids.emplace(std::move(key), id);
+                return id;
+            }
+            std::string name(std::uint32_t id) {
+                std::lock_guard<std::mutex> lock(names_mutex);
+                return names.at(id);
+            }
+            void commit() {
+                staged.insert(staged.end(), pending.begin(), pending.end());
+                pending.clear();
+            }
+            void publish() {
+                if (staged.empty()) {
+                    return;
+                }
 
-                for (int i = 0; i < nrows; ++i) {
-                    std::unordered_map<std::string, std::string> row;
-                    for (int j = 0; j < nfields; ++j) {
-                        row[PQfname(res, j)] = PQgetvalue(res, i, j);
+                const std::int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+                for (auto& change : staged) {
+                    change.commit_ns = now;
+                    if (!ring.push(change)) {
+                        std::lock_guard<std::mutex> lock(overflow_mutex);
+                        overflow.push_back(change);
+                        overflowed.fetch_add(1, std::memory_order_relaxed);
                     }
-                    result.push_back(std::move(row));
                 }
+                captured.fetch_add(staged.size(), std::memory_order_release);
+                staged.clear();
+            }
+            void rollback() {
+                // a rollback after the commit hook means the commit itself failed
+                pending.clear();
+                staged.clear();
+            }
+        };
+#ifdef SDB_POSIX
+        /**
+         * @brief Private read-only mapping of a database image file, unmapped on destruction.
+         */
+        struct SQLite3MappedImage {
+            void* data{MAP_FAILED};
+            std::size_t size{};
 
-                PQclear(res);
-                return result;
+            SQLite3MappedImage() = default;
+            SQLite3MappedImage(const SQLite3MappedImage&) = delete;
+            SQLite3MappedImage& operator=(const SQLite3MappedImage&) = delete;
+            ~SQLite3MappedImage() {
+                if (data != MAP_FAILED) {
+                    munmap(data, size);
+                }
             }
-            std::vector<std::unordered_map<std::string, std::string>> query(const std::string& query);
-            bool exec(const std::string& query);
-            bool good();
-            bool is_open();
-            void open(const std::string& host, const std::string& user, const std::string& password, const std::string& database, int port=5432);
-            void close();
-            bool empty();
-            bool validate(const std::string& query);
-            std::int64_t get_last_insertion();
-            PostgreSQLDatabase() = default;
-            PostgreSQLDatabase(const std::string& host, const std::string& user, const std::string& password, const std::string& database, int port=5432);
-            ~PostgreSQLDatabase();
-    };
+        };
 #endif
-}
-
-#ifdef SDB_SQLITE3
-inline int sdatabase::callback(void* data, int argc, char** argv, char** name) {
-    (void)data;
-
-    std::unordered_map<std::string, std::string> map{};
-    for (int i{0}; i < argc; i++) {
-        map[name[i]] = argv[i] ? argv[i] : "";
     }
+    /**
+     * @brief Handle for incremental I/O on a single SQLite3 blob. Obtain one through SQLite3Database::open_blob().
+     */
+    class SQLite3Blob {
+        sqlite3_blob* blob{};
 
-    tmp.push_back(std::move(map));
+        friend class SQLite3Database;
+        explicit SQLite3Blob(sqlite3_blob* blob) : blob(blob) {}
+        public:
+            SQLite3Blob() = default;
+            SQLite3Blob(const SQLite3Blob&) = delete;
+            SQLite3Blob& operator=(const SQLite3Blob&) = delete;
+            SQLite3Blob(SQLite3Blob&& other) noexcept;
+            SQLite3Blob& operator=(SQLite3Blob&& other) noexcept;
+            /**
+             * @brief Check if the blob is open.
+             * @return bool True if open.
+             */
+            bool good() const;
+            /**
+             * @brief Get the size of the blob. Blobs cannot be resized through this handle.
+             * @return int Size in bytes.
+             */
+            int size() const;
+            /**
+             * @brief Read part of the blob into a buffer.
+             * @param buffer Buffer of at least n bytes.
+             * @param n Number of bytes to read.
+             * @param offset Offset into the blob.
+             * @return bool True if successful.
+             */
+            bool read(void* buffer, int n, int offset);
+            /**
+             * @brief Write a buffer into part of the blob.
+             * @param buffer Data to write.
+             * @param n Number of bytes to write.
+             * @param offset Offset into the blob.
+             * @return bool True if successful.
+             */
+            bool write(const void* buffer, int n, int offset);
+            /**
+             * @brief Point the handle at the same column of another row, without preparing a new statement.
+             * @param rowid Row to move to.
+             * @return bool True if successful. The handle is unusable on failure.
+             */
+            bool reopen(std::int64_t rowid);
+            /**
+             * @brief Stream the whole blob to an output stream in chunks.
+             * @param os Stream to write to.
+             * @param chunk_size Bytes per read.
+             * @return bool True if successful.
+             */
+            bool read_to(std::ostream& os, int chunk_size = 64 * 1024);
+            /**
+             * @brief Fill the blob from an input stream in chunks, starting at an offset.
+             * @param is Stream to read from, until EOF or the blob is full.
+             * @param offset Offset into the blob.
+             * @param chunk_size Bytes per write.
+             * @return int Number of bytes written, or -1 on failure.
+             */
+            int write_from(std::istream& is, int offset = 0, int chunk_size = 64 * 1024);
+            /**
+             * @brief Close the blob.
+             */
+            void close();
+            /**
+             * @brief Destructor.
+             */
+            ~SQLite3Blob();
+    };
+    /**
+     * @brief Lazy range over a table in key order, read one page at a time with keyset predicates.
+     * Obtain one through SQLite3Database::scan(). Must not outlive the database.
+     *
+     * Each page runs WHERE (keys) > (last keys) ORDER BY keys LIMIT page_size on a statement prepared once,
+     * so with an index on the keys every page costs the same, however deep into the table it is.
+     */
+    class SQLite3Scan {
+        sqlite3_stmt* first{};
+        sqlite3_stmt* next{};
+        sqlite3_stmt* current{};
+        std::vector<int> key_index{};
+        std::vector<sqlite3_value*> last{};
+        std::int64_t page_size{};
+        std::int64_t page_rows{};
+        std::unordered_map<std::string, std::string> row{};
+        bool started{false};
+        bool done{false};
+        bool failed{false};
 
-    return 0;
-}
+        friend class SQLite3Database;
+        SQLite3Scan(sqlite3_stmt* first, sqlite3_stmt* next, std::vector<int> key_index, std::int64_t page_size);
+        bool advance();
+        void release();
+        public:
+            /**
+             * @brief Input iterator over the rows of a scan.
+             */
+            class iterator {
+                SQLite3Scan* scan{};
+                public:
+                    using iterator_category = std::input_iterator_tag;
+                    using value_type = std::unordered_map<std::string, std::string>;
+                    using difference_type = std::ptrdiff_t;
+                    using pointer = const value_type*;
+                    using reference = const value_type&;
 
-inline sdatabase::SQLite3Database::SQLite3Database(const std::string& database) {
-    if (sqlite3_open(database.c_str(), &this->sqlite3_db)) {
-        return;
-    }
+                    iterator() = default;
+                    explicit iterator(SQLite3Scan* scan) : scan(scan) {}
+                    reference operator*() const {
+                        return scan->row;
+                    }
+                    pointer operator->() const {
+                        return &scan->row;
+                    }
+                    iterator& operator++() {
+                        if (!scan->advance()) {
+                            scan = nullptr;
+                        }
+                        return *this;
+                    }
+                    void operator++(int) {
+                        ++*this;
+                    }
+                    bool operator==(const iterator& other) const {
+                        return scan == other.scan;
+                    }
+                    bool operator!=(const iterator& other) const {
+                        return scan != other.scan;
+                    }
+            };
 
-    this->database = database;
-    this->is_good = true;
-}
+            SQLite3Scan() = default;
+            SQLite3Scan(const SQLite3Scan&) = delete;
+            SQLite3Scan& operator=(const SQLite3Scan&) = delete;
+            SQLite3Scan(SQLite3Scan&& other) noexcept;
+            SQLite3Scan& operator=(SQLite3Scan&& other) noexcept;
+            /**
+             * @brief Check if the scan was set up and no page has failed.
+             * @return bool True if good.
+             */
+            bool good() const;
+            /**
+             * @brief Start the scan. The range can only be iterated once.
+             * @return iterator Iterator to the first row.
+             */
+            iterator begin();
+            /**
+             * @brief Get the end of the range.
+             * @return iterator End iterator.
+             */
+            iterator end();
+            /**
+             * @brief Destructor.
+             */
+            ~SQLite3Scan();
+    };
+#ifdef SDB_SQLITE3_SESSION
+    /**
+     * @brief Reason a change could not be applied as recorded.
+     */
+    enum class ChangesetConflict {
+        Data,       // the row exists but its old values differ
+        NotFound,   // the row to update or delete does not exist
+        Conflict,   // an inserted row already exists
+        Constraint, // the change violates a constraint
+        ForeignKey, // the applied changeset leaves foreign key violations
+    };
+    /**
+     * @brief Resolution returned by a conflict handler.
+     * Replace is only valid for Data and Conflict, and is treated as Omit otherwise.
+     */
+    enum class ConflictAction {
+        Omit,
+        Replace,
+        Abort,
+    };
+    /**
+     * @brief Handler for conflicts during SQLite3Database::apply_changeset(), given the kind of conflict and the table.
+     */
+    using ConflictHandler = std::function<ConflictAction(ChangesetConflict, const std::string&)>;
+    /**
+     * @brief Records changes to attached tables with the session extension.
+     * Obtain one through SQLite3Database::create_session(). Must be closed before the database.
+     *
+     * Only tables with a primary key are recorded. Changesets hold the old and new values of every
+     * changed row, patchsets only the primary key and new values, and are smaller but cannot detect
+     * Data conflicts.
+     */
+    class SQLite3Session {
+        sqlite3* sqlite3_db{};
+        sqlite3_session* session{};
+        std::string schema{};
+        std::vector<std::string> tables{};
+        bool all_tables{false};
+        bool enabled{true};
 
-inline sdatabase::SQLite3Database::SQLite3Database() {
-    this->is_good = false;
-}
+        friend class SQLite3Database;
+        SQLite3Session(sqlite3* sqlite3_db, sqlite3_session* session, std::string schema)
+            : sqlite3_db(sqlite3_db), session(session), schema(std::move(schema)) {}
+        std::string take(bool patchset, bool restart);
+        public:
+            SQLite3Session() = default;
+            SQLite3Session(const SQLite3Session&) = delete;
+            SQLite3Session& operator=(const SQLite3Session&) = delete;
+            SQLite3Session(SQLite3Session&& other) noexcept;
+            SQLite3Session& operator=(SQLite3Session&& other) noexcept;
+            /**
+             * @brief Check if the session was created.
+             * @return bool True if good.
+             */
+            bool good() const;
+            /**
+             * @brief Start recording a table.
+             * @param table Table name, empty for every table including ones created later.
+             * @return bool True if successful.
+             */
+            bool attach(const std::string& table = "");
+            /**
+             * @brief Pause or resume recording.
+             * @param enable True to record.
+             * @return bool True if successful.
+             */
+            bool enable(bool enable = true);
+            /**
+             * @brief Check if no changes have been recorded.
+             * @return bool True if empty.
+             */
+            bool empty() const;
+            /**
+             * @brief Get the changes recorded so far as a changeset.
+             * @return std::string Binary changeset, empty if nothing changed or on failure.
+             */
+            std::string changeset();
+            /**
+             * @brief Get the changes recorded so far as a patchset.
+             * @return std::string Binary patchset, empty if nothing changed or on failure.
+             */
+            std::string patchset();
+            /**
+             * @brief Get the changes recorded so far and start over with the same tables.
+             * Call after each COMMIT to collect one changeset per transaction.
+             * @param patchset True for a patchset instead of a changeset.
+             * @return std::string Binary changeset or patchset, empty if nothing changed.
+             */
+            std::string take_changeset(bool patchset = false);
+            /**
+             * @brief Stop recording and free the session.
+             */
+            void close();
+            /**
+             * @brief Destructor.
+             */
+            ~SQLite3Session();
+    };
+#ifdef SDB_POSIX
+    /**
+     * @brief Append-only file of changesets, each framed with its length and checksum.
+     *
+     * A record torn by a crash fails its checksum, so read() stops before it and returns the offset
+     * to truncate to or resume from.
+     */
+    class SQLite3ChangesetLog {
+        int fd{-1};
+        bool sync{false};
+        public:
+            /**
+             * @brief Open a log for appending, creating it if needed.
+             * @param path Path to the log.
+             * @param sync Flush each record to disk with fdatasync() before append() returns.
+             */
+            explicit SQLite3ChangesetLog(const std::string& path, bool sync = false);
+            SQLite3ChangesetLog(const SQLite3ChangesetLog&) = delete;
+            SQLite3ChangesetLog& operator=(const SQLite3ChangesetLog&) = delete;
+            /**
+             * @brief Check if the log is open.
+             * @return bool True if good.
+             */
+            bool good() const;
+            /**
+             * @brief Append one changeset or patchset. Empty changesets are not written.
+             * @param changeset Binary changeset.
+             * @return bool True if successful.
+             */
+            bool append(const std::string& changeset);
+            /**
+             * @brief Read the records of a log in order.
+             * @param path Path to the log.
+             * @param callback Called with each changeset, return false to stop.
+             * @param offset Byte offset to start from, as returned by an earlier read().
+             * @return std::int64_t Offset after the last record read, -1 if the log could not be read.
+             */
+            static std::int64_t read(const std::string& path, const std::function<bool(const std::string&)>& callback, std::int64_t offset = 0);
+            /**
+             * @brief Close the log.
+             */
+            void close();
+            /**
+             * @brief Destructor.
+             */
+            ~SQLite3ChangesetLog();
+    };
+#endif
+#endif
+    /**
+     * @brief Class for database operations.
+     */
+    class SQLite3Database {
+        sqlite3* sqlite3_db{};
+        std::string database{};
+        bool is_good{false};
+        std::unique_ptr<detail::SQLite3Profiler> profiler{};
+        std::shared_ptr<SlowQueryLog> slow_log{};
+#ifdef SDB_POSIX
+        std::unique_ptr<detail::SQLite3MappedImage> image{};
+#endif
+        std::unique_ptr<detail::SQLite3CacheState> cache{};
+        detail::SQLite3ChangeCapture* capture{};
+        std::unique_ptr<detail::SQLite3CheckpointState> checkpointer{};
+        std::unique_ptr<detail::SQLite3BusyState> busy{};
+        std::unordered_set<std::string> volatile_functions{}; // lowercase names of non-deterministic functions registered here
+        int autocheckpoint{-1}; // wal_autocheckpoint to restore once our WAL hook is removed, -1 while it is not installed
+        std::chrono::milliseconds backup_timeout{30000};
+
+        friend struct detail::TableMigration;
+        friend class SQLite3CDC;
+        static int trace_callback(unsigned type, void* ctx, void* p, void* x);
+        static int authorizer_callback(void* ctx, int action, const char* a, const char* b, const char* schema, const char* trigger);
+        static void update_hook_callback(void* ctx, int op, const char* schema, const char* table, sqlite3_int64 rowid);
+        static int commit_hook_callback(void* ctx);
+        static void rollback_hook_callback(void* ctx);
+        void install_hooks();
+        void mark_volatile(const std::string& function, bool is_volatile);
+        static int wal_hook_callback(void* ctx, sqlite3* db, const char* schema, int frames);
+        static void checkpoint_loop(detail::SQLite3CheckpointState* state, sqlite3* db);
+        static int busy_callback(void* ctx, int count);
+#ifdef SDB_SQLITE3_SESSION
+        static int conflict_callback(void* ctx, int type, sqlite3_changeset_iter* it);
+#endif
+        sqlite3_stmt* prepare(const std::string& nq, detail::SQLite3TableCollector* tables = nullptr);
+        bool run_transaction(const std::function<bool(SQLite3Database&)>& fn);
+        static std::string convert_placeholders(const std::string& query);
+        static bool backup(sqlite3* source, sqlite3* destination, int pages_per_step,
+            std::chrono::milliseconds sleep_between, const std::function<bool(int, int)>& progress, std::chrono::milliseconds timeout);
+        std::string explain_query_plan(const std::string& query);
+
+        template <typename... Args>
+        void log_slow_query(const detail::QueryProbe& probe, const std::string& query, const std::string& nq, const std::string& error = {}) {
+            if (!this->slow_log || probe.elapsed_ns() < this->slow_log->threshold_ns()) {
+                return;
+            }
+
+            SlowQueryEntry entry{"sqlite3", this->database, metrics::normalize(query), {detail::param_type_name<Args>()...}, probe.row_count(), probe.elapsed_ns(), {}, error};
+            if (error.empty() && this->slow_log->sample_plan()) {
+                entry.plan = this->explain_query_plan(nq);
+            }
+
+            this->slow_log->write(entry);
+        }
+
+        template<typename T, typename... Args>
+        void bind_parameters(sqlite3_stmt* stmt, int index, T value, Args... args) {
+            if constexpr (std::is_same_v<T, int>) {
+                bind_parameter(stmt, index, value);
+            } else if constexpr (std::is_same_v<T, int64_t>) {
+                bind_parameter(stmt, index, value);
+            } else if constexpr (std::is_same_v<T, double>) {
+                bind_parameter(stmt, index, value);
+            } else if constexpr (std::is_same_v<T, std::string>) {
+                bind_parameter(stmt, index, value);
+            } else if constexpr (std::is_same_v<T, const char*>) {
+                bind_parameter(stmt, index, value);
+            } else if constexpr (std::is_same_v<T, ZeroBlob>) {
+                bind_parameter(stmt, index, value);
+            } else if constexpr (std::is_same_v<T, BlobView>) {
+                bind_parameter(stmt, index, value);
+            }
+            bind_parameters(stmt, index + 1, args...);
+        }
+
+        void bind_parameters(sqlite3_stmt* stmt, int index) {}
+
+        void bind_parameter(sqlite3_stmt* stmt, int index, int value) {
+#ifdef SDB_ENABLE_PRINTDEBUG
+            std::cerr << "Binding int: " << value << " to index: " << index << "\n";
+#endif
+            sqlite3_bind_int(stmt, index, value);
+        }
+
+        void bind_parameter(sqlite3_stmt* stmt, int index, int64_t value) {
+#ifdef SDB_ENABLE_PRINTDEBUG
+            std::cerr << "Binding int: " << value << " to index: " << index << "\n";
+#endif
+            sqlite3_bind_int64(stmt, index, value);
+        }
+
+        void bind_parameter(sqlite3_stmt* stmt, int index, double value) {
+#ifdef SDB_ENABLE_PRINTDEBUG
+            std::cerr << "Binding double: " << value << " to index: " << index << "\n";
+#endif
+            sqlite3_bind_double(stmt, index, value);
+        }
+
+        void bind_parameter(sqlite3_stmt* stmt, int index, const std::string& value) {
+#ifdef SDB_ENABLE_PRINTDEBUG
+            std::cerr << "Binding string: " << value << " to index: " << index << "\n";
+#endif
+            sqlite3_bind_text(stmt, index, remove_non_utf8(value).c_str(), -1, SQLITE_TRANSIENT);
+        }
+
+        void bind_parameter(sqlite3_stmt* stmt, int index, const char* value) {
+#ifdef SDB_ENABLE_PRINTDEBUG
+            std::cerr << "Binding string: " << value << " to index: " << index << "\n";
+#endif
+            sqlite3_bind_text(stmt, index, remove_non_utf8(value).c_str(), -1, SQLITE_TRANSIENT);
+        }
+
+        void bind_parameter(sqlite3_stmt* stmt, int index, ZeroBlob value) {
+#ifdef SDB_ENABLE_PRINTDEBUG
+            std::cerr << "Binding zeroblob: " << value.size << " to index: " << index << "\n";
+#endif
+            sqlite3_bind_zeroblob64(stmt, index, value.size);
+        }
+
+        void bind_parameter(sqlite3_stmt* stmt, int index, BlobView value) {
+#ifdef SDB_ENABLE_PRINTDEBUG
+            std::cerr << "Binding blob: " << value.size << " bytes to index: " << index << "\n";
+#endif
+            if (value.data) {
+                sqlite3_bind_blob64(stmt, index, value.data, value.size, SQLITE_STATIC);
+            } else {
+                sqlite3_bind_zeroblob(stmt, index, 0);
+            }
+        }
+
+        public:
+            template <typename... Args>
+            bool exec(const std::string& query, Args... args) {
+                static_assert(sizeof...(args) > 0, "exec() requires more parameters");
+                if (!this->is_good) {
+                    return false;
+                }
+
+                detail::QueryProbe probe{query, this->slow_log != nullptr};
+
+                const std::string nq = convert_placeholders(query);
+
+                // a locked database is not an error worth printing, the caller sees false and can retry
+                const auto locked = [this]() {
+                    const int code = sqlite3_errcode(this->sqlite3_db);
+                    return code == SQLITE_BUSY || code == SQLITE_LOCKED;
+                };
+
+                sqlite3_stmt* stmt = this->prepare(nq);
+                if (!stmt) {
+                    if (!locked()) {
+                        std::cerr << "Failed to prepare statement\n";
+                    }
+                    return false;
+                }
+
+                probe.prepared();
+
+                bind_parameters(stmt, 1, args...);
+
+                const int status = sqlite3_step(stmt);
+                probe.executed();
+
+                if (status != SQLITE_DONE) {
+                    if (!locked()) {
+                        std::cerr << "Failed to step statement" << sqlite3_errmsg(sqlite3_db) << "\n";
+                    }
+                    this->log_slow_query<Args...>(probe, query, nq, sqlite3_errmsg(sqlite3_db));
+                    sqlite3_finalize(stmt);
+                    return false;
+                }
+
+                sqlite3_finalize(stmt);
+
+                this->log_slow_query<Args...>(probe, query, nq);
+
+                probe.succeeded();
+                return true;
+            }
+            template <typename... Args>
+            std::vector<std::unordered_map<std::string, std::string>> query(const std::string& query, Args... args) {
+                static_assert(sizeof...(args) > 0, "query() requires more parameters");
+                if (!this->is_good) {
+                    return {};
+                }
+
+                if (this->cache) {
+                    auto result = this->cached_query(query, args...);
+                    return result ? *result : std::vector<std::unordered_map<std::string, std::string>>{};
+                }
+
+                std::vector<std::unordered_map<std::string, std::string>> result;
+                this->fetch(query, result, nullptr, args...);
+                return result;
+            }
+            /**
+             * @brief Query the database through the result cache.
+             *
+             * Hits return the shared result without running the statement. Without a cache, inside a
+             * transaction, or for statements that write, the statement is run and its result is not cached.
+             * Only deterministic statements should be cached, and writes through other connections are
+             * not seen; use invalidate_result_cache() for those.
+             * @param query Query to execute.
+             * @param args Parameters.
+             * @return std::shared_ptr<const std::vector<std::unordered_map<std::string, std::string>>> Data, nullptr on failure.
+             */
+            template <typename... Args>
+            std::shared_ptr<const std::vector<std::unordered_map<std::string, std::string>>> cached_query(const std::string& query, Args... args) {
+                using Result = std::vector<std::unordered_map<std::string, std::string>>;
+                if (!this->is_good) {
+                    return nullptr;
+                }
+
+                // reads inside a transaction may see uncommitted rows
+                if (!this->cache || !sqlite3_get_autocommit(this->sqlite3_db)) {
+                    auto result = std::make_shared<Result>();
+                    return this->fetch(query, *result, nullptr, args...) ? result : nullptr;
+                }
+
+                const std::string key = detail::cache_key(query, args...);
+                if (auto hit = this->cache->cache.get(key)) {
+                    return hit;
+                }
+
+                const std::uint64_t generation = this->cache->cache.generation();
+                detail::SQLite3TableCollector tables{};
+                auto result = std::make_shared<Result>();
+                if (!this->fetch(query, *result, &tables, args...)) {
+                    return nullptr;
+                }
+
+                if (tables.read_only && tables.deterministic) {
+                    this->cache->cache.put(key, result, std::move(tables.reads), generation);
+                }
+                return result;
+            }
+            /**
+             * @brief Register a C++ function as an SQL scalar function on this connection.
+             *
+             * The SQL argument count and conversions are deduced from the function's parameters: integral,
+             * floating point, bool, std::string, std::string_view, BlobView, sqlite3_value* or std::optional
+             * of those, which is empty for NULL. The result may be any of these, const char* or std::nullptr_t.
+             * Exceptions are reported as the statement's error. Registering a name again with the same
+             * argument count replaces the function.
+             * @param name SQL name of the function.
+             * @param fn Function or lambda, copied.
+             * @param deterministic True if the result only depends on the arguments (SQLITE_DETERMINISTIC),
+             * which lets SQLite use it in indexes and factor it out of loops.
+             * @return bool True if successful.
+             */
+            template <typename F>
+            bool register_function(const std::string& name, F fn, bool deterministic = false) {
+                using Traits = detail::FunctionTraits<std::decay_t<F>>;
+                using Args = typename Traits::args;
+                static_assert(!std::is_void_v<typename Traits::result>, "SQL functions must return a value");
+                if (!this->is_good) {
+                    return false;
+                }
+
+                const auto call = [](sqlite3_context* ctx, int, sqlite3_value** argv) {
+                    auto& fn = *static_cast<F*>(sqlite3_user_data(ctx));
+                    try {
+                        detail::sqlite3_set_result(ctx, detail::sqlite3_invoke<Args>(fn, argv, std::make_index_sequence<std::tuple_size_v<Args>>{}));
+                    } catch (const std::exception& e) {
+                        sqlite3_result_error(ctx, e.what(), -1);
+                    } catch (...) {
+                        // nothing may unwind through SQLite's C frames
+                        sqlite3_result_error(ctx, "unknown exception", -1);
+                    }
+                };
+                const auto destroy = [](void* p) {
+                    delete static_cast<F*>(p);
+                };
+
+                const int flags = SQLITE_UTF8 | (deterministic ? SQLITE_DETERMINISTIC : 0);
+                if (sqlite3_create_function_v2(this->sqlite3_db, name.c_str(), static_cast<int>(std::tuple_size_v<Args>), flags,
+                        new F(std::move(fn)), call, nullptr, nullptr, destroy) != SQLITE_OK) {
+                    return false;
+                }
+                this->mark_volatile(name, !deterministic);
+                return true;
+            }
+            /**
+             * @brief Register C++ functions as an SQL aggregate function on this connection.
+             *
+             * step takes a mutable state followed by the SQL arguments, converted as in register_function(),
+             * and is called once per row. final takes the state and returns the result. The state type is deduced
+             * from step, must be default constructible and is created per group, also for groups without rows.
+             * @param name SQL name of the function.
+             * @param step Called per row, e.g. [](double& sum, double value) { sum += value; }.
+             * @param final Called once per group, e.g. [](double& sum) { return sum; }.
+             * @param deterministic True if the result only depends on the arguments (SQLITE_DETERMINISTIC).
+             * @return bool True if successful.
+             */
+            template <typename Step, typename Final>
+            bool register_aggregate(const std::string& name, Step step, Final final, bool deterministic = false) {
+                using StepArgs = typename detail::FunctionTraits<std::decay_t<Step>>::args;
+                static_assert(std::tuple_size_v<StepArgs> > 0, "the step function must take the aggregate state first");
+                using State = std::tuple_element_t<0, StepArgs>;
+                using Args = typename detail::TupleTail<StepArgs>::type;
+                using Aggregate = detail::SQLite3Aggregate<Step, Final>;
+                static_assert(std::is_default_constructible_v<State>, "the aggregate state must be default constructible");
+                if (!this->is_good) {
+                    return false;
+                }
+
+                const auto step_call = [](sqlite3_context* ctx, int, sqlite3_value** argv) {
+                    auto& aggregate = *static_cast<Aggregate*>(sqlite3_user_data(ctx));
+                    try {
+                        State* current = detail::sqlite3_aggregate_state<State>(ctx, true);
+                        if (!current) {
+                            sqlite3_result_error_nomem(ctx);
+                            return;
+                        }
+                        detail::sqlite3_invoke<Args>(aggregate.step, argv, std::make_index_sequence<std::tuple_size_v<Args>>{}, *current);
+                    } catch (const std::exception& e) {
+                        sqlite3_result_error(ctx, e.what(), -1);
+                    } catch (...) {
+                        sqlite3_result_error(ctx, "unknown exception", -1);
+                    }
+                };
+                const auto final_call = [](sqlite3_context* ctx) {
+                    auto& aggregate = *static_cast<Aggregate*>(sqlite3_user_data(ctx));
+                    std::unique_ptr<State> current{detail::sqlite3_aggregate_state<State>(ctx, false)};
+                    try {
+                        if (current) {
+                            detail::sqlite3_set_result(ctx, aggregate.final(*current));
+                        } else {
+                            State empty{};
+                            detail::sqlite3_set_result(ctx, aggregate.final(empty));
+                        }
+                    } catch (const std::exception& e) {
+                        sqlite3_result_error(ctx, e.what(), -1);
+                    } catch (...) {
+                        sqlite3_result_error(ctx, "unknown exception", -1);
+                    }
+                };
+                const auto destroy = [](void* p) {
+                    delete static_cast<Aggregate*>(p);
+                };
+
+                const int flags = SQLITE_UTF8 | (deterministic ? SQLITE_DETERMINISTIC : 0);
+                if (sqlite3_create_function_v2(this->sqlite3_db, name.c_str(), static_cast<int>(std::tuple_size_v<Args>), flags,
+                        new Aggregate{std::move(step), std::move(final)}, nullptr, step_call, final_call, destroy) != SQLITE_OK) {
+                    return false;
+                }
+                this->mark_volatile(name, !deterministic);
+                return true;
+            }
+        private:
+            template <typename... Args>
+            bool fetch(const std::string& query, std::vector<std::unordered_map<std::string, std::string>>& result, detail::SQLite3TableCollector* tables, Args... args) {
+                detail::QueryProbe probe{query, this->slow_log != nullptr};
+
+                const std::string nq = convert_placeholders(query);
+
+                sqlite3_stmt* stmt = this->prepare(nq, tables);
+                if (!stmt) {
+                    return false;
+                }
+
+                probe.prepared();
+
+                bind_parameters(stmt, 1, args...);
+
+                std::uint64_t bytes{0};
+                int status = sqlite3_step(stmt);
+                probe.executed();
+                for (; status == SQLITE_ROW; status = sqlite3_step(stmt)) {
+                    std::unordered_map<std::string, std::string> row;
+                    for (int i = 0; i < sqlite3_column_count(stmt); ++i) {
+                        const unsigned char* value = sqlite3_column_text(stmt, i);
+                        row[sqlite3_column_name(stmt, i)] = value ? reinterpret_cast<const char*>(value) : "";
+                        bytes += static_cast<std::uint64_t>(sqlite3_column_bytes(stmt, i));
+                    }
+                    result.push_back(std::move(row));
+                }
+
+                probe.fetched(result.size(), bytes);
+
+                sqlite3_finalize(stmt);
+                if (status != SQLITE_DONE) {
+                    this->log_slow_query<Args...>(probe, query, nq, sqlite3_errmsg(sqlite3_db));
+                    return false;
+                }
+
+                this->log_slow_query<Args...>(probe, query, nq);
+                probe.succeeded();
+                return true;
+            }
+        public:
+            /**
+             * @brief Query the database, returning data.
+             * @param query Query to execute.
+             * @return std::vector<std::unordered_map<std::string, std::string>> Data.
+             */
+            std::vector<std::unordered_map<std::string, std::string>> query(const std::string& query);
+            /**
+             * @brief Execute an SQL command.
+             * @param query Query to execute.
+             * @return bool True if successful.
+             */
+            bool exec(const std::string& query);
+            /**
+             * @brief Check if the database is good.
+             * @return bool True if good.
+             */
+            bool good();
+            /**
+             * @brief Check if the database is open.
+             * @return bool True if open.
+             */
+            bool is_open();
+            /**
+             * @brief Open a database from file.
+             * @param database Database to open.
+             */
+            void open(const std::string& database);
+            /**
+             * @brief Close the open database.
+             *
+             * While a blob, session or scan still holds a statement on the connection, SQLite refuses to
+             * close it; the database then stays open and good() stays true, so close() can be retried.
+             */
+            void close();
+            /**
+             * @brief Check if the database is empty.
+             * @return bool
+             */
+            bool empty();
+            /**
+             * @brief Validate an SQL statement.
+             * @param query Query to validate.
+             * @return bool True if valid.
+             */
+            bool validate(const std::string& query);
+            /**
+             * @brief Get the last insertion.
+             * @return std::int64_t Last insertion.
+             */
+            std::int64_t get_last_insertion();
+            /**
+             * @brief Enable or disable the statement profiler.
+             *
+             * Collects sqlite3_stmt_status counters and SQLITE_TRACE_PROFILE timings
+             * for every statement run on this connection. Statements are prepared for each call, so
+             * entries are keyed on the normalized statement text rather than on a prepared statement.
+             * Collected data is kept when disabled.
+             * @param enable True to enable.
+             * @return bool True if successful.
+             */
+            bool enable_profiler(bool enable = true);
+            /**
+             * @brief Get the collected profile, ranked by total time spent.
+             * @return std::vector<SQLite3ProfileEntry> Profile entries, slowest first.
+             */
+            std::vector<SQLite3ProfileEntry> get_profile();
+            /**
+             * @brief Print the ranked profile, flagging full scans and automatic indexes.
+             * @param os Stream to print to.
+             */
+            void print_profile(std::ostream& os = std::cerr);
+            /**
+             * @brief Clear the collected profile.
+             */
+            void reset_profile();
+            /**
+             * @brief Enable or disable the result cache used by query() and cached_query().
+             *
+             * Results are tagged with the tables they read. Writes on this connection invalidate those
+             * tables when they commit, through sqlite3_update_hook and sqlite3_commit_hook, and
+             * schema changes drop everything. Enabling again replaces the cache with an empty one.
+             * Statements calling random(), the date and time functions or functions registered as not
+             * deterministic are never cached.
+             * @param enable True to enable.
+             * @param max_bytes Memory budget, least recently used results are evicted past it.
+             * @return bool True if successful.
+             */
+            bool enable_result_cache(bool enable = true, std::size_t max_bytes = 16 * 1024 * 1024);
+            /**
+             * @brief Get the result cache counters.
+             * @return ResultCacheStats Counters, all zero if the cache is disabled.
+             */
+            ResultCacheStats get_result_cache_stats();
+            /**
+             * @brief Drop cached results, e.g. after another connection wrote to a table.
+             * @param table Table to invalidate, empty to drop everything.
+             */
+            void invalidate_result_cache(const std::string& table = "");
+            /**
+             * @brief Log statements slower than the log's threshold to a slow-query log.
+             * @param log Log to write to, or nullptr to disable.
+             */
+            void set_slow_query_log(std::shared_ptr<SlowQueryLog> log);
+            /**
+             * @brief Move WAL checkpoints off the commit path, onto a background thread with its own connection.
+             *
+             * Automatic checkpoints are disabled on this connection. A WAL hook counts the frames its commits
+             * append and wakes the thread once options.wal_frames have accumulated; the thread also runs every
+             * options.interval while the WAL file changes. Each run is a PASSIVE checkpoint, escalated to RESTART
+             * when it could not finish and the WAL has grown past options.restart_frames, and followed by
+             * TRUNCATE when the file is larger than options.truncate_bytes. The database must be a file in WAL mode.
+             * @param options Size and time policy.
+             * @return bool True if the checkpointer is running.
+             */
+            bool start_checkpointer(const CheckpointOptions& options = {});
+            /**
+             * @brief Stop the background checkpointer and restore automatic checkpoints.
+             */
+            void stop_checkpointer();
+            /**
+             * @brief Get the checkpointer counters.
+             * @return CheckpointStats Counters, all zero if the checkpointer is not running.
+             */
+            CheckpointStats get_checkpoint_stats();
+            /**
+             * @brief Enable or disable the busy handler.
+             *
+             * A statement that finds the database locked by another connection or process sleeps and
+             * retries, with exponential backoff and jitter, for up to options.max_wait in total before it
+             * fails with SQLITE_BUSY. This replaces any busy timeout set on the connection. Counters are
+             * kept when disabled.
+             * @param enable True to enable.
+             * @param options Backoff and limits.
+             * @return bool True if successful.
+             */
+            bool enable_busy_handler(bool enable = true, const BusyOptions& options = {});
+            /**
+             * @brief Get the lock contention counters.
+             * @return BusyStats Counters, all zero if the busy handler was never enabled.
+             */
+            BusyStats get_busy_stats();
+            /**
+             * @brief Run a function inside a write transaction, retrying when the database is locked.
+             *
+             * The transaction starts with BEGIN IMMEDIATE, so the write lock is taken up front and a
+             * locked database fails at BEGIN instead of halfway through. BEGIN and COMMIT that fail with
+             * SQLITE_BUSY are retried up to BusyOptions::max_attempts times with backoff; the function runs
+             * once. Commits if the function returns true (or void), rolls back if it returns false or throws.
+             * Inside an open transaction the function simply runs as part of it.
+             * @param fn Function taking the database.
+             * @return bool True if committed.
+             */
+            template <typename F>
+            bool transaction(F&& fn) {
+                if constexpr (std::is_void_v<std::invoke_result_t<F&, SQLite3Database&>>) {
+                    return this->run_transaction([&fn](SQLite3Database& db) {
+                        fn(db);
+                        return true;
+                    });
+                } else {
+                    return this->run_transaction([&fn](SQLite3Database& db) {
+                        return static_cast<bool>(fn(db));
+                    });
+                }
+            }
+            /**
+             * @brief Open a blob for incremental I/O.
+             *
+             * To write a new blob, insert a ZeroBlob of the final size first, then open it writable.
+             * @param table Table name.
+             * @param column Column name.
+             * @param rowid Row to open.
+             * @param writable True to open for writing.
+             * @param schema Schema name, "main" for the main database.
+             * @return SQLite3Blob Blob handle, check good() for success.
+             */
+            SQLite3Blob open_blob(const std::string& table, const std::string& column, std::int64_t rowid, bool writable = false, const std::string& schema = "main");
+            /**
+             * @brief Scan a table in key order, page by page, as a lazy range of rows.
+             * @param table Table name, inserted verbatim.
+             * @param keys Columns of a unique, non-null key, inserted verbatim. Must be part of columns.
+             * @param page_size Rows per page.
+             * @param columns Columns to select, inserted verbatim.
+             * @return SQLite3Scan Range of rows, check good() for success.
+             */
+            SQLite3Scan scan(const std::string& table, const std::vector<std::string>& keys, std::int64_t page_size = 1000, const std::string& columns = "*");
+            /**
+             * @brief Stream the result of a query to a sink, formatted straight from the column buffers.
+             *
+             * Blobs are written as \x-prefixed hex, as PostgreSQL prints bytea. Only one chunk of output
+             * is buffered at a time.
+             * @param query Query to export.
+             * @param sink Receives the output in chunks.
+             * @param format ExportFormat::CSV, ExportFormat::Text or ExportFormat::NDJSON.
+             * @param header Write a header line with the column names (CSV only).
+             * @return std::int64_t Number of rows written, -1 on failure.
+             */
+            std::int64_t copy_out(const std::string& query, const ExportSink& sink, ExportFormat format = ExportFormat::CSV, bool header = true);
+#ifdef SDB_POSIX
+            /**
+             * @brief Stream the result of a query to a file descriptor.
+             * @return std::int64_t Number of rows written, -1 on failure.
+             */
+            std::int64_t copy_out(const std::string& query, int fd, ExportFormat format = ExportFormat::CSV, bool header = true);
+#endif
+            /**
+             * @brief Bulk load a CSV or NDJSON file into a table.
+             *
+             * The file is mapped and split into chunks that are parsed on a thread pool, while this thread
+             * inserts the parsed rows in file order through one prepared statement, committing every
+             * batch_size rows. If a transaction is already open, rows are inserted into it instead and
+             * nothing is committed. Rows committed before an error are kept.
+             * @param table Table to insert into, quoted as one identifier like the column names.
+             * @param path File to read.
+             * @param options Format, columns and batching.
+             * @return ImportStats Row counts, ok is false and error is set on failure.
+             */
+            ImportStats import_file(const std::string& table, const std::string& path, const ImportOptions& options = {});
+#ifdef SDB_SQLITE3_SESSION
+            /**
+             * @brief Create a session that records changes for replication. Attach tables before changing them.
+             * @param schema Database to record, "main" or the name of an attached database.
+             * @return SQLite3Session Session, check good() for success.
+             */
+            SQLite3Session create_session(const std::string& schema = "main");
+            /**
+             * @brief Apply a changeset or patchset from another connection, all or nothing.
+             * @param changeset Binary changeset.
+             * @param on_conflict Handler for changes that do not apply cleanly. Without one, a conflict aborts.
+             * @return bool True if the changeset was applied.
+             */
+            bool apply_changeset(const std::string& changeset, const ConflictHandler& on_conflict = {});
+#ifdef SDB_POSIX
+            /**
+             * @brief Apply the records of a changeset log in order, each all or nothing.
+             * @param path Path to the log.
+             * @param on_conflict Handler for changes that do not apply cleanly. Without one, a conflict aborts.
+             * @param offset Byte offset to start from, as returned by an earlier call.
+             * @return std::int64_t Offset after the last applied record, to resume from; -1 if the log could not be read.
+             */
+            std::int64_t apply_changeset_log(const std::string& path, const ConflictHandler& on_conflict = {}, std::int64_t offset = 0);
+#endif
+#endif
+            /**
+             * @brief Copy this database to a file while it stays in use.
+             *
+             * Copies pages_per_step pages at a time and sleeps in between, so locks are only held for one step.
+             * If another connection writes to the source, SQLite restarts the copy; writes through this
+             * connection are applied to the copy in place.
+             * @param path Destination file, overwritten.
+             * @param pages_per_step Pages per step, -1 to copy everything in one step.
+             * @param sleep_between Pause between steps.
+             * @param progress Called after each step with (remaining, total) pages. Return false to abort.
+             * @return bool True if the copy completed.
+             */
+            bool backup_to(const std::string& path, int pages_per_step = 256,
+                std::chrono::milliseconds sleep_between = std::chrono::milliseconds{10},
+                const std::function<bool(int, int)>& progress = {});
+            /**
+             * @brief Copy this database into another open database, e.g. a file image into ":memory:".
+             * @return bool True if the copy completed.
+             */
+            bool backup_to(SQLite3Database& destination, int pages_per_step = 256,
+                std::chrono::milliseconds sleep_between = std::chrono::milliseconds{10},
+                const std::function<bool(int, int)>& progress = {});
+            /**
+             * @brief Replace the contents of this database with a copy of a file, e.g. to warm up ":memory:" from an image.
+             * @param path Source file.
+             * @return bool True if the copy completed.
+             */
+            bool restore_from(const std::string& path, int pages_per_step = -1,
+                std::chrono::milliseconds sleep_between = std::chrono::milliseconds{0},
+                const std::function<bool(int, int)>& progress = {});
+            /**
+             * @brief Set how long backup_to() and restore_from() keep retrying while the source or destination is locked.
+             *
+             * The time counts from the first step that failed with SQLITE_BUSY or SQLITE_LOCKED and restarts
+             * whenever a step makes progress, so a connection that holds its lock forever fails the copy
+             * instead of hanging it. The default is 30 seconds.
+             * @param timeout Longest wait, 0 to fail on the first locked step.
+             */
+            void set_backup_timeout(std::chrono::milliseconds timeout);
+            /**
+             * @brief Serialize a schema into a database image, as it would be stored on disk.
+             * @param schema Schema name, "main" for the main database.
+             * @return std::vector<unsigned char> The image, empty on failure.
+             */
+            std::vector<unsigned char> serialize(const std::string& schema = "main");
+            /**
+             * @brief Write the image of a schema to a file. The file is replaced atomically through a rename.
+             * @param path Destination file.
+             * @param schema Schema name, "main" for the main database.
+             * @return bool True if the image was written.
+             */
+            bool save_image(const std::string& path, const std::string& schema = "main");
+            /**
+             * @brief Replace the main schema with a copy of a database image. Opens ":memory:" if no database is open.
+             * @param data Image data.
+             * @param size Image size in bytes. An empty image gives an empty database.
+             * @param read_only True to reject writes to the loaded database.
+             * @return bool True if the image was loaded.
+             */
+            bool deserialize(const unsigned char* data, std::size_t size, bool read_only = false);
+            /**
+             * @brief Replace the main schema with an image file written by save_image(). Opens ":memory:" if no database is open.
+             *
+             * Read-only images are mmapped and used in place, so loading does not copy the file.
+             * Writable images are read into memory owned by SQLite.
+             * @param path Image file.
+             * @param read_only True to map the file read-only instead of copying it.
+             * @return bool True if the image was loaded.
+             */
+            bool load_image(const std::string& path, bool read_only = true);
+            /**
+             * @brief Constructor.
+             */
+            SQLite3Database();
+            /**
+             * @brief Constructor.
+             * @param database Database to open.
+             */
+            SQLite3Database(const std::string& database);
+            /**
+             * @brief Destructor.
+             */
+            ~SQLite3Database();
+    };
+    /**
+     * @brief Live in-memory database that can be replaced by a new image while readers are using the old one.
+     *
+     * Readers call acquire() and keep the returned pointer for as long as they need a consistent view.
+     * load() and swap() publish a new database; the old one is closed when its last reader lets go.
+     */
+    class SQLite3LiveImage {
+        mutable std::mutex mutex{};
+        std::shared_ptr<SQLite3Database> current{};
+    public:
+        /**
+         * @brief Load an image file into a new database and publish it.
+         * @param path Image file written by SQLite3Database::save_image().
+         * @param read_only True to map the file read-only.
+         * @return bool True if the image was loaded and published. The current database is kept on failure.
+         */
+        bool load(const std::string& path, bool read_only = true);
+        /**
+         * @brief Publish a database.
+         * @param database Database to publish.
+         */
+        void swap(std::shared_ptr<SQLite3Database> database);
+        /**
+         * @brief Get the current database.
+         * @return std::shared_ptr<SQLite3Database> The current database, nullptr if none was published.
+         */
+        std::shared_ptr<SQLite3Database> acquire() const;
+    };
+    /**
+     * @brief SQLite3 dataset split across several database files by key.
+     *
+     * Keyed statements are routed to one shard on a consistent-hash ring, so adding a shard only moves
+     * the keys of its own ring segments. Every shard has its own connection and lock, so writes to
+     * different shards run in parallel. Unkeyed queries fan out to all shards on a thread pool.
+     */
+    class ShardedSQLite {
+        public:
+            using Row = std::unordered_map<std::string, std::string>;
+            /**
+             * @brief Sort key for merging the per-shard results of an ordered fan-out query.
+             */
+            struct Order {
+                std::string column{};
+                bool numeric{false};
+                bool descending{false};
+                std::size_t limit{0}; // stop merging after this many rows, 0 for all
+            };
+        private:
+            struct Shard {
+                std::mutex mutex{};
+                SQLite3Database db;
+
+                explicit Shard(const std::string& path) : db(path) {}
+            };
+
+            std::vector<std::unique_ptr<Shard>> shards{};
+            std::vector<std::pair<std::uint64_t, std::size_t>> ring{}; // (point, shard), sorted by point
+            std::unique_ptr<detail::ThreadPool> pool{};
+
+            static std::uint64_t hash(const std::string& key);
+
+            template <typename... Args>
+            static std::vector<Row> run_query(SQLite3Database& db, const std::string& query, const Args&... args) {
+                if constexpr (sizeof...(Args) == 0) {
+                    return db.query(query);
+                } else {
+                    return db.query(query, args...);
+                }
+            }
+            template <typename... Args>
+            static bool run_exec(SQLite3Database& db, const std::string& query, const Args&... args) {
+                if constexpr (sizeof...(Args) == 0) {
+                    return db.exec(query);
+                } else {
+                    return db.exec(query, args...);
+                }
+            }
+            template <typename... Args>
+            std::vector<std::vector<Row>> gather(const std::string& query, const Args&... args) {
+                std::vector<std::future<std::vector<Row>>> futures{};
+                for (auto& shard : this->shards) {
+                    futures.push_back(this->pool->submit([shard = shard.get(), &query, &args...]() {
+                        std::lock_guard<std::mutex> lock(shard->mutex);
+                        return run_query(shard->db, query, args...);
+                    }));
+                }
+
+                std::vector<std::vector<Row>> results{};
+                for (auto& future : futures) {
+                    results.push_back(future.get());
+                }
+                return results;
+            }
+        public:
+            /**
+             * @brief Constructor. Opens every shard.
+             * @param paths One database file per shard. The path identifies the shard on the ring, so keep it stable.
+             * @param threads Threads for fan-out queries, 0 for one per hardware thread.
+             * @param virtual_nodes Ring points per shard. More points spread keys more evenly.
+             */
+            explicit ShardedSQLite(const std::vector<std::string>& paths, std::size_t threads = 0, int virtual_nodes = 128);
+            /**
+             * @brief Check if every shard is open.
+             * @return bool True if good.
+             */
+            bool good();
+            /**
+             * @brief Get the number of shards.
+             * @return std::size_t Shard count.
+             */
+            std::size_t size() const;
+            /**
+             * @brief Get the shard a key is routed to.
+             * @param key Shard key.
+             * @return std::size_t Shard index.
+             */
+            std::size_t shard_for(const std::string& key) const;
+            /**
+             * @brief Run a function with exclusive access to one shard, e.g. for a transaction.
+             * @param index Shard index.
+             * @param fn Function called with the shard's SQLite3Database.
+             * @return The return value of fn.
+             */
+            template <typename F>
+            auto with_shard(std::size_t index, F&& fn) {
+                Shard& shard = *this->shards.at(index);
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                return fn(shard.db);
+            }
+            /**
+             * @brief Execute a statement on the shard owning a key.
+             * @param key Shard key.
+             * @param query Query to execute.
+             * @param args Parameters.
+             * @return bool True if successful.
+             */
+            template <typename... Args>
+            bool exec(const std::string& key, const std::string& query, Args... args) {
+                return this->with_shard(this->shard_for(key), [&](SQLite3Database& db) {
+                    return run_exec(db, query, args...);
+                });
+            }
+            /**
+             * @brief Query the shard owning a key.
+             * @param key Shard key.
+             * @param query Query to execute.
+             * @param args Parameters.
+             * @return std::vector<Row> Data.
+             */
+            template <typename... Args>
+            std::vector<Row> query(const std::string& key, const std::string& query, Args... args) {
+                return this->with_shard(this->shard_for(key), [&](SQLite3Database& db) {
+                    return run_query(db, query, args...);
+                });
+            }
+            /**
+             * @brief Execute a statement on every shard in parallel, e.g. to create the schema.
+             * @param query Query to execute.
+             * @param args Parameters.
+             * @return bool True if it succeeded on every shard.
+             */
+            template <typename... Args>
+            bool exec_all(const std::string& query, Args... args) {
+                std::vector<std::future<bool>> futures{};
+                for (auto& shard : this->shards) {
+                    futures.push_back(this->pool->submit([shard = shard.get(), &query, &args...]() {
+                        std::lock_guard<std::mutex> lock(shard->mutex);
+                        return run_exec(shard->db, query, args...);
+                    }));
+                }
+
+                bool ret{true};
+                for (auto& future : futures) {
+                    ret = future.get() && ret;
+                }
+                return ret;
+            }
+            /**
+             * @brief Query every shard in parallel and concatenate the results in shard order.
+             * @param query Query to execute.
+             * @param args Parameters.
+             * @return std::vector<Row> Data.
+             */
+            template <typename... Args>
+            std::vector<Row> query_all(const std::string& query, Args... args) {
+                std::vector<Row> ret{};
+                for (auto& rows : this->gather(query, args...)) {
+                    ret.insert(ret.end(), std::make_move_iterator(rows.begin()), std::make_move_iterator(rows.end()));
+                }
+                return ret;
+            }
+            /**
+             * @brief Query every shard in parallel and merge the results on a sort key.
+             *
+             * The query must return rows sorted by the same key (ORDER BY), so the merge is a single
+             * k-way pass. For a global top-n, add LIMIT n to the query and set order.limit to n; each shard
+             * then returns at most n rows and the merge stops after the first n.
+             * @param order Sort key the shard results are sorted by.
+             * @param query Query to execute.
+             * @param args Parameters.
+             * @return std::vector<Row> Data in sort order.
+             */
+            template <typename... Args>
+            std::vector<Row> query_all(const Order& order, const std::string& query, Args... args) {
+                return merge(order, this->gather(query, args...));
+            }
+            /**
+             * @brief Merge sorted per-shard results.
+             * @param order Sort key the results are sorted by.
+             * @param results Results, each sorted by order.
+             * @return std::vector<Row> Merged rows.
+             */
+            static std::vector<Row> merge(const Order& order, std::vector<std::vector<Row>> results);
+    };
+#endif
+
+#ifdef SDB_POSTGRESQL
+    /**
+     * @brief Handle for an open PostgreSQL large object. Obtain one through PostgreSQLDatabase::open_large_object().
+     *
+     * Large object descriptors are only valid inside the transaction that opened them.
+     */
+    class PostgreSQLLargeObject {
+        PGconn* pg_conn{};
+        int fd{-1};
+
+        friend class PostgreSQLDatabase;
+        PostgreSQLLargeObject(PGconn* pg_conn, int fd) : pg_conn(pg_conn), fd(fd) {}
+        public:
+            PostgreSQLLargeObject() = default;
+            PostgreSQLLargeObject(const PostgreSQLLargeObject&) = delete;
+            PostgreSQLLargeObject& operator=(const PostgreSQLLargeObject&) = delete;
+            PostgreSQLLargeObject(PostgreSQLLargeObject&& other) noexcept;
+            PostgreSQLLargeObject& operator=(PostgreSQLLargeObject&& other) noexcept;
+            /**
+             * @brief Check if the large object is open.
+             * @return bool True if open.
+             */
+            bool good() const;
+            /**
+             * @brief Read from the current position into a buffer.
+             * @param buffer Buffer of at least n bytes.
+             * @param n Maximum number of bytes to read.
+             * @return int Number of bytes read, 0 at the end, -1 on failure.
+             */
+            int read(void* buffer, std::size_t n);
+            /**
+             * @brief Write a buffer at the current position.
+             * @param buffer Data to write.
+             * @param n Number of bytes to write.
+             * @return int Number of bytes written, -1 on failure.
+             */
+            int write(const void* buffer, std::size_t n);
+            /**
+             * @brief Move the current position.
+             * @param offset Offset.
+             * @param whence SEEK_SET, SEEK_CUR or SEEK_END.
+             * @return std::int64_t New position, -1 on failure.
+             */
+            std::int64_t seek(std::int64_t offset, int whence = SEEK_SET);
+            /**
+             * @brief Get the current position.
+             * @return std::int64_t Position, -1 on failure.
+             */
+            std::int64_t tell();
+            /**
+             * @brief Truncate or extend the large object.
+             * @param size New size in bytes.
+             * @return bool True if successful.
+             */
+            bool truncate(std::int64_t size);
+            /**
+             * @brief Stream from the current position to the end into an output stream.
+             * @param os Stream to write to.
+             * @param chunk_size Bytes per read.
+             * @return bool True if successful.
+             */
+            bool read_to(std::ostream& os, std::size_t chunk_size = 256 * 1024);
+            /**
+             * @brief Stream an input stream into the large object at the current position.
+             * @param is Stream to read from until EOF.
+             * @param chunk_size Bytes per write.
+             * @return std::int64_t Number of bytes written, -1 on failure.
+             */
+            std::int64_t write_from(std::istream& is, std::size_t chunk_size = 256 * 1024);
+            /**
+             * @brief Close the large object.
+             */
+            void close();
+            /**
+             * @brief Destructor.
+             */
+            ~PostgreSQLLargeObject();
+    };
+    namespace detail {
+        /* Framing for COPY ... (FORMAT binary) */
+        inline void copy_put_int16(std::string& buffer, std::int16_t value) {
+            const auto v = static_cast<std::uint16_t>(value);
+            buffer += static_cast<char>(v >> 8);
+            buffer += static_cast<char>(v & 0xff);
+        }
+
+        inline void copy_put_int32(std::string& buffer, std::int32_t value) {
+            const auto v = static_cast<std::uint32_t>(value);
+            for (int shift{24}; shift >= 0; shift -= 8) {
+                buffer += static_cast<char>((v >> shift) & 0xff);
+            }
+        }
+
+        inline void copy_put_int64(std::string& buffer, std::int64_t value) {
+            const auto v = static_cast<std::uint64_t>(value);
+            for (int shift{56}; shift >= 0; shift -= 8) {
+                buffer += static_cast<char>((v >> shift) & 0xff);
+            }
+        }
+
+        inline std::string copy_binary_header() {
+            std::string ret{"PGCOPY\n\377\r\n\0", 11};
+            copy_put_int32(ret, 0);
+            copy_put_int32(ret, 0);
+            return ret;
+        }
+    }
+    /**
+     * @brief Lazy range over a table in key order, read one page at a time with keyset predicates.
+     * Obtain one through PostgreSQLDatabase::scan(). Must not outlive the database.
+     *
+     * Each page runs WHERE (keys) > (last keys) ORDER BY keys LIMIT page_size as a server-side prepared
+     * statement, so with an index on the keys every page costs the same, however deep into the table it is.
+     */
+    class PostgreSQLScan {
+        PGconn* pg_conn{};
+        std::string first{};
+        std::string next{};
+        std::vector<int> key_index{};
+        std::vector<std::string> last{};
+        int page_size{};
+        PGresult* page{};
+        int page_row{};
+        std::unordered_map<std::string, std::string> row{};
+        bool started{false};
+        bool done{false};
+        bool failed{false};
+
+        friend class PostgreSQLDatabase;
+        PostgreSQLScan(PGconn* pg_conn, std::string first, std::string next, std::vector<int> key_index, int page_size);
+        bool advance();
+        void release();
+        public:
+            /**
+             * @brief Input iterator over the rows of a scan.
+             */
+            class iterator {
+                PostgreSQLScan* scan{};
+                public:
+                    using iterator_category = std::input_iterator_tag;
+                    using value_type = std::unordered_map<std::string, std::string>;
+                    using difference_type = std::ptrdiff_t;
+                    using pointer = const value_type*;
+                    using reference = const value_type&;
+
+                    iterator() = default;
+                    explicit iterator(PostgreSQLScan* scan) : scan(scan) {}
+                    reference operator*() const {
+                        return scan->row;
+                    }
+                    pointer operator->() const {
+                        return &scan->row;
+                    }
+                    iterator& operator++() {
+                        if (!scan->advance()) {
+                            scan = nullptr;
+                        }
+                        return *this;
+                    }
+                    void operator++(int) {
+                        ++*this;
+                    }
+                    bool operator==(const iterator& other) const {
+                        return scan == other.scan;
+                    }
+                    bool operator!=(const iterator& other) const {
+                        return scan != other.scan;
+                    }
+            };
+
+            PostgreSQLScan() = default;
+            PostgreSQLScan(const PostgreSQLScan&) = delete;
+            PostgreSQLScan& operator=(const PostgreSQLScan&) = delete;
+            PostgreSQLScan(PostgreSQLScan&& other) noexcept;
+            PostgreSQLScan& operator=(PostgreSQLScan&& other) noexcept;
+            /**
+             * @brief Check if the scan was set up and no page has failed.
+             * @return bool True if good.
+             */
+            bool good() const;
+            /**
+             * @brief Start the scan. The range can only be iterated once.
+             * @return iterator Iterator to the first row.
+             */
+            iterator begin();
+            /**
+             * @brief Get the end of the range.
+             * @return iterator End iterator.
+             */
+            iterator end();
+            /**
+             * @brief Destructor. Deallocates the prepared statements.
+             */
+            ~PostgreSQLScan();
+    };
+    /**
+     * @brief Notification received on a channel the connection listens on.
+     */
+    struct PostgreSQLNotification {
+        std::string channel{};
+        std::string payload{};
+        int pid{}; // backend process that sent it
+    };
+    namespace detail {
+        /**
+         * @brief Channels, result cache and background listener of one PostgreSQLDatabase.
+         */
+        struct PostgreSQLNotifyState {
+            static constexpr std::size_t max_inbox{4096};
+
+            std::mutex mutex{};
+            std::condition_variable cv{};
+            std::unordered_set<std::string> channels{};
+            std::shared_ptr<ResultCache> cache{};
+            std::deque<PostgreSQLNotification> inbox{}; // drained by poll_notifications()
+
+            // background listener, which owns its own connection
+            std::function<void(const PostgreSQLNotification&)> handler{};
+            std::vector<std::pair<bool, std::string>> commands{}; // (listen, channel)
+            std::uint64_t queued{};
+            std::uint64_t applied{};
+            std::thread thread{};
+            std::atomic<bool> running{false};
+            std::atomic<bool> stop{false};
+            int wake[2]{-1, -1}; // pipe that interrupts the listener's wait, POSIX only
+
+            std::shared_ptr<ResultCache> get_cache() {
+                std::lock_guard<std::mutex> lock(mutex);
+                return cache;
+            }
+            void wake_listener() {
+#ifdef SDB_POSIX
+                const char byte{};
+                (void)!::write(wake[1], &byte, 1);
+#endif
+            }
+        };
+        /**
+         * @brief Wait until any of the sockets is readable, with poll() on POSIX and select() elsewhere.
+         * @param sockets Sockets to wait on, negative entries are skipped.
+         * @param ready Set to one flag per socket, true if it is readable or has an error.
+         * @param timeout Timeout in milliseconds, negative to wait forever.
+         * @return int Number of ready sockets, 0 on timeout or interruption, negative on error.
+         */
+        int wait_readable(const std::vector<int>& sockets, std::vector<bool>& ready, int timeout);
+        /**
+         * @brief Extra connections of one PostgreSQLDatabase, opened on demand and kept for reuse.
+         */
+        struct PostgreSQLConnectionPool {
+            std::string conninfo{};
+            std::size_t max_size{};
+            std::mutex mutex{};
+            std::condition_variable cv{};
+            std::vector<PGconn*> idle{};
+            std::size_t open{};
+
+            PostgreSQLConnectionPool(std::string conninfo, std::size_t max_size) : conninfo(std::move(conninfo)), max_size(max_size) {}
+            PostgreSQLConnectionPool(const PostgreSQLConnectionPool&) = delete;
+            PostgreSQLConnectionPool& operator=(const PostgreSQLConnectionPool&) = delete;
+
+            /**
+             * @brief Take an idle connection or open a new one.
+             *
+             * The wait is bounded, since the connections may be held by the calling thread itself,
+             * e.g. by open cursors, and would then never be released.
+             * @param wait Longest to wait for a connection to be released if the pool is full, 0 to not wait.
+             * @return PGconn* Connection, nullptr if none is available in time or connecting failed.
+             */
+            PGconn* acquire(std::chrono::milliseconds wait) {
+                const auto deadline = std::chrono::steady_clock::now() + wait;
+                std::unique_lock<std::mutex> lock(mutex);
+                for (;;) {
+                    if (!idle.empty()) {
+                        PGconn* conn = idle.back();
+                        idle.pop_back();
+                        lock.unlock();
+                        if (PQstatus(conn) != CONNECTION_OK) {
+                            PQreset(conn);
+                        }
+                        if (PQstatus(conn) == CONNECTION_OK) {
+                            return conn;
+                        }
+                        PQfinish(conn);
+                        lock.lock();
+                        --open;
+                        continue;
+                    }
+                    if (open < max_size) {
+                        ++open;
+                        lock.unlock();
+                        PGconn* conn = PQconnectdb(conninfo.c_str());
+                        if (conn && PQstatus(conn) == CONNECTION_OK) {
+                            PQsetNoticeProcessor(conn, [](void*, const char*) {}, nullptr);
+                            return conn;
+                        }
+                        PQfinish(conn);
+                        lock.lock();
+                        --open;
+                        cv.notify_one();
+                        return nullptr;
+                    }
+                    if (!cv.wait_until(lock, deadline, [this]() { return !idle.empty() || open < max_size; })) {
+                        return nullptr;
+                    }
+                }
+            }
+            /**
+             * @brief Return a connection. Connections left inside a transaction or broken are closed.
+             * @param conn Connection from acquire().
+             */
+            void release(PGconn* conn) {
+                if (!conn) {
+                    return;
+                }
+
+                const bool reusable = PQstatus(conn) == CONNECTION_OK && PQtransactionStatus(conn) == PQTRANS_IDLE;
+                if (!reusable) {
+                    PQfinish(conn);
+                }
+
+                std::lock_guard<std::mutex> lock(mutex);
+                if (reusable) {
+                    idle.push_back(conn);
+                } else {
+                    --open;
+                }
+                cv.notify_one();
+            }
+            ~PostgreSQLConnectionPool() {
+                for (PGconn* conn : idle) {
+                    PQfinish(conn);
+                }
+            }
+        };
+    }
+    /**
+     * @brief Server-side cursor streaming a result set in batches. Obtain one through PostgreSQLDatabase::open_cursor().
+     * Must not outlive the database.
+     *
+     * The cursor lives in a transaction on a pooled connection. As soon as a batch arrives, the FETCH for
+     * the next one is sent asynchronously, so the server and network work on it while the caller processes
+     * the current batch. At most two batches are held in memory.
+     */
+    class PostgreSQLCursor {
+        detail::PostgreSQLConnectionPool* pool{};
+        PGconn* conn{};
+        std::string name{};
+        int batch_size{};
+        bool pending{false};
+        bool done{false};
+        bool failed{false};
+
+        friend class PostgreSQLDatabase;
+        PostgreSQLCursor(detail::PostgreSQLConnectionPool* pool, PGconn* conn, std::string name, int batch_size)
+            : pool(pool), conn(conn), name(std::move(name)), batch_size(batch_size) {}
+        bool send_fetch();
+        PGresult* take_result();
+        public:
+            PostgreSQLCursor() = default;
+            PostgreSQLCursor(const PostgreSQLCursor&) = delete;
+            PostgreSQLCursor& operator=(const PostgreSQLCursor&) = delete;
+            PostgreSQLCursor(PostgreSQLCursor&& other) noexcept;
+            PostgreSQLCursor& operator=(PostgreSQLCursor&& other) noexcept;
+            /**
+             * @brief Check if the cursor was declared and no fetch has failed.
+             * @return bool True if good.
+             */
+            bool good() const;
+            /**
+             * @brief Get the next batch and start fetching the one after it.
+             * @return std::vector<std::unordered_map<std::string, std::string>> Up to batch_size rows, empty once exhausted.
+             */
+            std::vector<std::unordered_map<std::string, std::string>> next();
+            /**
+             * @brief Check if the cursor is exhausted.
+             * @return bool True if no more rows are available.
+             */
+            bool exhausted() const;
+            /**
+             * @brief Close the cursor, end its transaction and return the connection to the pool.
+             */
+            void close();
+            /**
+             * @brief Destructor.
+             */
+            ~PostgreSQLCursor();
+    };
+    class PostgreSQLDatabase {
+            friend class PostgreSQLCursor;
+            friend struct detail::TableMigration;
+            friend class SQLite3CDC;
+
+            PGconn* pg_conn{};
+            std::string host{};
+            std::string user{};
+            std::string password{};
+            std::string database{};
+            bool is_good{false};
+            int port{5432};
+            std::shared_ptr<SlowQueryLog> slow_log{};
+            std::unique_ptr<detail::PostgreSQLNotifyState> notify{std::make_unique<detail::PostgreSQLNotifyState>()};
+            std::unique_ptr<detail::PostgreSQLConnectionPool> pool{};
+            std::size_t pool_size{8};
+            std::chrono::milliseconds pool_timeout{5000};
+            int cursor_batch_size{10000};
+
+            std::string conninfo() const;
+            detail::PostgreSQLConnectionPool& connection_pool();
+            static std::vector<std::unordered_map<std::string, std::string>> rows_from_result(PGresult* res, std::uint64_t& bytes);
+            static std::string quote_identifier(PGconn* conn, const std::string& identifier);
+            static void listener_loop(detail::PostgreSQLNotifyState* state, PGconn* conn);
+            void drain_notifications();
+            bool upload_bytea(const std::string& table, const std::string& column, const std::string& key_column,
+                const std::string& key, std::istream& is, std::int64_t size, std::size_t chunk_size);
+
+            struct Parameters {
+                std::vector<std::string> storage{};
+                std::vector<const char*> values{};
+                std::vector<int> lengths{};
+                std::vector<int> formats{};
+                bool ok{true}; // false if a value cannot be sent
+            };
+
+            static std::string convert_placeholders(const std::string& query);
+            std::string explain_analyze(const std::string& query, const Parameters& params);
+            PostgreSQLCursor declare_cursor(const std::string& nq, const Parameters& params, int batch_size);
+
+            template <typename... Args>
+            void log_slow_query(const detail::QueryProbe& probe, const std::string& query, const std::string& nq, const Parameters& params,
+                    const std::string& error = {}) {
+                if (!this->slow_log || probe.elapsed_ns() < this->slow_log->threshold_ns()) {
+                    return;
+                }
+
+                SlowQueryEntry entry{"postgresql", this->database, metrics::normalize(query), {detail::param_type_name<Args>()...}, probe.row_count(), probe.elapsed_ns(), {}, error};
+                if (error.empty() && this->slow_log->sample_plan()) {
+                    entry.plan = this->explain_analyze(nq, params);
+                }
+
+                this->slow_log->write(entry);
+            }
+
+            template <typename T>
+            std::string to_string(const T& value) {
+                if constexpr (std::is_same_v<T, std::string>) {
+                    return value;
+                } else if constexpr (std::is_same_v<T, const char*>) {
+                    return std::string(value);
+                } else {
+                    return std::to_string(value);
+                }
+            }
+
+            template <typename T>
+            void add_parameter(Parameters& params, const T& value) {
+                if constexpr (std::is_same_v<T, BlobView>) {
+#ifdef SDB_ENABLE_PRINTDEBUG
+                    std::cerr << "Binding bytea: " << value.size << " bytes\n";
+#endif
+                    // libpq lengths are int, and a null value pointer would send NULL instead of an empty bytea
+                    params.ok = params.ok && value.size <= static_cast<std::size_t>(INT32_MAX);
+                    params.values.push_back(value.data ? static_cast<const char*>(value.data) : "");
+                    params.lengths.push_back(params.ok ? static_cast<int>(value.size) : 0);
+                    params.formats.push_back(1);
+                } else {
+                    params.storage.push_back(remove_non_utf8(to_string(value)));
+#ifdef SDB_ENABLE_PRINTDEBUG
+                    std::cerr << "Binding string: " << params.storage.back() << "\n";
+#endif
+                    params.values.push_back(params.storage.back().c_str());
+                    params.lengths.push_back(0);
+                    params.formats.push_back(0);
+                }
+            }
+
+            template <typename... Args>
+            Parameters make_parameters(const Args&... args) {
+                Parameters params{};
+                params.storage.reserve(sizeof...(args)); // values point into storage
+                (add_parameter(params, args), ...);
+                return params;
+            }
+
+        public:
+            template <typename... Args>
+            bool exec(const std::string& query, Args... args) {
+                static_assert(sizeof...(args) > 0, "exec() requires more parameters");
+                if (!this->is_good) {
+                    return false;
+                }
+
+                detail::QueryProbe probe{query, this->slow_log != nullptr};
+
+                const std::string nq = convert_placeholders(query);
+
+                const Parameters params = make_parameters(args...);
+                if (!params.ok) {
+                    return false;
+                }
+
+                probe.prepared();
+
+                PGresult* res = PQexecParams(pg_conn, nq.c_str(), static_cast<int>(params.values.size()), nullptr,
+                    params.values.data(), params.lengths.data(), params.formats.data(), 0);
+
+                probe.executed();
+
+                if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+                    this->log_slow_query<Args...>(probe, query, nq, params, PQresultErrorMessage(res));
+                    PQclear(res);
+                    return false;
+                }
+
+                PQclear(res);
+
+                this->log_slow_query<Args...>(probe, query, nq, params);
+
+                probe.succeeded();
+                return true;
+            }
+
+            template <typename... Args>
+            std::vector<std::unordered_map<std::string, std::string>> query(const std::string& query, Args... args) {
+                static_assert(sizeof...(args) > 0, "query() requires more parameters");
+                if (!this->is_good) {
+                    return {};
+                }
+
+                std::vector<std::unordered_map<std::string, std::string>> result;
+                this->fetch(query, result, args...);
+                return result;
+            }
+        private:
+            template <typename... Args>
+            bool fetch(const std::string& query, std::vector<std::unordered_map<std::string, std::string>>& result, Args... args) {
+                detail::QueryProbe probe{query, this->slow_log != nullptr};
+
+                const std::string nq = convert_placeholders(query);
+
+                const Parameters params = make_parameters(args...);
+                if (!params.ok) {
+                    return false;
+                }
+
+                probe.prepared();
+
+                PGresult* res = PQexecParams(pg_conn, nq.c_str(), static_cast<int>(params.values.size()), nullptr,
+                    params.values.data(), params.lengths.data(), params.formats.data(), 0);
+
+                probe.executed();
+
+                if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+                    this->log_slow_query<Args...>(probe, query, nq, params, PQresultErrorMessage(res));
+                    PQclear(res);
+                    return false;
+                }
+
+                std::uint64_t bytes{0};
+                int nrows = PQntuples(res);
+                int nfields = PQnfields(res);
+
+                for (int i = 0; i < nrows; ++i) {
+                    std::unordered_map<std::string, std::string> row;
+                    for (int j = 0; j < nfields; ++j) {
+                        row[PQfname(res, j)] = PQgetvalue(res, i, j);
+                        bytes += static_cast<std::uint64_t>(PQgetlength(res, i, j));
+                    }
+                    result.push_back(std::move(row));
+                }
+
+                probe.fetched(result.size(), bytes);
+
+                PQclear(res);
+
+                this->log_slow_query<Args...>(probe, query, nq, params);
+
+                probe.succeeded();
+                return true;
+            }
+        public:
+            /**
+             * @brief Query the database through the result cache.
+             *
+             * The result is tagged with channels and dropped when a notification arrives on one of them,
+             * so writers (or triggers) should NOTIFY those channels on every change. The channels are
+             * listened on before the query runs. Notifications are picked up by the background listener
+             * or, without one, from this connection before every cached_query() and poll_notifications().
+             * Inside a transaction the query runs uncached.
+             * @param channels Channels to tag the result with.
+             * @param query Query to execute.
+             * @param args Parameters.
+             * @return std::shared_ptr<const std::vector<std::unordered_map<std::string, std::string>>> Data, nullptr on failure.
+             */
+            template <typename... Args>
+            std::shared_ptr<const std::vector<std::unordered_map<std::string, std::string>>> cached_query(const std::vector<std::string>& channels, const std::string& query, Args... args) {
+                using Result = std::vector<std::unordered_map<std::string, std::string>>;
+                if (!this->is_good) {
+                    return nullptr;
+                }
+
+                auto cache = this->notify->get_cache();
+                bool cacheable = cache && PQtransactionStatus(this->pg_conn) == PQTRANS_IDLE;
+
+                std::string key{};
+                std::uint64_t generation{};
+                if (cacheable) {
+                    this->drain_notifications();
+
+                    key = detail::cache_key(query, args...);
+                    if (auto hit = cache->get(key)) {
+                        return hit;
+                    }
+
+                    // listen first, so a change committed while the query runs still invalidates it
+                    generation = cache->generation();
+                    for (const auto& channel : channels) {
+                        cacheable = cacheable && this->listen(channel);
+                    }
+                }
+
+                auto result = std::make_shared<Result>();
+                if (!this->fetch(query, *result, args...)) {
+                    return nullptr;
+                }
+
+                if (cacheable) {
+                    cache->put(key, result, channels, generation);
+                }
+                return result;
+            }
+            std::vector<std::unordered_map<std::string, std::string>> query(const std::string& query);
+            bool exec(const std::string& query);
+            bool good();
+            bool is_open();
+            void open(const std::string& host, const std::string& user, const std::string& password, const std::string& database, int port=5432);
+            void close();
+            bool empty();
+            bool validate(const std::string& query);
+            std::int64_t get_last_insertion();
+            void set_slow_query_log(std::shared_ptr<SlowQueryLog> log);
+            /**
+             * @brief Start listening on a channel (LISTEN). With a background listener running, the
+             * channel is added to the listener's connection and this call waits until it is active.
+             * @param channel Channel name, quoted as an identifier.
+             * @return bool True if successful.
+             */
+            bool listen(const std::string& channel);
+            /**
+             * @brief Stop listening on a channel (UNLISTEN).
+             * @param channel Channel name.
+             * @return bool True if successful.
+             */
+            bool unlisten(const std::string& channel);
+            /**
+             * @brief Get the notifications received on this connection, waiting up to timeout for the first one.
+             *
+             * For event loops: wait for notification_socket() to become readable and call this with no timeout.
+             * Not used while a background listener runs; its handler receives the notifications instead.
+             * @param timeout Time to wait if none are queued.
+             * @return std::vector<PostgreSQLNotification> Notifications, oldest first.
+             */
+            std::vector<PostgreSQLNotification> poll_notifications(std::chrono::milliseconds timeout = std::chrono::milliseconds{0});
+            /**
+             * @brief Get the socket of this connection, to wait for notifications in an event loop.
+             * @return int Socket descriptor, -1 if not connected.
+             */
+            int notification_socket();
+            /**
+             * @brief Receive notifications on a background thread, on a dedicated connection.
+             *
+             * All channels listened on move to the listener's connection, which reconnects on failure.
+             * Every notification invalidates its channel in the result cache before the handler runs,
+             * and the whole cache is dropped after a reconnect, since notifications may have been missed.
+             * @param handler Called on the listener thread for every notification, may be empty.
+             * @return bool True if the listener is running.
+             */
+            bool start_listener(std::function<void(const PostgreSQLNotification&)> handler = {});
+            /**
+             * @brief Stop the background listener. Channels are listened on this connection again.
+             */
+            void stop_listener();
+            /**
+             * @brief Enable or disable the result cache used by cached_query(). Enabling again replaces it with an empty one.
+             * @param enable True to enable.
+             * @param max_bytes Memory budget, least recently used results are evicted past it.
+             * @return bool True if successful.
+             */
+            bool enable_result_cache(bool enable = true, std::size_t max_bytes = 16 * 1024 * 1024);
+            /**
+             * @brief Get the result cache counters.
+             * @return ResultCacheStats Counters, all zero if the cache is disabled.
+             */
+            ResultCacheStats get_result_cache_stats();
+            /**
+             * @brief Drop cached results.
+             * @param channel Channel to invalidate, empty to drop everything.
+             */
+            void invalidate_result_cache(const std::string& channel = "");
+            /**
+             * @brief Set the maximum number of extra connections used by query_all().
+             * Takes effect before the pool is first used.
+             * @param size Maximum number of pooled connections.
+             */
+            void set_pool_size(std::size_t size);
+            /**
+             * @brief Set how long query_all() and open_cursor() wait for a pooled connection when all are in use.
+             *
+             * Connections held by open cursors are only released when the cursors close, so a thread holding
+             * every pooled connection fails after this timeout rather than waiting for itself forever.
+             * @param timeout Longest wait, 0 to fail immediately.
+             */
+            void set_pool_timeout(std::chrono::milliseconds timeout);
+            /**
+             * @brief Run independent queries concurrently on pooled connections.
+             *
+             * Statements are sent asynchronously on up to concurrency connections and served from a single
+             * poll loop, so the total latency approaches that of the slowest query rather than the sum.
+             * Each statement runs in its own implicit transaction on its own connection, so they must not
+             * depend on each other or on uncommitted work on this connection.
+             * @param queries Statements to run, one query each.
+             * @param concurrency Maximum number of statements in flight.
+             * @return std::vector<std::vector<std::unordered_map<std::string, std::string>>> One result per
+             * statement, in the order given. Failed statements have an empty result.
+             */
+            std::vector<std::vector<std::unordered_map<std::string, std::string>>> query_all(const std::vector<std::string>& queries, std::size_t concurrency = 8);
+            /**
+             * @brief Stream a query through a server-side cursor (DECLARE ... CURSOR, FETCH) on a pooled connection.
+             * Rows are fetched in batches of set_cursor_batch_size() rows.
+             * @param query Query to execute.
+             * @param args Parameters.
+             * @return PostgreSQLCursor Cursor, check good() for success.
+             */
+            template <typename... Args>
+            PostgreSQLCursor open_cursor(const std::string& query, Args... args) {
+                if (!this->is_good) {
+                    return {};
+                }
+
+                const Parameters params = make_parameters(args...);
+                if (!params.ok) {
+                    return {};
+                }
+                return this->declare_cursor(convert_placeholders(query), params, this->cursor_batch_size);
+            }
+            /**
+             * @brief Set the rows per FETCH of cursors opened by open_cursor() from now on.
+             * @param batch_size Rows per FETCH, at least 1.
+             */
+            void set_cursor_batch_size(int batch_size);
+            /**
+             * @brief Create an empty large object. Large object calls must run inside a transaction.
+             * @return Oid New object id, InvalidOid on failure.
+             */
+            Oid create_large_object();
+            /**
+             * @brief Open a large object.
+             * @param oid Object id.
+             * @param writable True to open for reading and writing.
+             * @return PostgreSQLLargeObject Handle, check good() for success.
+             */
+            PostgreSQLLargeObject open_large_object(Oid oid, bool writable = false);
+            /**
+             * @brief Delete a large object.
+             * @param oid Object id.
+             * @return bool True if successful.
+             */
+            bool unlink_large_object(Oid oid);
+            /**
+             * @brief Stream a client-side file into a new large object.
+             * @param path File to read.
+             * @return Oid New object id, InvalidOid on failure.
+             */
+            Oid import_large_object(const std::string& path);
+            /**
+             * @brief Stream a large object into a client-side file.
+             * @param oid Object id.
+             * @param path File to write.
+             * @return bool True if successful.
+             */
+            bool export_large_object(Oid oid, const std::string& path);
+            /**
+             * @brief Read a slice of a bytea value into a caller buffer, using a binary result.
+             *
+             * Slicing is cheapest for columns with STORAGE EXTERNAL, which are stored uncompressed.
+             * @param table Table name, inserted verbatim.
+             * @param column Bytea column, inserted verbatim.
+             * @param key_column Column identifying the row, inserted verbatim.
+             * @param key Key value.
+             * @param offset Byte offset into the value.
+             * @param buffer Buffer of at least size bytes.
+             * @param size Maximum number of bytes to read.
+             * @return std::int64_t Number of bytes read, -1 on failure or if the row does not exist.
+             */
+            std::int64_t read_bytea(const std::string& table, const std::string& column, const std::string& key_column,
+                const std::string& key, std::int64_t offset, void* buffer, std::int64_t size);
+            /**
+             * @brief Write a bytea value to an output stream in chunks.
+             *
+             * The value is fetched once as a binary result, so it is held in memory while it is written.
+             * @param table Table name, inserted verbatim.
+             * @param column Bytea column, inserted verbatim.
+             * @param key_column Column identifying the row, inserted verbatim.
+             * @param key Key value.
+             * @param os Stream to write to.
+             * @param chunk_size Bytes per write.
+             * @return bool True if successful, false on failure or if the row does not exist or is NULL.
+             */
+            bool read_bytea(const std::string& table, const std::string& column, const std::string& key_column,
+                const std::string& key, std::ostream& os, std::int64_t chunk_size = 1024 * 1024);
+            /**
+             * @brief Stream an input stream into a bytea value through binary COPY, without holding it in memory.
+             * @param table Table name, inserted verbatim.
+             * @param column Bytea column, inserted verbatim.
+             * @param key_column Column identifying the row, inserted verbatim.
+             * @param key Key value of an existing row.
+             * @param is Stream to read from.
+             * @param size Number of bytes to read from the stream.
+             * @param chunk_size Bytes per read.
+             * @return bool True if the row was updated. On failure inside a transaction, the transaction is left usable.
+             */
+            bool write_bytea(const std::string& table, const std::string& column, const std::string& key_column,
+                const std::string& key, std::istream& is, std::int64_t size, std::size_t chunk_size = 1024 * 1024);
+            /**
+             * @brief Scan a table in key order, page by page, as a lazy range of rows.
+             * @param table Table name, inserted verbatim.
+             * @param keys Columns of a unique, non-null key, inserted verbatim. Must be part of columns.
+             * @param page_size Rows per page.
+             * @param columns Columns to select, inserted verbatim.
+             * @return PostgreSQLScan Range of rows, check good() for success.
+             */
+            PostgreSQLScan scan(const std::string& table, const std::vector<std::string>& keys, int page_size = 1000, const std::string& columns = "*");
+            /**
+             * @brief Stream the result of a query to a sink with COPY (query) TO STDOUT, without building rows.
+             * @param query Query to export, or a table name.
+             * @param sink Receives the data as the server sends it.
+             * @param format ExportFormat::Text, ExportFormat::CSV or ExportFormat::Binary.
+             * @param header Write a header line with the column names (CSV only).
+             * @return std::int64_t Number of rows written, -1 on failure or if the sink aborted.
+             */
+            std::int64_t copy_out(const std::string& query, const ExportSink& sink, ExportFormat format = ExportFormat::CSV, bool header = true);
+#ifdef SDB_POSIX
+            /**
+             * @brief Stream the result of a query to a file descriptor with COPY (query) TO STDOUT.
+             * @return std::int64_t Number of rows written, -1 on failure.
+             */
+            std::int64_t copy_out(const std::string& query, int fd, ExportFormat format = ExportFormat::CSV, bool header = true);
+#endif
+            /**
+             * @brief Bulk load a CSV or NDJSON file into a table with COPY FROM STDIN (FORMAT binary).
+             *
+             * The file is mapped and parsed in parallel chunks, and the rows are encoded in file order into
+             * binary COPY, one COPY per batch_size rows. Binary COPY does not cast, so the table's columns
+             * must be text, bigint, double precision and boolean as given by ImportOptions::types.
+             * Rows with a value that does not convert are skipped. Batches finished before an error are kept.
+             * @param table Table to copy into, quoted as one identifier like the column names.
+             * @param path File to read.
+             * @param options Format, columns and batching.
+             * @return ImportStats Row counts, ok is false and error is set on failure.
+             */
+            ImportStats import_file(const std::string& table, const std::string& path, const ImportOptions& options = {});
+            PostgreSQLDatabase() = default;
+            PostgreSQLDatabase(const std::string& host, const std::string& user, const std::string& password, const std::string& database, int port=5432);
+            ~PostgreSQLDatabase();
+    };
+#endif
+#if defined(SDB_SQLITE3) && defined(SDB_POSTGRESQL)
+    /**
+     * @brief Options for migrate_table().
+     */
+    struct MigrationOptions {
+        /**
+         * @brief Destination table, inserted verbatim. Empty for the source table name.
+         */
+        std::string target{};
+        /**
+         * @brief Create the destination table from the source schema if it does not exist.
+         */
+        bool create_table{true};
+        /**
+         * @brief Rows per batch handed from the reading thread to the writing thread.
+         */
+        std::size_t batch_rows{10000};
+        /**
+         * @brief Batches that may wait between the threads, which bounds memory use.
+         */
+        std::size_t queue_depth{8};
+    };
+    /**
+     * @brief Result of migrate_table().
+     */
+    struct MigrationStats {
+        bool ok{false};
+        std::uint64_t rows{};
+        std::uint64_t skipped{}; // rows with a value that does not convert to the destination column type
+        std::uint64_t bytes{};
+        std::string error{};
+    };
+    namespace detail {
+        struct MigrationColumn {
+            std::string name{};
+            ColumnType type{ColumnType::Text};
+            bool not_null{false};
+            int primary_key{}; // position in the primary key, 0 if not part of it
+        };
+
+        struct TableMigration {
+            static bool sqlite_schema(SQLite3Database& db, const std::string& table, std::vector<MigrationColumn>& columns);
+            static bool postgresql_schema(PostgreSQLDatabase& db, const std::string& table, std::vector<MigrationColumn>& columns);
+            static std::string create_statement(const std::string& table, const std::vector<MigrationColumn>& columns, bool postgresql);
+            static bool encode_row(sqlite3_stmt* stmt, const std::vector<MigrationColumn>& columns, std::string& out);
+            static const char* bind_row(sqlite3_stmt* stmt, const std::vector<MigrationColumn>& columns, const char* p, const char* end);
+            static MigrationStats to_postgresql(SQLite3Database& from, PostgreSQLDatabase& to, const std::string& table, const MigrationOptions& options);
+            static MigrationStats to_sqlite(PostgreSQLDatabase& from, SQLite3Database& to, const std::string& table, const MigrationOptions& options);
+        };
+
+        ColumnType sqlite_declared_type(const std::string& declared);
+    }
+    /**
+     * @brief Copy a SQLite3 table into PostgreSQL with binary COPY.
+     *
+     * One thread steps a statement over the source table and encodes rows in batches while this
+     * thread streams them into a single COPY, so at most queue_depth batches are held in memory and
+     * the copy is all or nothing. Declared types map by SQLite affinity: INT to bigint, REAL/FLOA/DOUB
+     * to double precision, BOOL to boolean, BLOB to bytea and everything else, including NUMERIC and
+     * DATE types, to text so values arrive unchanged.
+     * @param from Source database.
+     * @param to Destination database.
+     * @param table Source table, inserted verbatim.
+     * @param options Destination table and batching.
+     * @return MigrationStats Row counts, ok is false and error is set on failure.
+     */
+    MigrationStats migrate_table(SQLite3Database& from, PostgreSQLDatabase& to, const std::string& table, const MigrationOptions& options = {});
+    /**
+     * @brief Copy a PostgreSQL table into SQLite3 from COPY TO STDOUT (FORMAT binary).
+     *
+     * One thread receives the COPY stream in batches while this thread inserts them through one
+     * prepared statement in a single transaction. Integer types map to INTEGER, float4/float8 to REAL,
+     * boolean to BOOLEAN, bytea to BLOB, and every other type is read as its text form into TEXT.
+     * @param from Source database.
+     * @param to Destination database.
+     * @param table Source table, inserted verbatim and resolved with regclass.
+     * @param options Destination table and batching.
+     * @return MigrationStats Row counts, ok is false and error is set on failure.
+     */
+    MigrationStats migrate_table(PostgreSQLDatabase& from, SQLite3Database& to, const std::string& table, const MigrationOptions& options = {});
+    /**
+     * @brief Options for SQLite3CDC.
+     */
+    struct CDCOptions {
+        /**
+         * @brief Tables to mirror. Empty for every table in the main database.
+         */
+        std::vector<std::string> tables{};
+        /**
+         * @brief Changes applied to PostgreSQL per batch.
+         */
+        std::size_t batch_size{1000};
+        /**
+         * @brief Longest a change waits for its batch to fill before it is applied anyway.
+         */
+        std::chrono::milliseconds flush_interval{100};
+        /**
+         * @brief Capacity of the lock-free change queue, rounded up to a power of two.
+         */
+        std::size_t queue_capacity{65536};
+    };
+    /**
+     * @brief Counters of a SQLite3CDC.
+     */
+    struct CDCStats {
+        std::uint64_t captured{};       // row changes committed on SQLite3
+        std::uint64_t applied{};        // rows upserted or deleted on PostgreSQL, after coalescing changes to the same row
+        std::uint64_t pending{};        // captured changes not yet applied
+        std::uint64_t batches{};
+        std::uint64_t failed_batches{}; // batches that failed and were retried
+        std::uint64_t overflowed{};     // changes that found the queue full and took the locked path
+        std::chrono::nanoseconds lag{}; // SQLite3 commit to PostgreSQL commit, for the oldest change of the last batch
+        std::chrono::nanoseconds max_lag{};
+        double throughput{};            // rows applied per second over the last full second
+        std::string error{};            // last error, empty once a batch succeeds
+    };
+    /**
+     * @brief Change data capture from a SQLite3 database into PostgreSQL.
+     *
+     * The update hook records the table and rowid of every change, and the WAL hook queues them into a
+     * lock-free queue once their commit is visible to other connections. A worker thread coalesces them into batches, reads the current rows through its own
+     * read-only connection to the database file, and applies them to PostgreSQL in one transaction per
+     * batch: multi-row INSERT ... ON CONFLICT DO UPDATE for rows that exist and DELETE for rows that do
+     * not, pipelined when libpq supports it. Because the current row is read at apply time, replaying a
+     * change is harmless and failed batches are retried until they succeed.
+     *
+     * Mirrored tables need an INTEGER PRIMARY KEY, and the PostgreSQL table the same name, the same
+     * columns and a unique constraint on that key, as migrate_table() creates. Table and column names
+     * are quoted, so they must match in case. SQLite does not call the
+     * update hook for WITHOUT ROWID tables, for DELETE without WHERE (the truncate optimization) or for
+     * rows removed by REPLACE conflict resolution on another unique column; those changes are not mirrored.
+     * The database must be a file in WAL mode.
+     */
+    class SQLite3CDC {
+        struct Table {
+            std::string name{};
+            std::vector<std::string> columns{};
+            std::size_t key{};
+            sqlite3_stmt* select{};
+            std::string insert{};
+            std::string conflict{};
+            std::string remove{};
+            bool supported{false};
+        };
+        struct Statement {
+            std::string query{};
+            std::deque<std::string> storage{};
+            std::vector<const char*> values{};
+            std::vector<int> lengths{};
+            std::vector<int> formats{};
+        };
+
+        SQLite3Database* source{};
+        CDCOptions options{};
+        std::unique_ptr<detail::SQLite3ChangeCapture> capture{};
+        std::unique_ptr<SQLite3Database> reader{};
+        detail::PostgreSQLConnectionPool* pool{};
+        PGconn* conn{};
+        std::unordered_map<std::uint32_t, Table> tables{};
+        std::thread worker{};
+        std::atomic<bool> running{false};
+        std::atomic<std::uint64_t> consumed{0};
+        std::atomic<std::uint64_t> applied{0};
+        std::atomic<std::uint64_t> batches{0};
+        std::atomic<std::uint64_t> failed_batches{0};
+        std::atomic<std::int64_t> lag_ns{0};
+        std::atomic<std::int64_t> max_lag_ns{0};
+        mutable std::mutex stats_mutex{};
+        double throughput{};
+        std::string error{};
+
+        void run();
+        Table& table(std::uint32_t id);
+        bool apply(const std::unordered_map<std::uint32_t, std::unordered_set<std::int64_t>>& dirty, std::uint64_t& rows);
+        bool send(std::vector<Statement>& statements);
+        void fail(const std::string& message);
+        public:
+            /**
+             * @brief Hook a SQLite3 database and start mirroring its changes. Both databases must outlive this object.
+             * @param source Database to capture. Only one SQLite3CDC can capture a database at a time.
+             * @param target Database to apply changes to, through a connection from its pool.
+             * @param options Tables, batching and queue size.
+             */
+            SQLite3CDC(SQLite3Database& source, PostgreSQLDatabase& target, CDCOptions options = {});
+            SQLite3CDC(const SQLite3CDC&) = delete;
+            SQLite3CDC& operator=(const SQLite3CDC&) = delete;
+            /**
+             * @brief Check if capture is running.
+             * @return bool True if good.
+             */
+            bool good() const;
+            /**
+             * @brief Wait until every change committed before the call has been applied.
+             * @param timeout Longest to wait.
+             * @return bool True if caught up, false on timeout.
+             */
+            bool flush(std::chrono::milliseconds timeout = std::chrono::seconds(10));
+            /**
+             * @brief Get the counters.
+             * @return CDCStats Snapshot of the counters.
+             */
+            CDCStats stats() const;
+            /**
+             * @brief Unhook the database, apply what is queued and stop the worker.
+             * Call while no other thread uses the source database.
+             */
+            void stop();
+            /**
+             * @brief Destructor, stops capture.
+             */
+            ~SQLite3CDC();
+    };
+#endif
+#if __cplusplus >= 202002L
+    /**
+     * @brief Row type returned by query().
+     */
+    using Row = std::unordered_map<std::string, std::string>;
+    /**
+     * @brief Operations shared by SQLite3Database and PostgreSQLDatabase.
+     *
+     * Generic code constrained on this concept is resolved at compile time,
+     * so targeting either backend adds no indirect calls.
+     */
+    template <typename T>
+    concept Database = requires(T& db, const std::string& query, const std::string& param) {
+        { db.exec(query) } -> std::same_as<bool>;
+        { db.exec(query, param) } -> std::same_as<bool>;
+        { db.query(query) } -> std::same_as<std::vector<Row>>;
+        { db.query(query, param) } -> std::same_as<std::vector<Row>>;
+        { db.good() } -> std::same_as<bool>;
+        { db.get_last_insertion() } -> std::same_as<std::int64_t>;
+    };
+
+    namespace detail {
+        template <typename T>
+        T from_string(const std::string& value) {
+            if constexpr (std::is_same_v<T, std::string>) {
+                return value;
+            } else if constexpr (std::is_same_v<T, bool>) {
+                return value == "1" || value == "t" || value == "true";
+            } else if constexpr (std::is_integral_v<T>) {
+                return static_cast<T>(std::strtoll(value.c_str(), nullptr, 10));
+            } else if constexpr (std::is_floating_point_v<T>) {
+                return static_cast<T>(std::strtod(value.c_str(), nullptr));
+            } else {
+                static_assert(std::is_same_v<T, std::string>, "unsupported column type");
+            }
+        }
+
+        template <Database DB, typename... Args>
+        std::vector<Row> query(DB& db, const std::string& query, const Args&... args) {
+            if constexpr (sizeof...(Args) == 0) {
+                return db.query(query);
+            } else {
+                return db.query(query, args...);
+            }
+        }
+    }
+
+    /**
+     * @brief Run a function inside a transaction.
+     *
+     * Commits if the function returns true (or void), rolls back if it returns false or throws.
+     * @param db Database.
+     * @param fn Function taking the database.
+     * @return bool True if committed.
+     */
+    template <Database DB, typename F>
+    bool transaction(DB& db, F&& fn) {
+        if (!db.exec("BEGIN;")) {
+            return false;
+        }
+
+        bool ok{true};
+        try {
+            if constexpr (std::is_void_v<std::invoke_result_t<F, DB&>>) {
+                fn(db);
+            } else {
+                ok = static_cast<bool>(fn(db));
+            }
+        } catch (...) {
+            db.exec("ROLLBACK;");
+            throw;
+        }
+
+        if (ok && db.exec("COMMIT;")) {
+            return true;
+        }
+
+        db.exec("ROLLBACK;");
+        return false;
+    }
+#ifdef SDB_SQLITE3
+    /**
+     * @brief Run a function inside a transaction with SQLite3Database::transaction(), which retries a locked BEGIN or COMMIT.
+     * @param db Database.
+     * @param fn Function taking the database.
+     * @return bool True if committed.
+     */
+    template <typename F>
+    bool transaction(SQLite3Database& db, F&& fn) {
+        return db.transaction(std::forward<F>(fn));
+    }
+#endif
+
+    /**
+     * @brief Insert rows in a single transaction.
+     * @param db Database.
+     * @param table Table name, inserted verbatim.
+     * @param columns Column names, inserted verbatim, one per tuple element.
+     * @param rows Rows to insert.
+     * @return bool True if every row was inserted and the transaction committed.
+     */
+    template <Database DB, typename... Ts>
+    bool bulk_insert(DB& db, const std::string& table, const std::vector<std::string>& columns, const std::vector<std::tuple<Ts...>>& rows) {
+        static_assert(sizeof...(Ts) > 0, "bulk_insert() requires at least one column");
+        if (columns.size() != sizeof...(Ts)) {
+            return false;
+        }
+
+        std::string query = "INSERT INTO " + table + " (";
+        std::string values{};
+        for (std::size_t i{0}; i < columns.size(); ++i) {
+            query += (i ? ", " : "") + columns[i];
+            values += i ? ", ?" : "?";
+        }
+        query += ") VALUES (" + values + ");";
+
+        return transaction(db, [&](DB& db) {
+            for (const std::tuple<Ts...>& row : rows) {
+                if (!std::apply([&](const Ts&... value) { return db.exec(query, value...); }, row)) {
+                    return false;
+                }
+            }
+            return true;
+        });
+    }
+
+    /**
+     * @brief Run a query and convert the named columns of each row.
+     *
+     * Example: query_as<std::int64_t, std::string>(db, {"id", "name"}, "SELECT id, name FROM users WHERE age > ?;", 30)
+     * @param db Database.
+     * @param columns Column to read for each tuple element.
+     * @param query Query to execute.
+     * @param args Query parameters.
+     * @return std::vector<std::tuple<Ts...>> Converted rows.
+     */
+    template <typename... Ts, Database DB, typename... Args>
+    std::vector<std::tuple<Ts...>> query_as(DB& db, const std::vector<std::string>& columns, const std::string& query, const Args&... args) {
+        if (columns.size() != sizeof...(Ts)) {
+            throw std::runtime_error{"query_as(): expected " + std::to_string(sizeof...(Ts)) + " columns"};
+        }
+
+        auto convert = [&]<std::size_t... I>(const Row& row, std::index_sequence<I...>) {
+            auto value = [&](const std::string& column) -> const std::string& {
+                auto it = row.find(column);
+                if (it == row.end()) {
+                    throw std::runtime_error{"query_as(): no column '" + column + "' in result"};
+                }
+                return it->second;
+            };
+            return std::tuple<Ts...>{detail::from_string<Ts>(value(columns[I]))...};
+        };
+
+        std::vector<std::tuple<Ts...>> ret{};
+        for (const Row& row : detail::query(db, query, args...)) {
+            ret.push_back(convert(row, std::index_sequence_for<Ts...>{}));
+        }
+        return ret;
+    }
+
+    /**
+     * @brief Page through a table in key order, one page of the database's scan() at a time.
+     */
+    template <Database DB>
+    class Cursor {
+        using Scan = decltype(std::declval<DB&>().scan(std::string{}, std::vector<std::string>{}));
+
+        Scan scan{};
+        typename Scan::iterator it{};
+        std::int64_t page_size{};
+        bool started{false};
+        bool done{false};
+        public:
+            /**
+             * @brief Constructor.
+             * @param db Database.
+             * @param table Table name, inserted verbatim.
+             * @param key Unique key column to order by, inserted verbatim. Must be part of columns.
+             * @param page_size Rows per page.
+             * @param columns Columns to select.
+             */
+            Cursor(DB& db, const std::string& table, const std::string& key, std::int64_t page_size = 1000, const std::string& columns = "*")
+                : scan(db.scan(table, {key}, page_size, columns)), page_size(page_size) {}
+            Cursor(const Cursor&) = delete;
+            Cursor& operator=(const Cursor&) = delete;
+            /**
+             * @brief Fetch the next page.
+             * @return std::vector<Row> Rows, empty once the table is exhausted.
+             */
+            std::vector<Row> next() {
+                if (done) {
+                    return {};
+                }
+                if (!started) {
+                    it = scan.begin();
+                    started = true;
+                }
+
+                std::vector<Row> rows{};
+                for (; it != scan.end() && static_cast<std::int64_t>(rows.size()) < page_size; ++it) {
+                    rows.push_back(*it);
+                }
+
+                if (it == scan.end() || !scan.good()) {
+                    done = true;
+                }
+
+                return rows;
+            }
+            /**
+             * @brief Check if the cursor is exhausted.
+             * @return bool True if no more rows are available.
+             */
+            bool exhausted() const {
+                return done;
+            }
+    };
+
+#ifdef SDB_SQLITE3
+    static_assert(Database<SQLite3Database>);
+#endif
+#ifdef SDB_POSTGRESQL
+    static_assert(Database<PostgreSQLDatabase>);
+#endif
+#endif
+}
+
+inline std::string sdatabase::remove_non_utf8(const std::string& input) {
+#ifdef SDB_ENABLE_ICONV
+    iconv_t cd = iconv_open("UTF-8//IGNORE", "UTF-8");
+    if (cd == (iconv_t)-1) {
+        throw std::runtime_error("iconv_open failed");
+    }
+
+    std::vector<char> output(input.size() * 2);
+    char* inbuf = const_cast<char*>(input.data());
+    size_t inbytesleft = input.size();
+    char* outbuf = output.data();
+    size_t outbytesleft = output.size();
+
+    while (inbytesleft > 0) {
+        size_t result = iconv(cd, &inbuf, &inbytesleft, &outbuf, &outbytesleft);
+        if (result == (size_t)-1) {
+            if (errno == EILSEQ || errno == EINVAL) {
+                /* glibc's //IGNORE reports EILSEQ after skipping, possibly with no input left */
+                if (inbytesleft > 0) {
+                    ++inbuf;
+                    --inbytesleft;
+                }
+            } else if (errno == E2BIG) {
+                size_t used = output.size() - outbytesleft;
+                output.resize(output.size() * 2);
+                outbuf = output.data() + used;
+                outbytesleft = output.size() - used;
+            } else {
+                iconv_close(cd);
+                return "";
+            }
+        }
+    }
+
+    iconv_close(cd);
+    return std::string(output.data(), output.size() - outbytesleft);
+#else
+    return input;
+#endif
+}
+
+namespace sdatabase::detail {
+    /* Counters of one normalised statement, or of other_statement once max_statements are tracked. */
+    inline metrics::StatementStats& metrics_entry(std::unordered_map<std::string, metrics::StatementStats>& stats, const std::string& statement) {
+        if (const auto it = stats.find(statement); it != stats.end()) {
+            return it->second;
+        }
+        return stats[stats.size() < metrics::max_statements ? statement : metrics::other_statement];
+    }
+
+    struct MetricsShard {
+        static constexpr std::size_t max_keys{1024};
+
+        std::mutex mutex{};
+        std::unordered_map<std::string, metrics::StatementStats> stats{}; // by normalised statement
+        std::unordered_map<std::string, std::string> keys{};             // statement text to normalised statement
+
+        const std::string& key(const std::string& query) {
+            if (const auto it = keys.find(query); it != keys.end()) {
+                return it->second;
+            }
+            // statements with inlined literals never repeat, so the memo is dropped rather than grown
+            if (keys.size() >= max_keys) {
+                keys.clear();
+            }
+            return keys.emplace(query, metrics::normalize(query)).first->second;
+        }
+    };
+
+    struct MetricsRegistry {
+        std::atomic<bool> enabled{false};
+        std::mutex mutex{};
+        std::vector<std::shared_ptr<MetricsShard>> shards{};
+        std::unordered_map<std::string, metrics::StatementStats> retired{}; // merged from shards of exited threads
+    };
+
+    inline MetricsRegistry& metrics_registry() {
+        static MetricsRegistry* registry = new MetricsRegistry{};
+        return *registry;
+    }
+
+    /* Registers the shard of one thread, and merges it into the registry when the thread exits. */
+    struct MetricsShardOwner {
+        std::shared_ptr<MetricsShard> shard{std::make_shared<MetricsShard>()};
+
+        MetricsShardOwner() {
+            MetricsRegistry& registry = metrics_registry();
+            std::lock_guard<std::mutex> lock(registry.mutex);
+            registry.shards.push_back(shard);
+        }
+        MetricsShardOwner(const MetricsShardOwner&) = delete;
+        MetricsShardOwner& operator=(const MetricsShardOwner&) = delete;
+        ~MetricsShardOwner() {
+            MetricsRegistry& registry = metrics_registry();
+            std::lock_guard<std::mutex> lock(registry.mutex);
+            {
+                std::lock_guard<std::mutex> shard_lock(shard->mutex);
+                for (const auto& [statement, stats] : shard->stats) {
+                    metrics_entry(registry.retired, statement).merge(stats);
+                }
+            }
+            registry.shards.erase(std::remove(registry.shards.begin(), registry.shards.end(), shard), registry.shards.end());
+        }
+    };
+
+    inline MetricsShard& metrics_shard() {
+        thread_local MetricsShardOwner owner{};
+        return *owner.shard;
+    }
+
+    inline QueryProbe::~QueryProbe() {
+        if (!record) {
+            return;
+        }
+
+        MetricsShard& shard = metrics_shard();
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        metrics::StatementStats& stats = metrics_entry(shard.stats, shard.key(query));
+        ++stats.calls;
+        if (!ok) {
+            ++stats.errors;
+        }
+        stats.rows += rows;
+        stats.bytes += bytes;
+        stats.prepare.record(prepare_ns);
+        stats.execute.record(execute_ns);
+        if (fetch_ns) {
+            stats.fetch.record(fetch_ns);
+        }
+    }
+
+    inline std::string prometheus_label(const std::string& value) {
+        std::string ret{};
+        for (char ch : value) {
+            if (ch == '\\' || ch == '"') {
+                ret += '\\';
+                ret += ch;
+            } else if (ch == '\n') {
+                ret += "\\n";
+            } else {
+                ret += ch;
+            }
+        }
+        return ret;
+    }
+}
+
+inline std::size_t sdatabase::metrics::Histogram::index_of(std::uint64_t value) {
+    if (value < sub_buckets) {
+        return static_cast<std::size_t>(value);
+    }
+
+#if defined(__GNUC__) || defined(__clang__)
+    const unsigned exponent = 63 - static_cast<unsigned>(__builtin_clzll(value));
+#else
+    unsigned exponent{0};
+    for (std::uint64_t rest = value >> 1; rest != 0; rest >>= 1) {
+        ++exponent;
+    }
+#endif
+    std::size_t sub = static_cast<std::size_t>(value >> (exponent - 3)) & (sub_buckets - 1);
+    std::size_t index = (exponent - 2) * sub_buckets + sub;
+    return index < bucket_count ? index : bucket_count - 1;
+}
+
+inline std::uint64_t sdatabase::metrics::Histogram::upper_bound_of(std::size_t index) {
+    if (index < sub_buckets) {
+        return index + 1;
+    }
+
+    unsigned exponent = static_cast<unsigned>(index / sub_buckets) + 2;
+    std::uint64_t sub = index % sub_buckets;
+    return ((sub_buckets + sub + 1) << (exponent - 3));
+}
+
+inline void sdatabase::metrics::Histogram::record(std::uint64_t value) {
+    ++buckets[index_of(value)];
+    if (total == 0 || value < min_value) {
+        min_value = value;
+    }
+    if (value > max_value) {
+        max_value = value;
+    }
+    ++total;
+    sum_value += value;
+}
+
+inline void sdatabase::metrics::Histogram::merge(const Histogram& other) {
+    if (other.total == 0) {
+        return;
+    }
+
+    for (std::size_t i{0}; i < bucket_count; ++i) {
+        buckets[i] += other.buckets[i];
+    }
+    if (total == 0 || other.min_value < min_value) {
+        min_value = other.min_value;
+    }
+    if (other.max_value > max_value) {
+        max_value = other.max_value;
+    }
+    total += other.total;
+    sum_value += other.sum_value;
+}
+
+inline std::uint64_t sdatabase::metrics::Histogram::percentile(double percentile) const {
+    if (total == 0) {
+        return 0;
+    }
+
+    auto rank = static_cast<std::uint64_t>(percentile / 100.0 * static_cast<double>(total) + 0.5);
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    std::uint64_t seen{0};
+    for (std::size_t i{0}; i < bucket_count; ++i) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            std::uint64_t bound = upper_bound_of(i);
+            return bound < max_value ? bound : max_value;
+        }
+    }
+
+    return max_value;
+}
+
+inline std::uint64_t sdatabase::metrics::Histogram::count_below_pow2(unsigned exponent) const {
+    std::size_t end = exponent < 3 ? (std::size_t{1} << exponent) : (exponent - 2) * sub_buckets;
+    if (end > bucket_count) {
+        end = bucket_count;
+    }
+
+    std::uint64_t ret{0};
+    for (std::size_t i{0}; i < end; ++i) {
+        ret += buckets[i];
+    }
+    return ret;
+}
+
+inline std::uint64_t sdatabase::metrics::Histogram::count() const {
+    return total;
+}
+
+inline std::uint64_t sdatabase::metrics::Histogram::sum() const {
+    return sum_value;
+}
+
+inline std::uint64_t sdatabase::metrics::Histogram::min() const {
+    return min_value;
+}
+
+inline std::uint64_t sdatabase::metrics::Histogram::max() const {
+    return max_value;
+}
+
+inline void sdatabase::metrics::StatementStats::merge(const StatementStats& other) {
+    calls += other.calls;
+    errors += other.errors;
+    rows += other.rows;
+    bytes += other.bytes;
+    prepare.merge(other.prepare);
+    execute.merge(other.execute);
+    fetch.merge(other.fetch);
+}
+
+inline void sdatabase::metrics::enable(bool enable) {
+    detail::metrics_registry().enabled.store(enable, std::memory_order_relaxed);
+}
+
+inline bool sdatabase::metrics::enabled() {
+    return detail::metrics_registry().enabled.load(std::memory_order_relaxed);
+}
+
+inline std::string sdatabase::metrics::normalize(const std::string& query) {
+    auto is_word = [](char ch) {
+        return std::isalnum(static_cast<unsigned char>(ch)) || ch == '_';
+    };
+
+    std::string ret{};
+    for (std::size_t i{0}; i < query.size(); ++i) {
+        char ch = query[i];
+        if (ch == '\'') {
+            ++i;
+            while (i < query.size()) {
+                if (query[i] == '\'' && i + 1 < query.size() && query[i + 1] == '\'') {
+                    i += 2;
+                } else if (query[i] == '\'') {
+                    break;
+                } else {
+                    ++i;
+                }
+            }
+            ret += '?';
+        } else if ((ch == '$' || ch == '?') && i + 1 < query.size() && std::isdigit(static_cast<unsigned char>(query[i + 1]))) {
+            while (i + 1 < query.size() && std::isdigit(static_cast<unsigned char>(query[i + 1]))) {
+                ++i;
+            }
+            ret += '?';
+        } else if (std::isdigit(static_cast<unsigned char>(ch)) && (ret.empty() || !is_word(ret.back()))) {
+            while (i + 1 < query.size() && (std::isalnum(static_cast<unsigned char>(query[i + 1])) || query[i + 1] == '.')) {
+                ++i;
+            }
+            ret += '?';
+        } else if (std::isspace(static_cast<unsigned char>(ch))) {
+            if (!ret.empty() && ret.back() != ' ') {
+                ret += ' ';
+            }
+        } else {
+            ret += ch;
+        }
+    }
+
+    while (!ret.empty() && (ret.back() == ' ' || ret.back() == ';')) {
+        ret.pop_back();
+    }
+
+    return ret;
+}
+
+inline sdatabase::metrics::Snapshot sdatabase::metrics::snapshot() {
+    detail::MetricsRegistry& registry = detail::metrics_registry();
+    std::vector<std::shared_ptr<detail::MetricsShard>> shards{};
+    std::unordered_map<std::string, StatementStats> merged{};
+    {
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        shards = registry.shards;
+        merged = registry.retired;
+    }
+
+    for (const auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        for (const auto& [statement, stats] : shard->stats) {
+            merged[statement].merge(stats);
+        }
+    }
+
+    Snapshot ret{};
+    for (auto& [statement, stats] : merged) {
+        ret.statements.push_back({statement, std::move(stats)});
+    }
+    std::sort(ret.statements.begin(), ret.statements.end(), [](const StatementMetrics& a, const StatementMetrics& b) {
+        return a.statement < b.statement;
+    });
+
+    return ret;
+}
+
+inline void sdatabase::metrics::reset() {
+    detail::MetricsRegistry& registry = detail::metrics_registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.retired.clear();
+    for (const auto& shard : registry.shards) {
+        std::lock_guard<std::mutex> shard_lock(shard->mutex);
+        shard->stats.clear();
+    }
+}
+
+inline bool sdatabase::metrics::write_prometheus(const std::string& path) {
+    const Snapshot snap = snapshot();
+    const std::string tmp_path = path + ".tmp";
+
+    std::ofstream file(tmp_path, std::ios::trunc);
+    if (!file) {
+        return false;
+    }
+
+    auto counter = [&](const char* name, std::uint64_t StatementStats::* field) {
+        file << "# TYPE " << name << " counter\n";
+        for (const StatementMetrics& m : snap.statements) {
+            file << name << "{statement=\"" << detail::prometheus_label(m.statement) << "\"} " << m.stats.*field << "\n";
+        }
+    };
+
+    auto histogram = [&](const char* name, Histogram StatementStats::* field) {
+        file << "# TYPE " << name << " histogram\n";
+        for (const StatementMetrics& m : snap.statements) {
+            const Histogram& h = m.stats.*field;
+            const std::string label = "statement=\"" + detail::prometheus_label(m.statement) + "\"";
+            /* 2^10 ns (~1us) through 2^35 ns (~34s) */
+            for (unsigned exponent{10}; exponent <= 35; ++exponent) {
+                file << name << "_bucket{" << label << ",le=\"" << static_cast<double>(std::uint64_t{1} << exponent) / 1e9
+                     << "\"} " << h.count_below_pow2(exponent) << "\n";
+            }
+            file << name << "_bucket{" << label << ",le=\"+Inf\"} " << h.count() << "\n";
+            file << name << "_sum{" << label << "} " << static_cast<double>(h.sum()) / 1e9 << "\n";
+            file << name << "_count{" << label << "} " << h.count() << "\n";
+        }
+    };
+
+    counter("sdb_statement_calls_total", &StatementStats::calls);
+    counter("sdb_statement_errors_total", &StatementStats::errors);
+    counter("sdb_statement_rows_total", &StatementStats::rows);
+    counter("sdb_statement_bytes_total", &StatementStats::bytes);
+    histogram("sdb_statement_prepare_seconds", &StatementStats::prepare);
+    histogram("sdb_statement_execute_seconds", &StatementStats::execute);
+    histogram("sdb_statement_fetch_seconds", &StatementStats::fetch);
+
+    file.close();
+    if (!file) {
+        return false;
+    }
+
+    return std::rename(tmp_path.c_str(), path.c_str()) == 0;
+}
+
+inline std::string sdatabase::detail::json_escape(const std::string& value) {
+    std::string ret{};
+    ret.reserve(value.size());
+    for (unsigned char ch : value) {
+        switch (ch) {
+            case '"': ret += "\\\""; break;
+            case '\\': ret += "\\\\"; break;
+            case '\n': ret += "\\n"; break;
+            case '\r': ret += "\\r"; break;
+            case '\t': ret += "\\t"; break;
+            default:
+                if (ch < 0x20) {
+                    char buf[8];
+                    std::snprintf(buf, sizeof(buf), "\\u%04x", ch);
+                    ret += buf;
+                } else {
+                    ret += static_cast<char>(ch);
+                }
+        }
+    }
+    return ret;
+}
+
+inline void sdatabase::detail::append_csv_field(std::string& out, const char* data, std::size_t size) {
+    // an empty unquoted field is NULL to COPY FROM, and an unquoted \. alone on a line ends the data
+    bool quote = size == 0 || (size == 2 && data[0] == '\\' && data[1] == '.');
+    for (std::size_t i{0}; i < size && !quote; ++i) {
+        quote = data[i] == ',' || data[i] == '"' || data[i] == '\n' || data[i] == '\r';
+    }
+
+    if (!quote) {
+        out.append(data, size);
+        return;
+    }
+
+    out += '"';
+    for (std::size_t i{0}; i < size; ++i) {
+        if (data[i] == '"') {
+            out += '"';
+        }
+        out += data[i];
+    }
+    out += '"';
+}
+
+inline void sdatabase::detail::append_text_field(std::string& out, const char* data, std::size_t size) {
+    for (std::size_t i{0}; i < size; ++i) {
+        switch (data[i]) {
+            case '\\': out += "\\\\"; break;
+            case '\t': out += "\\t"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            default: out += data[i];
+        }
+    }
+}
+
+inline void sdatabase::detail::append_json_string(std::string& out, const char* data, std::size_t size) {
+    out += '"';
+    std::size_t start{0};
+    for (std::size_t i{0}; i < size; ++i) {
+        const auto ch = static_cast<unsigned char>(data[i]);
+        if (ch >= 0x20 && ch != '"' && ch != '\\') {
+            continue;
+        }
+
+        out.append(data + start, i - start);
+        start = i + 1;
+        switch (ch) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default: {
+                char buf[8];
+                std::snprintf(buf, sizeof(buf), "\\u%04x", ch);
+                out += buf;
+            }
+        }
+    }
+    out.append(data + start, size - start);
+    out += '"';
+}
+
+inline void sdatabase::detail::append_hex(std::string& out, const unsigned char* data, std::size_t size) {
+    static constexpr char digits[] = "0123456789abcdef";
+    out += "\\x";
+    for (std::size_t i{0}; i < size; ++i) {
+        out += digits[data[i] >> 4];
+        out += digits[data[i] & 0x0f];
+    }
+}
+
+#ifdef SDB_POSIX
+inline sdatabase::ExportSink sdatabase::detail::fd_sink(int fd) {
+    return [fd](const char* data, std::size_t size) {
+        while (size > 0) {
+            const auto n = ::write(fd, data, size);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            data += n;
+            size -= static_cast<std::size_t>(n);
+        }
+        return true;
+    };
+}
+#endif
+
+inline const char* sdatabase::detail::find_any(const char* p, const char* end, char a, char b, char c, char d) {
+#if defined(__SSE2__)
+    const __m128i va = _mm_set1_epi8(a);
+    const __m128i vb = _mm_set1_epi8(b);
+    const __m128i vc = _mm_set1_epi8(c);
+    const __m128i vd = _mm_set1_epi8(d);
+    for (; end - p >= 16; p += 16) {
+        const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        const __m128i hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, va), _mm_cmpeq_epi8(block, vb)),
+                                          _mm_or_si128(_mm_cmpeq_epi8(block, vc), _mm_cmpeq_epi8(block, vd)));
+        const int mask = _mm_movemask_epi8(hits);
+        if (mask != 0) {
+            return p + __builtin_ctz(static_cast<unsigned>(mask));
+        }
+    }
+#endif
+    for (; p < end; ++p) {
+        if (*p == a || *p == b || *p == c || *p == d) {
+            return p;
+        }
+    }
+    return end;
+}
+
+inline const char* sdatabase::detail::next_record(const char* from, const char* target, const char* end, bool csv) {
+    if (target >= end) {
+        return end;
+    }
+
+    // from is a record start, so an odd number of quotes up to target means target is inside a quoted field
+    bool quoted{false};
+    if (csv) {
+        for (const char* p = from; p < target; ++p) {
+            p = static_cast<const char*>(std::memchr(p, '"', static_cast<std::size_t>(target - p)));
+            if (!p) {
+                break;
+            }
+            quoted = !quoted;
+        }
+    }
+
+    for (const char* p = target; p < end; ++p) {
+        p = find_any(p, end, '\n', csv ? '"' : '\n', '\n', '\n');
+        if (p == end) {
+            break;
+        }
+        if (*p == '"') {
+            quoted = !quoted;
+        } else if (!quoted) {
+            return p + 1;
+        }
+    }
+    return end;
+}
+
+inline const char* sdatabase::detail::parse_csv_record(const char* p, const char* end, char delimiter,
+        std::vector<ImportField>& row, std::deque<std::string>& arena) {
+    row.clear();
+    for (;;) {
+        ImportField field{};
+        if (p < end && *p == '"') {
+            const char* start = ++p;
+            std::string* unescaped{};
+            for (;;) {
+                const char* q = static_cast<const char*>(std::memchr(p, '"', static_cast<std::size_t>(end - p)));
+                if (q && q + 1 < end && q[1] == '"') {
+                    if (!unescaped) {
+                        unescaped = &arena.emplace_back();
+                    }
+                    unescaped->append(p, q + 1);
+                    p = q + 2;
+                    continue;
+                }
+
+                // an unterminated quote runs to the end of the input
+                q = q ? q : end;
+                if (unescaped) {
+                    unescaped->append(p, q);
+                    field.data = unescaped->data();
+                    field.size = unescaped->size();
+                } else {
+                    field.data = start;
+                    field.size = static_cast<std::size_t>(q - start);
+                }
+                p = q < end ? q + 1 : end;
+                break;
+            }
+            // anything between the closing quote and the delimiter is dropped
+            p = find_any(p, end, delimiter, '\n', '\n', '\n');
+        } else {
+            const char* q = find_any(p, end, delimiter, '\n', '\n', '\n');
+            const char* last = q > p && q[-1] == '\r' ? q - 1 : q;
+            field.data = p;
+            field.size = static_cast<std::size_t>(last - p);
+            field.null = last == p;
+            p = q;
+        }
+
+        row.push_back(field);
+        if (p >= end) {
+            return end;
+        }
+        if (*p++ == '\n') {
+            return p;
+        }
+    }
+}
+
+inline void sdatabase::detail::parse_csv(const char* begin, const char* end, char delimiter, std::size_t columns, ImportChunk& out) {
+    std::vector<ImportField> row{};
+    row.reserve(columns);
+    out.fields.reserve(static_cast<std::size_t>(end - begin) / 16);
+
+    for (const char* p = begin; p < end;) {
+        if (*p == '\n' || (*p == '\r' && p + 1 < end && p[1] == '\n')) {
+            p += *p == '\n' ? 1 : 2;
+            continue;
+        }
+
+        p = parse_csv_record(p, end, delimiter, row, out.arena);
+        if (row.size() != columns) {
+            ++out.skipped;
+            continue;
+        }
+        out.fields.insert(out.fields.end(), row.begin(), row.end());
+        ++out.rows;
+    }
+}
+
+inline const char* sdatabase::detail::parse_json_string(const char* p, const char* end, ImportField& field, std::deque<std::string>& arena) {
+    const char* q = find_any(p, end, '"', '\\', '"', '"');
+    if (q == end) {
+        return nullptr;
+    }
+    if (*q == '"') {
+        field.data = p;
+        field.size = static_cast<std::size_t>(q - p);
+        return q + 1;
+    }
+
+    std::string& out = arena.emplace_back(p, q);
+    const auto hex = [&end](const char* at, std::uint32_t& value) {
+        if (end - at < 4) {
+            return false;
+        }
+        value = 0;
+        for (int i{0}; i < 4; ++i) {
+            const char c = at[i];
+            const int digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+            if (digit < 0) {
+                return false;
+            }
+            value = value << 4 | static_cast<std::uint32_t>(digit);
+        }
+        return true;
+    };
+
+    for (p = q; p < end;) {
+        if (*p == '"') {
+            field.data = out.data();
+            field.size = out.size();
+            return p + 1;
+        }
+        if (*p != '\\') {
+            q = find_any(p, end, '"', '\\', '"', '"');
+            out.append(p, q);
+            p = q;
+            continue;
+        }
+        if (++p == end) {
+            return nullptr;
+        }
+
+        switch (*p++) {
+            case '"': out += '"'; break;
+            case '\\': out += '\\'; break;
+            case '/': out += '/'; break;
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'u': {
+                std::uint32_t cp{};
+                if (!hex(p, cp)) {
+                    return nullptr;
+                }
+                p += 4;
+                std::uint32_t low{};
+                if (cp >= 0xd800 && cp < 0xdc00 && end - p >= 6 && p[0] == '\\' && p[1] == 'u' && hex(p + 2, low) && low >= 0xdc00 && low < 0xe000) {
+                    cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+                    p += 6;
+                } else if (cp >= 0xd800 && cp < 0xe000) {
+                    cp = 0xfffd; // lone surrogate
+                }
+
+                if (cp < 0x80) {
+                    out += static_cast<char>(cp);
+                } else if (cp < 0x800) {
+                    out += static_cast<char>(0xc0 | cp >> 6);
+                    out += static_cast<char>(0x80 | (cp & 0x3f));
+                } else if (cp < 0x10000) {
+                    out += static_cast<char>(0xe0 | cp >> 12);
+                    out += static_cast<char>(0x80 | (cp >> 6 & 0x3f));
+                    out += static_cast<char>(0x80 | (cp & 0x3f));
+                } else {
+                    out += static_cast<char>(0xf0 | cp >> 18);
+                    out += static_cast<char>(0x80 | (cp >> 12 & 0x3f));
+                    out += static_cast<char>(0x80 | (cp >> 6 & 0x3f));
+                    out += static_cast<char>(0x80 | (cp & 0x3f));
+                }
+                break;
+            }
+            default:
+                return nullptr;
+        }
+    }
+    return nullptr;
+}
+
+template <typename F>
+bool sdatabase::detail::parse_json_object(const char* p, const char* end, std::deque<std::string>& arena, F&& on_field) {
+    const auto skip = [&p, end]() {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) {
+            ++p;
+        }
+    };
+
+    skip();
+    if (p == end || *p++ != '{') {
+        return false;
+    }
+    skip();
+    if (p < end && *p == '}') {
+        return true;
+    }
+
+    for (;;) {
+        ImportField key{};
+        skip();
+        if (p == end || *p != '"' || !(p = parse_json_string(p + 1, end, key, arena))) {
+            return false;
+        }
+        skip();
+        if (p == end || *p++ != ':') {
+            return false;
+        }
+        skip();
+        if (p == end) {
+            return false;
+        }
+
+        ImportField value{};
+        if (*p == '"') {
+            if (!(p = parse_json_string(p + 1, end, value, arena))) {
+                return false;
+            }
+        } else if (*p == '{' || *p == '[') {
+            // nested values are kept as their JSON text
+            const char* start = p;
+            int depth{0};
+            do {
+                if (*p == '"') {
+                    ImportField ignored{};
+                    if (!(p = parse_json_string(p + 1, end, ignored, arena))) {
+                        return false;
+                    }
+                    continue;
+                }
+                depth += *p == '{' || *p == '[' ? 1 : *p == '}' || *p == ']' ? -1 : 0;
+                ++p;
+            } while (depth > 0 && p < end);
+            if (depth != 0) {
+                return false;
+            }
+            value.data = start;
+            value.size = static_cast<std::size_t>(p - start);
+        } else {
+            const char* start = p;
+            while (p < end && *p != ',' && *p != '}' && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') {
+                ++p;
+            }
+            value.data = start;
+            value.size = static_cast<std::size_t>(p - start);
+            value.null = value.size == 4 && std::memcmp(start, "null", 4) == 0;
+            if (value.size == 0) {
+                return false;
+            }
+        }
+
+        on_field(key, value);
+
+        skip();
+        if (p == end) {
+            return false;
+        }
+        if (*p == '}') {
+            return true;
+        }
+        if (*p++ != ',') {
+            return false;
+        }
+    }
+}
+
+inline void sdatabase::detail::parse_ndjson(const char* begin, const char* end, const std::unordered_map<std::string, std::size_t>& index,
+        std::size_t columns, ImportChunk& out) {
+    std::vector<ImportField> row(columns);
+    std::string key{};
+    for (const char* p = begin; p < end;) {
+        const char* line_end = static_cast<const char*>(std::memchr(p, '\n', static_cast<std::size_t>(end - p)));
+        line_end = line_end ? line_end : end;
+        const char* line = p;
+        p = line_end < end ? line_end + 1 : end;
+
+        while (line < line_end && (*line == ' ' || *line == '\t' || *line == '\r')) {
+            ++line;
+        }
+        if (line == line_end) {
+            continue;
+        }
+
+        // keys that are not imported are ignored, missing ones are NULL
+        std::fill(row.begin(), row.end(), ImportField{nullptr, 0, true});
+        const bool ok = parse_json_object(line, line_end, out.arena, [&](const ImportField& name, const ImportField& value) {
+            key.assign(name.data, name.size);
+            if (const auto it = index.find(key); it != index.end()) {
+                row[it->second] = value;
+            }
+        });
+        if (!ok) {
+            ++out.skipped;
+            continue;
+        }
+        out.fields.insert(out.fields.end(), row.begin(), row.end());
+        ++out.rows;
+    }
+}
+
+inline std::string sdatabase::detail::quote_name(const std::string& name) {
+    std::string ret{"\""};
+    for (const char c : name) {
+        ret += c == '"' ? "\"\"" : std::string(1, c);
+    }
+    return ret + "\"";
+}
+
+inline bool sdatabase::detail::import_integer(const ImportField& field, std::int64_t& value) {
+    const char* begin = field.data;
+    const char* end = field.data + field.size;
+    if (begin < end && *begin == '+') {
+        ++begin;
+    }
+    const auto [ptr, ec] = std::from_chars(begin, end, value);
+    return ec == std::errc{} && ptr == end && begin < end;
+}
+
+inline bool sdatabase::detail::import_real(const ImportField& field, double& value) {
+    char buffer[64];
+    if (field.size == 0 || field.size >= sizeof(buffer)) {
+        return false;
+    }
+    std::memcpy(buffer, field.data, field.size);
+    buffer[field.size] = '\0';
+
+    char* end{};
+    value = std::strtod(buffer, &end);
+    return end == buffer + field.size;
+}
+
+inline bool sdatabase::detail::import_boolean(const ImportField& field, bool& value) {
+    const std::string_view text{field.data, field.size};
+    if (text == "true" || text == "TRUE" || text == "t" || text == "1") {
+        value = true;
+        return true;
+    }
+    if (text == "false" || text == "FALSE" || text == "f" || text == "0") {
+        value = false;
+        return true;
+    }
+    return false;
+}
+
+template <typename Writer>
+sdatabase::ImportStats sdatabase::detail::run_import(const std::string& path, const ImportOptions& options, Writer& writer) {
+    ImportStats stats{};
+    MappedFile file{path};
+    if (!file.ok) {
+        stats.error = "cannot read " + path;
+        return stats;
+    }
+    stats.bytes = file.size;
+
+    const char* begin = file.data;
+    const char* end = file.data + file.size;
+    if (file.size >= 3 && std::memcmp(begin, "\xef\xbb\xbf", 3) == 0) {
+        begin += 3;
+    }
+
+    const bool csv = options.format == ImportFormat::CSV;
+    std::vector<std::string> columns = options.columns;
+    std::size_t width = columns.size();
+    std::vector<ImportField> first{};
+    std::deque<std::string> arena{};
+
+    if (csv) {
+        if (options.header && begin < end) {
+            begin = parse_csv_record(begin, end, options.delimiter, first, arena);
+            if (!columns.empty() && columns.size() != first.size()) {
+                stats.error = "column count does not match the header";
+                return stats;
+            }
+            if (columns.empty()) {
+                for (const auto& it : first) {
+                    columns.emplace_back(it.data, it.size);
+                }
+            }
+            width = first.size();
+        }
+        if (width == 0) {
+            // without a header or columns, the first record decides the width
+            const char* p = begin;
+            while (p < end && (*p == '\n' || *p == '\r')) {
+                ++p;
+            }
+            if (p < end) {
+                parse_csv_record(p, end, options.delimiter, first, arena);
+                width = first.size();
+            }
+        }
+    } else if (columns.empty()) {
+        for (const char* p = begin; p < end && columns.empty();) {
+            const char* line_end = static_cast<const char*>(std::memchr(p, '\n', static_cast<std::size_t>(end - p)));
+            line_end = line_end ? line_end : end;
+            std::vector<std::string> keys{};
+            if (parse_json_object(p, line_end, arena, [&keys](const ImportField& name, const ImportField&) { keys.emplace_back(name.data, name.size); })) {
+                columns = std::move(keys);
+            }
+            p = line_end < end ? line_end + 1 : end;
+        }
+        width = columns.size();
+    }
+
+    if (width == 0) {
+        stats.ok = begin >= end;
+        if (!stats.ok) {
+            stats.error = "no columns to import";
+        }
+        return stats;
+    }
+
+    std::vector<ColumnType> types = options.types;
+    types.resize(width, ColumnType::Text);
+
+    std::unordered_map<std::string, std::size_t> index{};
+    for (std::size_t i{0}; i < columns.size(); ++i) {
+        index.emplace(columns[i], i);
+    }
+
+    if (!writer.begin(columns, types, stats)) {
+        return stats;
+    }
+
+    // chunks are parsed in parallel and handed to the writer in file order
+    const char delimiter = options.delimiter;
+    const std::size_t chunk_size = std::max<std::size_t>(options.chunk_size, 4096);
+    ThreadPool pool{options.threads};
+    std::deque<std::future<ImportChunk>> pending{};
+    bool ok{true};
+
+    for (const char* cursor = begin; ok && (cursor < end || !pending.empty());) {
+        while (cursor < end && pending.size() < pool.size() * 2) {
+            const char* target = static_cast<std::size_t>(end - cursor) > chunk_size ? cursor + chunk_size : end;
+            const char* next = next_record(cursor, target, end, csv);
+            pending.push_back(pool.submit([cursor, next, csv, delimiter, width, &index]() {
+                ImportChunk chunk{};
+                if (csv) {
+                    parse_csv(cursor, next, delimiter, width, chunk);
+                } else {
+                    parse_ndjson(cursor, next, index, width, chunk);
+                }
+                return chunk;
+            }));
+            cursor = next;
+        }
+
+        ImportChunk chunk = pending.front().get();
+        pending.pop_front();
+        stats.skipped += chunk.skipped;
+        ok = writer.write(chunk, stats);
+    }
+
+    stats.ok = ok && writer.finish(stats);
+    return stats;
+}
+
+inline sdatabase::SlowQueryLog::SlowQueryLog(SlowQueryLogConfig config) : config(std::move(config)) {
+    this->file.open(this->config.path, std::ios::app);
+    this->file.seekp(0, std::ios::end);
+    std::streamoff pos = this->file.tellp();
+    this->size = pos > 0 ? static_cast<std::size_t>(pos) : 0;
+}
+
+inline std::uint64_t sdatabase::SlowQueryLog::threshold_ns() const {
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(this->config.threshold).count());
+}
+
+inline bool sdatabase::SlowQueryLog::sample_plan() {
+    if (!this->config.capture_plan || this->config.plan_sample_rate <= 0.0) {
+        return false;
+    }
+
+    /* Deterministic sampling: capture whenever n * rate crosses an integer. */
+    const auto n = static_cast<double>(this->slow_count.fetch_add(1, std::memory_order_relaxed));
+    const double rate = this->config.plan_sample_rate;
+    return static_cast<std::uint64_t>((n + 1) * rate) != static_cast<std::uint64_t>(n * rate);
+}
+
+inline void sdatabase::SlowQueryLog::rotate() {
+    this->file.close();
+
+    if (this->config.max_files > 0) {
+        for (std::size_t i = this->config.max_files - 1; i > 0; --i) {
+            std::rename((this->config.path + "." + std::to_string(i)).c_str(), (this->config.path + "." + std::to_string(i + 1)).c_str());
+        }
+        std::rename(this->config.path.c_str(), (this->config.path + ".1").c_str());
+        this->file.open(this->config.path, std::ios::app);
+    } else {
+        this->file.open(this->config.path, std::ios::trunc);
+    }
+
+    this->size = 0;
+}
+
+inline void sdatabase::SlowQueryLog::write(const SlowQueryEntry& entry) {
+    char ts[32];
+    std::time_t now = std::time(nullptr);
+    std::tm tm{};
+#ifdef SDB_POSIX
+    gmtime_r(&now, &tm);
+#else
+    gmtime_s(&tm, &now);
+#endif
+    std::strftime(ts, sizeof(ts), "%Y-%m-%dT%H:%M:%SZ", &tm);
+
+    std::string line = std::string{"{\"ts\":\""} + ts + "\""
+        + ",\"backend\":\"" + entry.backend + "\""
+        + ",\"database\":\"" + detail::json_escape(entry.database) + "\""
+        + ",\"statement\":\"" + detail::json_escape(entry.statement) + "\""
+        + ",\"parameter_types\":[";
+    for (std::size_t i{0}; i < entry.parameter_types.size(); ++i) {
+        line += (i ? ",\"" : "\"") + entry.parameter_types[i] + "\"";
+    }
+    line += "],\"rows\":" + std::to_string(entry.rows)
+        + ",\"duration_ms\":" + std::to_string(static_cast<double>(entry.duration_ns) / 1e6);
+    if (!entry.plan.empty()) {
+        line += ",\"plan\":\"" + detail::json_escape(entry.plan) + "\"";
+    }
+    if (!entry.error.empty()) {
+        line += ",\"error\":\"" + detail::json_escape(entry.error) + "\"";
+    }
+    line += "}\n";
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->config.max_file_size > 0 && this->size > 0 && this->size + line.size() > this->config.max_file_size) {
+        this->rotate();
+    }
+
+    this->file << line;
+    this->file.flush();
+    this->size += line.size();
+}
+
+inline sdatabase::ResultCache::ResultCache(std::size_t max_bytes) : max_bytes(max_bytes) {
+    this->counters.max_bytes = max_bytes;
+}
+
+inline void sdatabase::ResultCache::erase(std::list<Entry>::iterator it) {
+    for (const auto& tag : it->tags) {
+        auto tagged_it = this->tagged.find(tag);
+        if (tagged_it != this->tagged.end()) {
+            tagged_it->second.erase(it->key);
+            if (tagged_it->second.empty()) {
+                this->tagged.erase(tagged_it);
+            }
+        }
+    }
+
+    this->counters.bytes -= it->bytes;
+    --this->counters.entries;
+    this->index.erase(it->key);
+    this->entries.erase(it);
+}
+
+inline std::shared_ptr<const sdatabase::ResultCache::Result> sdatabase::ResultCache::get(const std::string& key) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    auto it = this->index.find(key);
+    if (it == this->index.end()) {
+        ++this->counters.misses;
+        return nullptr;
+    }
+
+    ++this->counters.hits;
+    this->entries.splice(this->entries.begin(), this->entries, it->second);
+    return it->second->result;
+}
+
+inline std::uint64_t sdatabase::ResultCache::generation() const {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->epoch;
+}
+
+inline bool sdatabase::ResultCache::put(const std::string& key, std::shared_ptr<const Result> result, std::vector<std::string> tags, std::uint64_t generation) {
+    if (!result) {
+        return false;
+    }
+
+    const std::size_t bytes = estimate_size(*result) + key.size() + sizeof(Entry);
+    if (bytes > this->max_bytes) {
+        return false;
+    }
+
+    std::sort(tags.begin(), tags.end());
+    tags.erase(std::unique(tags.begin(), tags.end()), tags.end());
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->cleared_at > generation) {
+        return false;
+    }
+    for (const auto& tag : tags) {
+        auto it = this->invalidated_at.find(tag);
+        if (it != this->invalidated_at.end() && it->second > generation) {
+            return false;
+        }
+    }
+
+    auto existing = this->index.find(key);
+    if (existing != this->index.end()) {
+        this->erase(existing->second);
+    }
+
+    while (!this->entries.empty() && this->counters.bytes + bytes > this->max_bytes) {
+        this->erase(std::prev(this->entries.end()));
+        ++this->counters.evictions;
+    }
+
+    this->entries.push_front(Entry{key, std::move(result), std::move(tags), bytes});
+    this->index[key] = this->entries.begin();
+    for (const auto& tag : this->entries.front().tags) {
+        this->tagged[tag].insert(key);
+    }
+
+    this->counters.bytes += bytes;
+    ++this->counters.entries;
+    ++this->counters.insertions;
+    return true;
+}
+
+inline void sdatabase::ResultCache::invalidate(const std::string& tag) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->invalidated_at[tag] = ++this->epoch;
+
+    auto it = this->tagged.find(tag);
+    if (it == this->tagged.end()) {
+        return;
+    }
+
+    const std::vector<std::string> keys(it->second.begin(), it->second.end());
+    for (const auto& key : keys) {
+        auto entry = this->index.find(key);
+        if (entry != this->index.end()) {
+            this->erase(entry->second);
+            ++this->counters.invalidations;
+        }
+    }
+}
+
+inline void sdatabase::ResultCache::clear() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->cleared_at = ++this->epoch;
+    this->invalidated_at.clear();
+    this->counters.invalidations += this->entries.size();
+    this->entries.clear();
+    this->index.clear();
+    this->tagged.clear();
+    this->counters.entries = 0;
+    this->counters.bytes = 0;
+}
+
+inline sdatabase::ResultCacheStats sdatabase::ResultCache::stats() const {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->counters;
+}
+
+inline std::size_t sdatabase::ResultCache::estimate_size(const Result& result) {
+    // rough per-node overhead of std::unordered_map, enough to keep the budget honest
+    constexpr std::size_t node_overhead{48};
+
+    std::size_t bytes{sizeof(Result) + result.capacity() * sizeof(Result::value_type)};
+    for (const auto& row : result) {
+        bytes += row.bucket_count() * sizeof(void*);
+        for (const auto& [name, value] : row) {
+            bytes += node_overhead + name.capacity() + value.capacity();
+        }
+    }
+    return bytes;
+}
+
+#ifdef SDB_SQLITE3
+inline int sdatabase::callback(void* data, int argc, char** argv, char** name) {
+    std::unordered_map<std::string, std::string> map{};
+    for (int i{0}; i < argc; i++) {
+        map[name[i]] = argv[i] ? argv[i] : "";
+    }
+
+    auto& rows = data ? *static_cast<std::vector<std::unordered_map<std::string, std::string>>*>(data) : tmp;
+    rows.push_back(std::move(map));
+
+    return 0;
+}
+
+namespace sdatabase::detail {
+    struct alignas(16) PoolHeader {
+        std::uint32_t size_class;
+        std::uint32_t reserved;
+        std::uint64_t size;
+    };
+
+    inline constexpr std::uint32_t pool_oversized{0xffffffff};
+    inline constexpr std::size_t pool_max_classes{32};
+
+    struct PoolCounters {
+        std::atomic<std::uint64_t> allocations{};
+        std::atomic<std::uint64_t> frees{};
+        std::atomic<std::uint64_t> pool_hits{};
+        std::atomic<std::uint64_t> cached{};
+    };
+
+    struct PoolThreadCache;
+
+    struct PoolState {
+        bool installed{false};
+        std::size_t sizes[pool_max_classes]{};
+        std::size_t class_count{};
+        std::size_t max_cached{};
+        std::vector<std::uint8_t> lookup{};
+        std::mutex mutex{};
+        std::vector<PoolThreadCache*> caches{};
+        std::uint64_t retired[pool_max_classes + 1][3]{};
+    };
+
+    /* Never destroyed, since SQLite may release memory during static destruction. */
+    inline PoolState& pool_state() {
+        static PoolState* state = new PoolState{};
+        return *state;
+    }
+
+    inline void pool_bump(std::atomic<std::uint64_t>& counter, std::int64_t n = 1) {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    inline void pool_retire(std::uint32_t size_class, int counter) {
+        PoolState& state = pool_state();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        ++state.retired[size_class][counter];
+    }
+
+    struct PoolThreadCache {
+        void* heads[pool_max_classes]{};
+        PoolCounters counters[pool_max_classes + 1]{};
+
+        PoolThreadCache() {
+            PoolState& state = pool_state();
+            std::lock_guard<std::mutex> lock(state.mutex);
+            state.caches.push_back(this);
+        }
+
+        ~PoolThreadCache();
+    };
+
+    inline thread_local bool pool_cache_destroyed{false};
+
+    inline PoolThreadCache* pool_thread_cache() {
+        if (pool_cache_destroyed) {
+            return nullptr;
+        }
+
+        thread_local PoolThreadCache cache{};
+        return &cache;
+    }
+
+    inline PoolThreadCache::~PoolThreadCache() {
+        pool_cache_destroyed = true;
+
+        PoolState& state = pool_state();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        for (std::size_t i{0}; i <= state.class_count; ++i) {
+            state.retired[i][0] += counters[i].allocations.load(std::memory_order_relaxed);
+            state.retired[i][1] += counters[i].frees.load(std::memory_order_relaxed);
+            state.retired[i][2] += counters[i].pool_hits.load(std::memory_order_relaxed);
+        }
+        for (std::size_t i{0}; i < state.class_count; ++i) {
+            while (heads[i]) {
+                void* next = *static_cast<void**>(heads[i]);
+                std::free(static_cast<PoolHeader*>(heads[i]) - 1);
+                heads[i] = next;
+            }
+        }
+        for (std::size_t i{0}; i < state.caches.size(); ++i) {
+            if (state.caches[i] == this) {
+                state.caches.erase(state.caches.begin() + static_cast<std::ptrdiff_t>(i));
+                break;
+            }
+        }
+    }
+
+    inline std::size_t pool_round(std::size_t size) {
+        return (size + 15) & ~static_cast<std::size_t>(15);
+    }
+
+    inline std::uint32_t pool_class_of(std::size_t size) {
+        const PoolState& state = pool_state();
+        std::size_t index = (size + 15) / 16;
+        return index < state.lookup.size() ? state.lookup[index] : pool_oversized;
+    }
+
+    inline void* pool_malloc(int n) {
+        if (n <= 0) {
+            return nullptr;
+        }
+
+        PoolState& state = pool_state();
+        std::size_t size = static_cast<std::size_t>(n);
+        std::uint32_t size_class = pool_class_of(size);
+        PoolThreadCache* cache = pool_thread_cache();
+
+        if (size_class == pool_oversized) {
+            auto* header = static_cast<PoolHeader*>(std::malloc(sizeof(PoolHeader) + pool_round(size)));
+            if (!header) {
+                return nullptr;
+            }
+
+            header->size_class = pool_oversized;
+            header->size = pool_round(size);
+
+            if (cache) {
+                pool_bump(cache->counters[state.class_count].allocations);
+            } else {
+                pool_retire(static_cast<std::uint32_t>(state.class_count), 0);
+            }
+
+            return header + 1;
+        }
+
+        if (cache && cache->heads[size_class]) {
+            void* p = cache->heads[size_class];
+            cache->heads[size_class] = *static_cast<void**>(p);
+            pool_bump(cache->counters[size_class].cached, -1);
+            pool_bump(cache->counters[size_class].pool_hits);
+            pool_bump(cache->counters[size_class].allocations);
+            return p;
+        }
+
+        auto* header = static_cast<PoolHeader*>(std::malloc(sizeof(PoolHeader) + state.sizes[size_class]));
+        if (!header) {
+            return nullptr;
+        }
+
+        header->size_class = size_class;
+        header->size = state.sizes[size_class];
+
+        if (cache) {
+            pool_bump(cache->counters[size_class].allocations);
+        } else {
+            pool_retire(size_class, 0);
+        }
+
+        return header + 1;
+    }
+
+    inline void pool_free(void* p) {
+        if (!p) {
+            return;
+        }
+
+        PoolState& state = pool_state();
+        auto* header = static_cast<PoolHeader*>(p) - 1;
+        std::uint32_t size_class = header->size_class;
+        PoolThreadCache* cache = pool_thread_cache();
+
+        if (size_class == pool_oversized) {
+            if (cache) {
+                pool_bump(cache->counters[state.class_count].frees);
+            } else {
+                pool_retire(static_cast<std::uint32_t>(state.class_count), 1);
+            }
+
+            std::free(header);
+            return;
+        }
+
+        if (!cache) {
+            pool_retire(size_class, 1);
+            std::free(header);
+            return;
+        }
+
+        pool_bump(cache->counters[size_class].frees);
+        if (cache->counters[size_class].cached.load(std::memory_order_relaxed) < state.max_cached) {
+            *static_cast<void**>(p) = cache->heads[size_class];
+            cache->heads[size_class] = p;
+            pool_bump(cache->counters[size_class].cached);
+            return;
+        }
+
+        std::free(header);
+    }
+
+    inline int pool_size(void* p) {
+        return p ? static_cast<int>((static_cast<PoolHeader*>(p) - 1)->size) : 0;
+    }
+
+    inline void* pool_realloc(void* p, int n) {
+        if (!p) {
+            return pool_malloc(n);
+        }
+
+        auto* header = static_cast<PoolHeader*>(p) - 1;
+        std::size_t size = static_cast<std::size_t>(n);
+        if (header->size_class != pool_oversized && pool_class_of(size) == header->size_class) {
+            return p;
+        }
+
+        void* q = pool_malloc(n);
+        if (!q) {
+            return nullptr;
+        }
+
+        std::memcpy(q, p, header->size < size ? header->size : size);
+        pool_free(p);
+        return q;
+    }
+
+    inline int pool_roundup(int n) {
+        std::size_t size = static_cast<std::size_t>(n);
+        std::uint32_t size_class = pool_class_of(size);
+        return static_cast<int>(size_class == pool_oversized ? pool_round(size) : pool_state().sizes[size_class]);
+    }
+
+    inline int pool_init(void*) {
+        return SQLITE_OK;
+    }
+
+    inline void pool_shutdown(void*) {}
+}
+
+inline bool sdatabase::install_pool_allocator(const PoolAllocatorConfig& config) {
+    detail::PoolState& state = detail::pool_state();
+    if (state.installed) {
+        return false;
+    }
+
+    std::vector<std::size_t> sizes{};
+    for (std::size_t size : config.size_classes) {
+        if (size > 0) {
+            sizes.push_back(detail::pool_round(size));
+        }
+    }
+    if (config.page_cache_size > 0) {
+        sizes.push_back(detail::pool_round(static_cast<std::size_t>(config.page_cache_size)));
+    }
+
+    std::sort(sizes.begin(), sizes.end());
+    sizes.erase(std::unique(sizes.begin(), sizes.end()), sizes.end());
+    if (sizes.empty()) {
+        return false;
+    }
+    if (sizes.size() > detail::pool_max_classes) {
+        sizes.resize(detail::pool_max_classes);
+    }
+
+    state.class_count = sizes.size();
+    state.max_cached = config.max_cached_per_class;
+    state.lookup.assign(sizes.back() / 16 + 1, 0);
+    for (std::size_t i{0}, c{0}; i < state.lookup.size(); ++i) {
+        while (sizes[c] < i * 16) {
+            ++c;
+        }
+        state.lookup[i] = static_cast<std::uint8_t>(c);
+    }
+    for (std::size_t i{0}; i < sizes.size(); ++i) {
+        state.sizes[i] = sizes[i];
+    }
+
+    static const sqlite3_mem_methods methods{
+        detail::pool_malloc,
+        detail::pool_free,
+        detail::pool_realloc,
+        detail::pool_size,
+        detail::pool_roundup,
+        detail::pool_init,
+        detail::pool_shutdown,
+        nullptr,
+    };
+
+    if (sqlite3_config(SQLITE_CONFIG_MALLOC, &methods) != SQLITE_OK) {
+        return false;
+    }
+
+    state.installed = true;
+
+    if (config.page_cache_size > 0 && config.page_cache_count > 0) {
+        if (sqlite3_config(SQLITE_CONFIG_PAGECACHE, nullptr, config.page_cache_size, config.page_cache_count) != SQLITE_OK) {
+            return false;
+        }
+    }
+
+    if (config.lookaside_size > 0 && config.lookaside_count > 0) {
+        if (sqlite3_config(SQLITE_CONFIG_LOOKASIDE, config.lookaside_size, config.lookaside_count) != SQLITE_OK) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+inline std::vector<sdatabase::PoolAllocatorStats> sdatabase::get_pool_allocator_stats() {
+    detail::PoolState& state = detail::pool_state();
+    std::lock_guard<std::mutex> lock(state.mutex);
+
+    std::vector<PoolAllocatorStats> stats(state.class_count + 1);
+    for (std::size_t i{0}; i <= state.class_count; ++i) {
+        stats[i].size = i < state.class_count ? state.sizes[i] : 0;
+        stats[i].allocations = state.retired[i][0];
+        stats[i].frees = state.retired[i][1];
+        stats[i].pool_hits = state.retired[i][2];
+        for (const detail::PoolThreadCache* cache : state.caches) {
+            stats[i].allocations += cache->counters[i].allocations.load(std::memory_order_relaxed);
+            stats[i].frees += cache->counters[i].frees.load(std::memory_order_relaxed);
+            stats[i].pool_hits += cache->counters[i].pool_hits.load(std::memory_order_relaxed);
+            stats[i].cached += cache->counters[i].cached.load(std::memory_order_relaxed);
+        }
+        stats[i].in_use = stats[i].allocations > stats[i].frees ? stats[i].allocations - stats[i].frees : 0;
+    }
+
+    return stats;
+}
+
+inline sdatabase::SQLite3Database::SQLite3Database(const std::string& database) {
+    if (sqlite3_open(database.c_str(), &this->sqlite3_db)) {
+        return;
+    }
+
+    this->database = database;
+    this->is_good = true;
+}
+
+inline sdatabase::SQLite3Database::SQLite3Database() {
+    this->is_good = false;
+}
+
+inline void sdatabase::SQLite3Database::open(const std::string& database) {
+    if (this->is_good) {
+        return;
+    }
+
+    if (sqlite3_open(database.c_str(), &this->sqlite3_db)) {
+        return;
+    }
+
+    this->is_good = true;
+}
+
+inline bool sdatabase::SQLite3Database::exec(const std::string& query) {
+    if (!this->is_good) {
+        return false;
+    }
+
+    detail::QueryProbe probe{query, this->slow_log != nullptr};
+
+    if (!this->validate(query)) {
+        // preparing reads the schema, which fails while another connection holds the lock
+        const int code = sqlite3_errcode(this->sqlite3_db);
+        if (code == SQLITE_BUSY || code == SQLITE_LOCKED) {
+            return false;
+        }
+        throw std::runtime_error{"Invalid SQL statement in database file '" + this->database + "': " + query + "\n"};
+    }
+
+    probe.prepared();
+
+    char* err{};
+
+    detail::SQLite3TableCollector tables{};
+    detail::table_collector = this->cache ? &tables : nullptr;
+    int ret = sqlite3_exec(sqlite3_db, query.c_str(), nullptr, nullptr, &err);
+    detail::table_collector = nullptr;
+
+    probe.executed();
+
+    if (this->cache) {
+        this->cache->mark_dirty(tables);
+        if (sqlite3_get_autocommit(this->sqlite3_db)) {
+            this->cache->flush();
+        }
+    }
+
+    if (ret != SQLITE_OK) {
+        this->log_slow_query<>(probe, query, query, err ? err : sqlite3_errstr(ret));
+        sqlite3_free(err);
+        return false;
+    }
+
+    this->log_slow_query<>(probe, query, query);
+
+    probe.succeeded();
+    return true;
+}
+
+inline bool sdatabase::SQLite3Database::validate(const std::string& query) {
+    if (!this->is_good) {
+        return false;
+    }
+
+    sqlite3_stmt* stmt;
+
+    int ret = sqlite3_prepare_v2(sqlite3_db, query.c_str(), -1, &stmt, nullptr);
+
+    if (ret != SQLITE_OK) {
+        return false;
+    }
+
+    sqlite3_finalize(stmt);
+
+    return true;
+}
+
+inline std::vector<std::unordered_map<std::string, std::string>> sdatabase::SQLite3Database::query(const std::string& query) {
+    if (!this->is_good) {
+        return {};
+    }
+
+    if (this->cache) {
+        // only single statements go through the cache, scripts run as before
+        const auto end = query.find(';');
+        if (end == std::string::npos || query.find_first_not_of("; \t\r\n", end) == std::string::npos) {
+            if (!this->validate(query)) {
+                throw std::runtime_error{"Invalid SQL statement: " + query + "\n"};
+            }
+
+            auto result = this->cached_query(query);
+            return result ? *result : std::vector<std::unordered_map<std::string, std::string>>{};
+        }
+    }
+
+    detail::QueryProbe probe{query, this->slow_log != nullptr};
+
+    if (!this->validate(query)) {
+        throw std::runtime_error{"Invalid SQL statement: " + query + "\n"};
+    }
+
+    probe.prepared();
+
+    char* err{};
+    std::vector<std::unordered_map<std::string, std::string>> result{};
+
+    detail::SQLite3TableCollector tables{};
+    detail::table_collector = this->cache ? &tables : nullptr;
+    int status = sqlite3_exec(sqlite3_db, query.c_str(), sdatabase::callback, &result, &err);
+    detail::table_collector = nullptr;
+
+    probe.executed();
+
+    if (this->cache) {
+        this->cache->mark_dirty(tables);
+        if (sqlite3_get_autocommit(this->sqlite3_db)) {
+            this->cache->flush();
+        }
+    }
+
+    if (status != SQLITE_OK) {
+        this->log_slow_query<>(probe, query, query, err ? err : sqlite3_errstr(status));
+        sqlite3_free(err);
+        return {};
+    }
+
+    std::uint64_t bytes{0};
+    for (const auto& row : result) {
+        for (const auto& [name, value] : row) {
+            bytes += value.size();
+        }
+    }
+    probe.fetched(result.size(), bytes);
+
+    this->log_slow_query<>(probe, query, query);
+
+    probe.succeeded();
+    return result;
+}
+
+inline bool sdatabase::SQLite3Database::good() {
+    return this->is_good;
+}
+
+inline bool sdatabase::SQLite3Database::is_open() {
+    return this->good();
+}
+
+inline void sdatabase::SQLite3Database::close() {
+    this->stop_checkpointer();
+    if (this->is_good) {
+        // the connection still reads from the image and calls into the cache until it is really closed
+        if (sqlite3_close(this->sqlite3_db) != SQLITE_OK) {
+            return;
+        }
+        this->is_good = false;
+    }
+#ifdef SDB_POSIX
+    this->image.reset();
+#endif
+    this->cache.reset();
+}
+
+inline bool sdatabase::SQLite3Database::empty() {
+    return std::ifstream(this->database).peek() == std::ifstream::traits_type::eof();
+}
+
+inline sdatabase::SQLite3Database::~SQLite3Database() {
+    if (this->is_good) {
+        this->close();
+    }
+    if (this->is_good) {
+        // something still holds a statement: detach every callback into this object and let SQLite
+        // close the connection once the last statement is finalized
+        sqlite3* db = this->sqlite3_db;
+        sqlite3_update_hook(db, nullptr, nullptr);
+        sqlite3_commit_hook(db, nullptr, nullptr);
+        sqlite3_rollback_hook(db, nullptr, nullptr);
+        if (this->autocheckpoint >= 0) {
+            sqlite3_wal_autocheckpoint(db, this->autocheckpoint);
+        }
+        sqlite3_set_authorizer(db, nullptr, nullptr);
+        sqlite3_busy_handler(db, nullptr, nullptr);
+        sqlite3_trace_v2(db, 0, nullptr, nullptr);
+        sqlite3_close_v2(db);
+        this->is_good = false;
+#ifdef SDB_POSIX
+        // the connection may still read the mapped image, so it is never unmapped
+        (void)this->image.release();
+#endif
+    }
+}
+
+inline std::int64_t sdatabase::SQLite3Database::get_last_insertion() {
+    if (!this->is_good) {
+        return -1;
+    }
+
+    return sqlite3_last_insert_rowid(this->sqlite3_db);
+}
+
+inline int sdatabase::SQLite3Database::trace_callback(unsigned type, void* ctx, void* p, void* x) {
+    if (type != SQLITE_TRACE_PROFILE) {
+        return 0;
+    }
+
+    auto* profiler = static_cast<detail::SQLite3Profiler*>(ctx);
+    auto* stmt = static_cast<sqlite3_stmt*>(p);
+    auto ns = static_cast<std::uint64_t>(*static_cast<sqlite3_int64*>(x));
+
+    const char* sql = sqlite3_sql(stmt);
+    if (!sql) {
+        return 0;
+    }
+
+    std::lock_guard<std::mutex> lock(profiler->mutex);
+    SQLite3ProfileEntry& entry = profiler->entries[metrics::normalize(sql)];
+    ++entry.calls;
+    entry.total_ns += ns;
+    if (ns > entry.max_ns) {
+        entry.max_ns = ns;
+    }
+    entry.fullscan_steps += static_cast<std::uint64_t>(sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_FULLSCAN_STEP, 1));
+    entry.sorts += static_cast<std::uint64_t>(sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_SORT, 1));
+    entry.autoindexes += static_cast<std::uint64_t>(sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_AUTOINDEX, 1));
+    entry.vm_steps += static_cast<std::uint64_t>(sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_VM_STEP, 1));
+
+    return 0;
+}
+
+inline bool sdatabase::SQLite3Database::enable_profiler(bool enable) {
+    if (!this->is_good) {
+        return false;
+    }
+
+    if (!enable) {
+        return sqlite3_trace_v2(this->sqlite3_db, 0, nullptr, nullptr) == SQLITE_OK;
+    }
+
+    if (!this->profiler) {
+        this->profiler = std::make_unique<detail::SQLite3Profiler>();
+    }
+
+    return sqlite3_trace_v2(this->sqlite3_db, SQLITE_TRACE_PROFILE, trace_callback, this->profiler.get()) == SQLITE_OK;
+}
+
+inline int sdatabase::SQLite3Database::authorizer_callback(void* ctx, int action, const char* a, const char* b, const char* schema, const char* trigger) {
+    (void)schema;
+    (void)trigger;
+
+    auto* tables = detail::table_collector;
+    if (!tables) {
+        return SQLITE_OK;
+    }
+
+    const auto table = [a]() {
+        std::string ret{a ? a : ""};
+        std::transform(ret.begin(), ret.end(), ret.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        return ret;
+    };
+
+    switch (action) {
+        case SQLITE_READ:
+            if (a && *a) {
+                tables->reads.push_back(table());
+            }
+            break;
+        case SQLITE_INSERT:
+        case SQLITE_UPDATE:
+        case SQLITE_DELETE:
+            tables->writes.push_back(table());
+            break;
+        case SQLITE_CREATE_INDEX:
+        case SQLITE_CREATE_TABLE:
+        case SQLITE_CREATE_TEMP_INDEX:
+        case SQLITE_CREATE_TEMP_TABLE:
+        case SQLITE_CREATE_TEMP_TRIGGER:
+        case SQLITE_CREATE_TEMP_VIEW:
+        case SQLITE_CREATE_TRIGGER:
+        case SQLITE_CREATE_VIEW:
+        case SQLITE_DROP_INDEX:
+        case SQLITE_DROP_TABLE:
+        case SQLITE_DROP_TEMP_INDEX:
+        case SQLITE_DROP_TEMP_TABLE:
+        case SQLITE_DROP_TEMP_TRIGGER:
+        case SQLITE_DROP_TEMP_VIEW:
+        case SQLITE_DROP_TRIGGER:
+        case SQLITE_DROP_VIEW:
+        case SQLITE_ALTER_TABLE:
+        case SQLITE_ATTACH:
+        case SQLITE_DETACH:
+        case SQLITE_CREATE_VTABLE:
+        case SQLITE_DROP_VTABLE:
+            tables->schema_change = true;
+            break;
+        case SQLITE_FUNCTION: {
+            // built-in functions whose result depends on more than their arguments; the date and time
+            // functions only with 'now', which cannot be told apart here
+            static const std::unordered_set<std::string> builtin{"random", "randomblob", "changes", "total_changes",
+                "last_insert_rowid", "date", "time", "datetime", "julianday", "unixepoch", "strftime", "timediff",
+                "current_date", "current_time", "current_timestamp"};
+            std::string name{b ? b : ""};
+            std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+            const auto* db = static_cast<const SQLite3Database*>(ctx);
+            if (builtin.count(name) || db->volatile_functions.count(name)) {
+                tables->deterministic = false;
+            }
+            break;
+        }
+        default:
+            break;
+    }
+
+    return SQLITE_OK;
+}
+
+inline void sdatabase::SQLite3Database::update_hook_callback(void* ctx, int op, const char* schema, const char* table, sqlite3_int64 rowid) {
+    (void)op;
+
+    auto* db = static_cast<SQLite3Database*>(ctx);
+    if (db->cache) {
+        std::string name{table ? table : ""};
+        std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        db->cache->mark_dirty(name);
+    }
+    if (db->capture) {
+        db->capture->record(schema, table, rowid);
+    }
+}
+
+inline int sdatabase::SQLite3Database::commit_hook_callback(void* ctx) {
+    auto* db = static_cast<SQLite3Database*>(ctx);
+    if (db->cache) {
+        db->cache->flush();
+    }
+    if (db->capture) {
+        db->capture->commit();
+    }
+    return 0;
+}
+
+inline void sdatabase::SQLite3Database::rollback_hook_callback(void* ctx) {
+    auto* db = static_cast<SQLite3Database*>(ctx);
+    if (db->cache) {
+        db->cache->discard();
+    }
+    if (db->capture) {
+        db->capture->rollback();
+    }
+}
+
+inline void sdatabase::SQLite3Database::mark_volatile(const std::string& function, bool is_volatile) {
+    std::string name{function};
+    std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    if (is_volatile) {
+        this->volatile_functions.insert(std::move(name));
+    } else {
+        this->volatile_functions.erase(name);
+    }
+}
+
+inline void sdatabase::SQLite3Database::install_hooks() {
+    if (!this->is_good) {
+        return;
+    }
+
+    // one set of hooks serves the result cache, change capture and the checkpointer
+    const bool hooked = this->cache || this->capture;
+    sqlite3_update_hook(this->sqlite3_db, hooked ? update_hook_callback : nullptr, hooked ? this : nullptr);
+    sqlite3_commit_hook(this->sqlite3_db, hooked ? commit_hook_callback : nullptr, hooked ? this : nullptr);
+    sqlite3_rollback_hook(this->sqlite3_db, hooked ? rollback_hook_callback : nullptr, hooked ? this : nullptr);
+
+    // SQLite runs automatic checkpoints from a WAL hook of its own, which ours replaces and takes over
+    const bool wal = this->capture || this->checkpointer;
+    if (wal && this->autocheckpoint < 0) {
+        this->autocheckpoint = 1000;
+        sqlite3_stmt* stmt{};
+        if (sqlite3_prepare_v2(this->sqlite3_db, "PRAGMA wal_autocheckpoint;", -1, &stmt, nullptr) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW) {
+            this->autocheckpoint = sqlite3_column_int(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+        sqlite3_wal_hook(this->sqlite3_db, wal_hook_callback, this);
+    } else if (!wal && this->autocheckpoint >= 0) {
+        sqlite3_wal_autocheckpoint(this->sqlite3_db, this->autocheckpoint);
+        this->autocheckpoint = -1;
+    }
+}
+
+inline sqlite3_stmt* sdatabase::SQLite3Database::prepare(const std::string& nq, detail::SQLite3TableCollector* tables) {
+    detail::SQLite3TableCollector local{};
+    if (this->cache && !tables) {
+        tables = &local;
+    }
+
+    detail::table_collector = this->cache ? tables : nullptr;
+    sqlite3_stmt* stmt{};
+    const int ret = sqlite3_prepare_v2(this->sqlite3_db, nq.c_str(), -1, &stmt, nullptr);
+    detail::table_collector = nullptr;
+
+    if (ret != SQLITE_OK) {
+        sqlite3_finalize(stmt);
+        return nullptr;
+    }
+
+    if (this->cache) {
+        tables->read_only = sqlite3_stmt_readonly(stmt) != 0;
+        // marked before the statement runs, so the commit hook of an autocommit write sees it
+        if (!tables->read_only) {
+            this->cache->mark_dirty(*tables);
+        }
+    }
+
+    return stmt;
+}
+
+inline bool sdatabase::SQLite3Database::enable_result_cache(bool enable, std::size_t max_bytes) {
+    if (!this->is_good) {
+        return false;
+    }
+
+    if (!enable) {
+        sqlite3_set_authorizer(this->sqlite3_db, nullptr, nullptr);
+        this->cache.reset();
+        this->install_hooks();
+        return true;
+    }
+
+    auto state = std::make_unique<detail::SQLite3CacheState>(max_bytes);
+    if (sqlite3_set_authorizer(this->sqlite3_db, authorizer_callback, this) != SQLITE_OK) {
+        return false;
+    }
+    this->cache = std::move(state);
+    this->install_hooks();
+    return true;
+}
+
+inline sdatabase::ResultCacheStats sdatabase::SQLite3Database::get_result_cache_stats() {
+    return this->cache ? this->cache->cache.stats() : ResultCacheStats{};
+}
+
+inline void sdatabase::SQLite3Database::invalidate_result_cache(const std::string& table) {
+    if (!this->cache) {
+        return;
+    }
+
+    if (table.empty()) {
+        this->cache->cache.clear();
+        return;
+    }
+
+    std::string name{table};
+    std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    this->cache->cache.invalidate(name);
+}
+
+inline std::vector<sdatabase::SQLite3ProfileEntry> sdatabase::SQLite3Database::get_profile() {
+    if (!this->profiler) {
+        return {};
+    }
+
+    std::vector<SQLite3ProfileEntry> ret{};
+    {
+        std::lock_guard<std::mutex> lock(this->profiler->mutex);
+        for (const auto& [statement, entry] : this->profiler->entries) {
+            ret.push_back(entry);
+            ret.back().statement = statement;
+        }
+    }
+
+    std::sort(ret.begin(), ret.end(), [](const SQLite3ProfileEntry& a, const SQLite3ProfileEntry& b) {
+        return a.total_ns > b.total_ns;
+    });
+
+    return ret;
+}
+
+inline void sdatabase::SQLite3Database::print_profile(std::ostream& os) {
+    const std::vector<SQLite3ProfileEntry> profile = this->get_profile();
+
+    int rank{1};
+    for (const SQLite3ProfileEntry& entry : profile) {
+        os << rank++ << ". " << entry.statement << "\n"
+           << "   calls: " << entry.calls
+           << ", total: " << static_cast<double>(entry.total_ns) / 1e6 << " ms"
+           << ", max: " << static_cast<double>(entry.max_ns) / 1e6 << " ms"
+           << ", vm steps: " << entry.vm_steps
+           << ", full scan steps: " << entry.fullscan_steps
+           << ", sorts: " << entry.sorts
+           << ", auto indexes: " << entry.autoindexes << "\n";
+        if (entry.full_scan()) {
+            os << "   warning: full table scan\n";
+        }
+        if (entry.auto_index()) {
+            os << "   warning: automatic index created, consider adding an index\n";
+        }
+    }
+}
+
+inline std::string sdatabase::SQLite3Database::convert_placeholders(const std::string& query) {
+    /* $N becomes ?N so numbered parameters keep their positions */
+    std::string nq{};
+    for (size_t i = 0; i < query.size(); ++i) {
+        if (query[i] == '$' && i + 1 < query.size() && isdigit(query[i + 1])) {
+            nq += '?';
+        } else {
+            nq += query[i];
+        }
+    }
+    return nq;
+}
+
+inline std::string sdatabase::SQLite3Database::explain_query_plan(const std::string& query) {
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(sqlite3_db, ("EXPLAIN QUERY PLAN " + query).c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        return "";
+    }
+
+    std::string ret{};
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        const unsigned char* detail = sqlite3_column_text(stmt, 3);
+        if (!ret.empty()) {
+            ret += "\n";
+        }
+        ret += detail ? reinterpret_cast<const char*>(detail) : "";
+    }
+
+    sqlite3_finalize(stmt);
+    return ret;
+}
+
+inline void sdatabase::SQLite3Database::set_slow_query_log(std::shared_ptr<SlowQueryLog> log) {
+    this->slow_log = std::move(log);
+}
+
+inline int sdatabase::SQLite3Database::wal_hook_callback(void* ctx, sqlite3* sqlite3_db, const char* schema, int frames) {
+    auto* db = static_cast<SQLite3Database*>(ctx);
+    if (db->capture) {
+        db->capture->publish();
+    }
+
+    if (db->checkpointer) {
+        if (std::strcmp(schema, "main") == 0) {
+            db->checkpointer->committed(frames);
+        }
+    } else if (db->autocheckpoint > 0 && frames >= db->autocheckpoint) {
+        // what SQLite's own WAL hook does for wal_autocheckpoint
+        sqlite3_wal_checkpoint(sqlite3_db, schema);
+    }
+    return SQLITE_OK;
+}
+
+inline void sdatabase::SQLite3Database::checkpoint_loop(detail::SQLite3CheckpointState* state, sqlite3* db) {
+    const auto& options = state->options;
+    const auto wal_size = [state](std::filesystem::file_time_type& mtime) -> std::int64_t {
+        std::error_code ec;
+        const auto size = std::filesystem::file_size(state->wal_path, ec);
+        if (ec) {
+            mtime = {};
+            return 0;
+        }
+        mtime = std::filesystem::last_write_time(state->wal_path, ec);
+        return static_cast<std::int64_t>(size);
+    };
+    const auto checkpoint = [state, db](int mode, int& log, int& done) {
+        const auto start = std::chrono::steady_clock::now();
+        const int rc = sqlite3_wal_checkpoint_v2(db, "main", mode, &log, &done);
+        const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+
+        std::lock_guard<std::mutex> lock(state->mutex);
+        auto& stats = state->stats;
+        ++stats.checkpoints;
+        ++(mode == SQLITE_CHECKPOINT_PASSIVE ? stats.passive : mode == SQLITE_CHECKPOINT_RESTART ? stats.restart : stats.truncate);
+        stats.last_duration = elapsed;
+        stats.max_duration = std::max(stats.max_duration, elapsed);
+        stats.total_duration += elapsed;
+        if (rc == SQLITE_BUSY) {
+            ++stats.busy;
+        } else if (rc != SQLITE_OK) {
+            stats.error = sqlite3_errmsg(db);
+        } else if (log < 0) {
+            stats.error = "database is not in WAL mode";
+        } else {
+            stats.wal_frames = log;
+            stats.checkpointed_frames = done;
+            stats.error.clear();
+        }
+        return rc;
+    };
+
+    std::filesystem::file_time_type last_mtime{};
+    std::int64_t last_size = wal_size(last_mtime);
+    int last_frames{};
+    std::unique_lock<std::mutex> lock(state->mutex);
+    while (!state->stop) {
+        state->cv.wait_for(lock, options.interval, [state]() { return state->stop || state->signaled.load(); });
+        if (state->stop) {
+            break;
+        }
+        lock.unlock();
+
+        // the timer only checkpoints when the WAL changed, which also catches writes from other connections
+        std::filesystem::file_time_type mtime{};
+        const std::int64_t size = wal_size(mtime);
+        const int frames = state->frames.load(std::memory_order_relaxed);
+        if (state->signaled.load() || frames != last_frames || size != last_size || mtime != last_mtime) {
+            int log{};
+            int done{};
+            int rc = checkpoint(SQLITE_CHECKPOINT_PASSIVE, log, done);
+            if (rc == SQLITE_OK && done < log && log >= options.restart_frames) {
+                rc = checkpoint(SQLITE_CHECKPOINT_RESTART, log, done);
+            }
+            if (rc == SQLITE_OK && options.truncate_bytes > 0 && size >= options.truncate_bytes) {
+                rc = checkpoint(SQLITE_CHECKPOINT_TRUNCATE, log, done);
+            }
+
+            state->base.store(rc == SQLITE_OK ? log : frames, std::memory_order_relaxed);
+            state->signaled = false;
+            last_frames = frames;
+            last_size = wal_size(last_mtime);
+        }
+
+        lock.lock();
+        state->stats.wal_bytes = last_size;
+    }
+    lock.unlock();
+
+    sqlite3_close(db);
+}
+
+inline bool sdatabase::SQLite3Database::start_checkpointer(const CheckpointOptions& options) {
+    if (!this->is_good || this->checkpointer || this->database.empty() || this->database == ":memory:") {
+        return false;
+    }
+
+    auto mode = this->query("PRAGMA journal_mode;");
+    if (mode.empty() || mode.front()["journal_mode"] != "wal") {
+        return false;
+    }
+
+    sqlite3* db{};
+    if (sqlite3_open(this->database.c_str(), &db) != SQLITE_OK) {
+        sqlite3_close(db);
+        return false;
+    }
+    // the connection only notices WAL mode once it has read the database
+    if (sqlite3_exec(db, "SELECT count(*) FROM sqlite_schema;", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        sqlite3_close(db);
+        return false;
+    }
+    sqlite3_busy_timeout(db, static_cast<int>(options.busy_timeout.count()));
+
+    auto state = std::make_unique<detail::SQLite3CheckpointState>();
+    state->options = options;
+    state->wal_path = std::string(sqlite3_db_filename(this->sqlite3_db, "main")) + "-wal";
+    state->thread = std::thread(checkpoint_loop, state.get(), db);
+    this->checkpointer = std::move(state);
+    this->install_hooks();
+    return true;
+}
+
+inline void sdatabase::SQLite3Database::stop_checkpointer() {
+    if (!this->checkpointer) {
+        return;
+    }
+
+    auto& state = *this->checkpointer;
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.stop = true;
+    }
+    state.cv.notify_all();
+    state.thread.join();
+    this->checkpointer.reset();
+    this->install_hooks();
+}
+
+inline sdatabase::CheckpointStats sdatabase::SQLite3Database::get_checkpoint_stats() {
+    if (!this->checkpointer) {
+        return {};
+    }
+
+    std::lock_guard<std::mutex> lock(this->checkpointer->mutex);
+    return this->checkpointer->stats;
+}
+
+inline int sdatabase::SQLite3Database::busy_callback(void* ctx, int count) {
+    auto* state = static_cast<detail::SQLite3BusyState*>(ctx);
+    const auto now = std::chrono::steady_clock::now();
+    if (count == 0) {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->event_start = now;
+        ++state->stats.busy_events;
+    }
+
+    const auto waited = now - state->event_start;
+    const auto delay = std::min<std::chrono::nanoseconds>(state->delay(count), state->options.max_wait - waited);
+    if (delay <= std::chrono::nanoseconds::zero()) {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        ++state->stats.timeouts;
+        return 0;
+    }
+
+    std::this_thread::sleep_for(delay);
+    const auto slept = std::chrono::steady_clock::now() - now;
+
+    std::lock_guard<std::mutex> lock(state->mutex);
+    ++state->stats.retries;
+    state->stats.wait_time += slept;
+    state->stats.max_wait_time = std::max<std::chrono::nanoseconds>(state->stats.max_wait_time, waited + slept);
+    return 1;
+}
+
+inline bool sdatabase::SQLite3Database::enable_busy_handler(bool enable, const BusyOptions& options) {
+    if (!this->is_good) {
+        return false;
+    }
+
+    if (!enable) {
+        return sqlite3_busy_handler(this->sqlite3_db, nullptr, nullptr) == SQLITE_OK;
+    }
+
+    if (!this->busy) {
+        this->busy = std::make_unique<detail::SQLite3BusyState>();
+    }
+    {
+        std::lock_guard<std::mutex> lock(this->busy->mutex);
+        this->busy->options = options;
+    }
+    return sqlite3_busy_handler(this->sqlite3_db, busy_callback, this->busy.get()) == SQLITE_OK;
+}
+
+inline sdatabase::BusyStats sdatabase::SQLite3Database::get_busy_stats() {
+    if (!this->busy) {
+        return {};
+    }
+
+    std::lock_guard<std::mutex> lock(this->busy->mutex);
+    return this->busy->stats;
+}
+
+inline bool sdatabase::SQLite3Database::run_transaction(const std::function<bool(SQLite3Database&)>& fn) {
+    if (!this->is_good) {
+        return false;
+    }
+
+    if (!sqlite3_get_autocommit(this->sqlite3_db)) {
+        return fn(*this);
+    }
+
+    if (!this->busy) {
+        this->busy = std::make_unique<detail::SQLite3BusyState>();
+    }
+    const int attempts = std::max(this->busy->options.max_attempts, 1);
+    const auto retry = [this, attempts](const char* statement) {
+        for (int attempt{0};; ++attempt) {
+            if (this->exec(statement)) {
+                return true;
+            }
+            const int code = sqlite3_errcode(this->sqlite3_db);
+            if ((code != SQLITE_BUSY && code != SQLITE_LOCKED) || attempt + 1 >= attempts) {
+                return false;
+            }
+            {
+                std::lock_guard<std::mutex> lock(this->busy->mutex);
+                ++this->busy->stats.transaction_retries;
+            }
+            std::this_thread::sleep_for(this->busy->delay(attempt));
+        }
+    };
+
+    if (!retry("BEGIN IMMEDIATE;")) {
+        return false;
+    }
+
+    bool ok{};
+    try {
+        ok = fn(*this);
+    } catch (...) {
+        this->exec("ROLLBACK;");
+        throw;
+    }
+
+    // a COMMIT that fails with SQLITE_BUSY leaves the transaction open, so it can be retried
+    if (ok && retry("COMMIT;")) {
+        return true;
+    }
+
+    this->exec("ROLLBACK;");
+    return false;
+}
+
+inline sdatabase::SQLite3Blob sdatabase::SQLite3Database::open_blob(const std::string& table, const std::string& column,
+        std::int64_t rowid, bool writable, const std::string& schema) {
+    if (!this->is_good) {
+        return {};
+    }
+
+    sqlite3_blob* blob{};
+    if (sqlite3_blob_open(this->sqlite3_db, schema.c_str(), table.c_str(), column.c_str(), rowid, writable ? 1 : 0, &blob) != SQLITE_OK) {
+        sqlite3_blob_close(blob);
+        return {};
+    }
+
+    return SQLite3Blob{blob};
+}
+
+inline bool sdatabase::SQLite3Database::backup(sqlite3* source, sqlite3* destination, int pages_per_step,
+        std::chrono::milliseconds sleep_between, const std::function<bool(int, int)>& progress, std::chrono::milliseconds timeout) {
+    sqlite3_backup* backup = sqlite3_backup_init(destination, "main", source, "main");
+    if (!backup) {
+        return false;
+    }
+
+    std::optional<std::chrono::steady_clock::time_point> deadline{};
+    int ret;
+    do {
+        ret = sqlite3_backup_step(backup, pages_per_step);
+        if (progress && !progress(sqlite3_backup_remaining(backup), sqlite3_backup_pagecount(backup))) {
+            sqlite3_backup_finish(backup);
+            return false;
+        }
+        if (ret == SQLITE_BUSY || ret == SQLITE_LOCKED) {
+            const auto now = std::chrono::steady_clock::now();
+            if (!deadline) {
+                deadline = now + timeout;
+            }
+            if (now >= *deadline) {
+                break;
+            }
+            // a locked step must not spin, even when no pause between steps was asked for
+            std::this_thread::sleep_for(std::max(sleep_between, std::chrono::milliseconds{1}));
+        } else if (ret == SQLITE_OK) {
+            deadline.reset();
+            if (sleep_between.count() > 0) {
+                std::this_thread::sleep_for(sleep_between);
+            }
+        }
+    } while (ret == SQLITE_OK || ret == SQLITE_BUSY || ret == SQLITE_LOCKED);
+
+    return sqlite3_backup_finish(backup) == SQLITE_OK && ret == SQLITE_DONE;
+}
+
+inline bool sdatabase::SQLite3Database::backup_to(const std::string& path, int pages_per_step,
+        std::chrono::milliseconds sleep_between, const std::function<bool(int, int)>& progress) {
+    if (!this->is_good) {
+        return false;
+    }
+
+    sqlite3* destination{};
+    if (sqlite3_open(path.c_str(), &destination) != SQLITE_OK) {
+        sqlite3_close(destination);
+        return false;
+    }
+
+    const bool ret = backup(this->sqlite3_db, destination, pages_per_step, sleep_between, progress, this->backup_timeout);
+    sqlite3_close(destination);
+    return ret;
+}
+
+inline bool sdatabase::SQLite3Database::backup_to(SQLite3Database& destination, int pages_per_step,
+        std::chrono::milliseconds sleep_between, const std::function<bool(int, int)>& progress) {
+    if (!this->is_good || !destination.is_good) {
+        return false;
+    }
+
+    const bool ret = backup(this->sqlite3_db, destination.sqlite3_db, pages_per_step, sleep_between, progress, this->backup_timeout);
+    if (destination.cache) {
+        destination.cache->cache.clear();
+    }
+    return ret;
+}
+
+inline void sdatabase::SQLite3Database::set_backup_timeout(std::chrono::milliseconds timeout) {
+    this->backup_timeout = std::max(timeout, std::chrono::milliseconds::zero());
+}
+
+inline bool sdatabase::SQLite3Database::restore_from(const std::string& path, int pages_per_step,
+        std::chrono::milliseconds sleep_between, const std::function<bool(int, int)>& progress) {
+    if (!this->is_good) {
+        return false;
+    }
+
+    sqlite3* source{};
+    if (sqlite3_open_v2(path.c_str(), &source, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK) {
+        sqlite3_close(source);
+        return false;
+    }
+
+    const bool ret = backup(source, this->sqlite3_db, pages_per_step, sleep_between, progress, this->backup_timeout);
+    sqlite3_close(source);
+    if (this->cache) {
+        this->cache->cache.clear();
+    }
+    return ret;
+}
+
+inline std::vector<unsigned char> sdatabase::SQLite3Database::serialize(const std::string& schema) {
+    if (!this->is_good) {
+        return {};
+    }
+
+    sqlite3_int64 size{};
+    if (const auto* data = sqlite3_serialize(this->sqlite3_db, schema.c_str(), &size, SQLITE_SERIALIZE_NOCOPY)) {
+        return {data, data + size};
+    }
+
+    auto* data = sqlite3_serialize(this->sqlite3_db, schema.c_str(), &size, 0);
+    if (!data) {
+        return {};
+    }
+
+    std::vector<unsigned char> ret(data, data + size);
+    sqlite3_free(data);
+    return ret;
+}
+
+inline bool sdatabase::SQLite3Database::save_image(const std::string& path, const std::string& schema) {
+    if (!this->is_good) {
+        return false;
+    }
+
+    // in-memory databases can be written straight from SQLite's buffer
+    sqlite3_int64 size{};
+    unsigned char* owned{};
+    const unsigned char* data = sqlite3_serialize(this->sqlite3_db, schema.c_str(), &size, SQLITE_SERIALIZE_NOCOPY);
+    if (!data) {
+        owned = sqlite3_serialize(this->sqlite3_db, schema.c_str(), &size, 0);
+        data = owned;
+    }
+    if (!data) {
+        return false;
+    }
+
+    const std::string tmp_path = path + ".tmp";
+    std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(size));
+    file.close();
+    sqlite3_free(owned);
+
+    if (!file) {
+        std::remove(tmp_path.c_str());
+        return false;
+    }
+
+    return std::rename(tmp_path.c_str(), path.c_str()) == 0;
+}
+
+inline bool sdatabase::SQLite3Database::deserialize(const unsigned char* data, std::size_t size, bool read_only) {
+    if (!this->is_good) {
+        this->open(":memory:");
+        this->database = ":memory:";
+        if (!this->is_good) {
+            return false;
+        }
+    }
+
+    auto* buffer = static_cast<unsigned char*>(sqlite3_malloc64(size));
+    if (!buffer && size) {
+        return false;
+    }
+    // an empty image is an empty database, and memcpy must not see the null buffer of a zero-size allocation
+    if (size > 0) {
+        std::memcpy(buffer, data, size);
+    }
+
+    // the memory VFS cannot open WAL mode images, so mark them as rollback journal
+    if (size >= 20 && buffer[18] == 2 && buffer[19] == 2) {
+        buffer[18] = 1;
+        buffer[19] = 1;
+    }
+
+    const unsigned flags = SQLITE_DESERIALIZE_FREEONCLOSE | (read_only ? SQLITE_DESERIALIZE_READONLY : SQLITE_DESERIALIZE_RESIZEABLE);
+    if (sqlite3_deserialize(this->sqlite3_db, "main", buffer, static_cast<sqlite3_int64>(size), static_cast<sqlite3_int64>(size), flags) != SQLITE_OK) {
+        return false;
+    }
+
+#ifdef SDB_POSIX
+    this->image.reset();
+#endif
+    if (this->cache) {
+        this->cache->cache.clear();
+    }
+    return true;
+}
+
+inline bool sdatabase::SQLite3Database::load_image(const std::string& path, bool read_only) {
+#ifndef SDB_POSIX
+    const detail::MappedFile file{path};
+    if (!file.ok || file.size == 0) {
+        return false;
+    }
+    return this->deserialize(reinterpret_cast<const unsigned char*>(file.data), file.size, read_only);
+#else
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st{};
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        ::close(fd);
+        return false;
+    }
+
+    if (!read_only) {
+        std::vector<unsigned char> data(static_cast<std::size_t>(st.st_size));
+        std::size_t offset{0};
+        while (offset < data.size()) {
+            const auto n = ::read(fd, data.data() + offset, data.size() - offset);
+            if (n <= 0) {
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                ::close(fd);
+                return false;
+            }
+            offset += static_cast<std::size_t>(n);
+        }
+        ::close(fd);
+        return this->deserialize(data.data(), data.size(), false);
+    }
+
+    // private writable mapping so the WAL header bytes can be patched without touching the file
+    auto mapped = std::make_unique<detail::SQLite3MappedImage>();
+    mapped->size = static_cast<std::size_t>(st.st_size);
+    mapped->data = mmap(nullptr, mapped->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapped->data == MAP_FAILED) {
+        return false;
+    }
+
+    auto* data = static_cast<unsigned char*>(mapped->data);
+    if (mapped->size >= 20 && data[18] == 2 && data[19] == 2) {
+        data[18] = 1;
+        data[19] = 1;
+    }
+
+    if (!this->is_good) {
+        this->open(":memory:");
+        this->database = ":memory:";
+        if (!this->is_good) {
+            return false;
+        }
+    }
+
+    const auto size = static_cast<sqlite3_int64>(mapped->size);
+    if (sqlite3_deserialize(this->sqlite3_db, "main", data, size, size, SQLITE_DESERIALIZE_READONLY) != SQLITE_OK) {
+        return false;
+    }
+
+    this->image = std::move(mapped);
+    if (this->cache) {
+        this->cache->cache.clear();
+    }
+    return true;
+#endif
+}
+
+inline bool sdatabase::SQLite3LiveImage::load(const std::string& path, bool read_only) {
+    auto database = std::make_shared<SQLite3Database>();
+    if (!database->load_image(path, read_only)) {
+        return false;
+    }
+
+    this->swap(std::move(database));
+    return true;
+}
+
+inline void sdatabase::SQLite3LiveImage::swap(std::shared_ptr<SQLite3Database> database) {
+    std::shared_ptr<SQLite3Database> old{};
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        old = std::exchange(this->current, std::move(database));
+    }
+    // old is released outside the lock so closing it does not block readers
+}
+
+inline std::shared_ptr<sdatabase::SQLite3Database> sdatabase::SQLite3LiveImage::acquire() const {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->current;
+}
+
+inline sdatabase::ShardedSQLite::ShardedSQLite(const std::vector<std::string>& paths, std::size_t threads, int virtual_nodes) {
+    for (const auto& path : paths) {
+        this->shards.push_back(std::make_unique<Shard>(path));
+    }
+
+    for (std::size_t i{0}; i < paths.size(); ++i) {
+        for (int node{0}; node < virtual_nodes; ++node) {
+            this->ring.emplace_back(hash(paths[i] + "#" + std::to_string(node)), i);
+        }
+    }
+    std::sort(this->ring.begin(), this->ring.end());
+
+    this->pool = std::make_unique<detail::ThreadPool>(threads ? threads : std::min<std::size_t>(paths.size(), std::max(1u, std::thread::hardware_concurrency())));
+}
+
+inline std::uint64_t sdatabase::ShardedSQLite::hash(const std::string& key) {
+    // 64-bit FNV-1a, finalized with a murmur mix so that similar keys land far apart on the ring
+    std::uint64_t h{14695981039346656037ULL};
+    for (unsigned char c : key) {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+inline bool sdatabase::ShardedSQLite::good() {
+    if (this->shards.empty()) {
+        return false;
+    }
+
+    return std::all_of(this->shards.begin(), this->shards.end(), [](const std::unique_ptr<Shard>& shard) {
+        return shard->db.good();
+    });
+}
+
+inline std::size_t sdatabase::ShardedSQLite::size() const {
+    return this->shards.size();
+}
+
+inline std::size_t sdatabase::ShardedSQLite::shard_for(const std::string& key) const {
+    if (this->ring.empty()) {
+        return 0;
+    }
+
+    const std::uint64_t h = hash(key);
+    auto it = std::lower_bound(this->ring.begin(), this->ring.end(), std::make_pair(h, std::size_t{0}));
+    return it == this->ring.end() ? this->ring.front().second : it->second;
+}
+
+inline std::vector<sdatabase::ShardedSQLite::Row> sdatabase::ShardedSQLite::merge(const Order& order, std::vector<std::vector<Row>> results) {
+    const auto less = [&order](const Row& a, const Row& b) {
+        auto ai = a.find(order.column);
+        auto bi = b.find(order.column);
+        const std::string& av = ai == a.end() ? std::string{} : ai->second;
+        const std::string& bv = bi == b.end() ? std::string{} : bi->second;
+        if (order.numeric) {
+            const double ad = std::strtod(av.c_str(), nullptr);
+            const double bd = std::strtod(bv.c_str(), nullptr);
+            return order.descending ? bd < ad : ad < bd;
+        }
+        return order.descending ? bv < av : av < bv;
+    };
+
+    // heap of (shard, position), smallest row on top
+    using Cursor = std::pair<std::size_t, std::size_t>;
+    const auto greater = [&](const Cursor& a, const Cursor& b) {
+        return less(results[b.first][b.second], results[a.first][a.second]);
+    };
+    std::priority_queue<Cursor, std::vector<Cursor>, decltype(greater)> heap(greater);
+
+    std::size_t total{0};
+    for (std::size_t i{0}; i < results.size(); ++i) {
+        total += results[i].size();
+        if (!results[i].empty()) {
+            heap.emplace(i, 0);
+        }
+    }
+
+    if (order.limit > 0) {
+        total = std::min(total, order.limit);
+    }
+
+    std::vector<Row> ret{};
+    ret.reserve(total);
+    while (!heap.empty() && ret.size() < total) {
+        auto [shard, pos] = heap.top();
+        heap.pop();
+        ret.push_back(std::move(results[shard][pos]));
+        if (pos + 1 < results[shard].size()) {
+            heap.emplace(shard, pos + 1);
+        }
+    }
+    return ret;
+}
+
+inline std::int64_t sdatabase::SQLite3Database::copy_out(const std::string& query, const ExportSink& sink, ExportFormat format, bool header) {
+    if (!this->is_good || !sink || format == ExportFormat::Binary) {
+        return -1;
+    }
+
+    detail::QueryProbe probe{query, this->slow_log != nullptr};
+
+    sqlite3_stmt* stmt = this->prepare(query);
+    if (!stmt) {
+        return -1;
+    }
+
+    probe.prepared();
+
+    constexpr std::size_t chunk_size{64 * 1024};
+    const int columns = sqlite3_column_count(stmt);
+    const char separator = format == ExportFormat::Text ? '\t' : ',';
+
+    std::string out{};
+    out.reserve(chunk_size * 2);
+
+    if (header && format == ExportFormat::CSV) {
+        for (int i{0}; i < columns; ++i) {
+            if (i) {
+                out += ',';
+            }
+            const char* name = sqlite3_column_name(stmt, i);
+            detail::append_csv_field(out, name, std::strlen(name));
+        }
+        out += '\n';
+    }
+
+    // JSON keys do not change between rows, so they are escaped once
+    std::vector<std::string> keys{};
+    if (format == ExportFormat::NDJSON) {
+        for (int i{0}; i < columns; ++i) {
+            const char* name = sqlite3_column_name(stmt, i);
+            std::string key{};
+            detail::append_json_string(key, name, std::strlen(name));
+            keys.push_back(std::move(key) + ':');
+        }
+    }
+
+    std::int64_t rows{0};
+    std::uint64_t bytes{0};
+    bool ok{true};
+    int status = sqlite3_step(stmt);
+    probe.executed();
+    for (; status == SQLITE_ROW; status = sqlite3_step(stmt)) {
+        if (format == ExportFormat::NDJSON) {
+            out += '{';
+        }
+
+        for (int i{0}; i < columns; ++i) {
+            const int type = sqlite3_column_type(stmt, i);
+            if (format == ExportFormat::NDJSON) {
+                out += i ? "," : "";
+                out += keys[i];
+            } else if (i) {
+                out += separator;
+            }
+
+            if (type == SQLITE_NULL) {
+                out += format == ExportFormat::NDJSON ? "null" : format == ExportFormat::Text ? "\\N" : "";
+            } else if (type == SQLITE_BLOB) {
+                const auto* data = static_cast<const unsigned char*>(sqlite3_column_blob(stmt, i));
+                const auto size = static_cast<std::size_t>(sqlite3_column_bytes(stmt, i));
+                const bool quoted = format == ExportFormat::NDJSON;
+                out += quoted ? "\"" : "";
+                // the backslash of \x has to be escaped in text format and in JSON
+                out += format == ExportFormat::CSV ? "" : "\\";
+                detail::append_hex(out, data, size);
+                out += quoted ? "\"" : "";
+                bytes += size;
+            } else {
+                const auto* data = reinterpret_cast<const char*>(sqlite3_column_text(stmt, i));
+                const auto size = static_cast<std::size_t>(sqlite3_column_bytes(stmt, i));
+                bytes += size;
+                if (format == ExportFormat::CSV) {
+                    detail::append_csv_field(out, data, size);
+                } else if (format == ExportFormat::Text) {
+                    detail::append_text_field(out, data, size);
+                } else if (type == SQLITE_TEXT) {
+                    detail::append_json_string(out, data, size);
+                } else if (type == SQLITE_FLOAT && !std::isfinite(sqlite3_column_double(stmt, i))) {
+                    out += "null";
+                } else {
+                    out.append(data, size);
+                }
+            }
+        }
+
+        out += format == ExportFormat::NDJSON ? "}\n" : "\n";
+        ++rows;
+
+        if (out.size() >= chunk_size) {
+            if (!sink(out.data(), out.size())) {
+                ok = false;
+                break;
+            }
+            out.clear();
+        }
+    }
+
+    ok = ok && status == SQLITE_DONE && (out.empty() || sink(out.data(), out.size()));
+    probe.fetched(static_cast<std::uint64_t>(rows), bytes);
+    sqlite3_finalize(stmt);
+
+    if (!ok) {
+        return -1;
+    }
+
+    this->log_slow_query<>(probe, query, query);
+    probe.succeeded();
+    return rows;
+}
+
+#ifdef SDB_POSIX
+inline std::int64_t sdatabase::SQLite3Database::copy_out(const std::string& query, int fd, ExportFormat format, bool header) {
+    return this->copy_out(query, detail::fd_sink(fd), format, header);
+}
+#endif
+
+inline sdatabase::ImportStats sdatabase::SQLite3Database::import_file(const std::string& table, const std::string& path, const ImportOptions& options) {
+    if (!this->is_good) {
+        ImportStats stats{};
+        stats.error = "database is not open";
+        return stats;
+    }
+
+    struct Writer {
+        SQLite3Database& db;
+        const std::string& table;
+        const ImportOptions& options;
+        sqlite3_stmt* stmt{};
+        std::vector<ColumnType> types{};
+        std::size_t in_batch{};
+        std::uint64_t uncommitted{};
+        bool own_transaction{false};
+        bool open{false};
+
+        bool fail(ImportStats& stats) {
+            stats.error = sqlite3_errmsg(db.sqlite3_db);
+            return false;
+        }
+
+        bool begin(const std::vector<std::string>& columns, const std::vector<ColumnType>& column_types, ImportStats& stats) {
+            types = column_types;
+
+            std::string list{};
+            std::string params{};
+            for (std::size_t i{0}; i < types.size(); ++i) {
+                if (!columns.empty()) {
+                    list += (i ? ", " : "") + detail::quote_name(columns[i]);
+                }
+                params += i ? ", ?" : "?";
+            }
+
+            if (options.create_table) {
+                if (columns.empty()) {
+                    stats.error = "create_table needs column names";
+                    return false;
+                }
+
+                std::string create = "CREATE TABLE IF NOT EXISTS " + detail::quote_name(table) + " (";
+                for (std::size_t i{0}; i < columns.size(); ++i) {
+                    create += (i ? ", " : "") + detail::quote_name(columns[i]);
+                    create += types[i] == ColumnType::Real ? " REAL" : types[i] == ColumnType::Text ? " TEXT"
+                            : types[i] == ColumnType::Blob ? " BLOB" : " INTEGER";
+                }
+                if (!db.exec(create + ");")) {
+                    return fail(stats);
+                }
+            }
+
+            const std::string insert = "INSERT INTO " + detail::quote_name(table) + (list.empty() ? "" : " (" + list + ")") + " VALUES (" + params + ");";
+            if (!(stmt = db.prepare(insert))) {
+                return fail(stats);
+            }
+
+            // inside a caller's transaction the rows become part of it
+            own_transaction = sqlite3_get_autocommit(db.sqlite3_db) != 0;
+            return !own_transaction || (open = db.exec("BEGIN;")) || fail(stats);
+        }
+
+        bool write(const detail::ImportChunk& chunk, ImportStats& stats) {
+            const std::size_t width = types.size();
+            for (std::size_t row{0}; row < chunk.rows; ++row) {
+                const detail::ImportField* fields = &chunk.fields[row * width];
+                for (std::size_t i{0}; i < width; ++i) {
+                    const auto& field = fields[i];
+                    const int index = static_cast<int>(i + 1);
+                    std::int64_t integer{};
+                    double real{};
+                    bool boolean{};
+
+                    // values that do not convert are stored as text, as SQLite would with type affinity
+                    if (field.null) {
+                        sqlite3_bind_null(stmt, index);
+                    } else if (types[i] == ColumnType::Integer && detail::import_integer(field, integer)) {
+                        sqlite3_bind_int64(stmt, index, integer);
+                    } else if (types[i] == ColumnType::Real && detail::import_real(field, real)) {
+                        sqlite3_bind_double(stmt, index, real);
+                    } else if (types[i] == ColumnType::Boolean && detail::import_boolean(field, boolean)) {
+                        sqlite3_bind_int(stmt, index, boolean ? 1 : 0);
+                    } else if (types[i] == ColumnType::Blob) {
+                        sqlite3_bind_blob64(stmt, index, field.data ? field.data : "", field.size, SQLITE_STATIC);
+                    } else {
+                        sqlite3_bind_text64(stmt, index, field.data ? field.data : "", field.size, SQLITE_STATIC, SQLITE_UTF8);
+                    }
+                }
+
+                const int ret = sqlite3_step(stmt);
+                sqlite3_reset(stmt);
+                if (ret != SQLITE_DONE) {
+                    return fail(stats);
+                }
+                ++uncommitted;
+
+                if (own_transaction && ++in_batch >= options.batch_size) {
+                    in_batch = 0;
+                    if (!db.exec("COMMIT;")) {
+                        return fail(stats);
+                    }
+                    open = false;
+                    stats.rows += uncommitted;
+                    uncommitted = 0;
+                    if (!(open = db.exec("BEGIN;"))) {
+                        return fail(stats);
+                    }
+                }
+            }
+            return true;
+        }
+
+        bool finish(ImportStats& stats) {
+            if (open) {
+                open = false;
+                if (!db.exec("COMMIT;")) {
+                    // a failed COMMIT leaves the transaction open, the destructor rolls it back
+                    open = !sqlite3_get_autocommit(db.sqlite3_db);
+                    return fail(stats);
+                }
+            }
+            stats.rows += uncommitted;
+            uncommitted = 0;
+            return true;
+        }
+
+        ~Writer() {
+            sqlite3_finalize(stmt);
+            if (open) {
+                db.exec("ROLLBACK;");
+            }
+        }
+    } writer{*this, table, options};
+
+    return detail::run_import(path, options, writer);
+}
+
+inline sdatabase::SQLite3Scan sdatabase::SQLite3Database::scan(const std::string& table, const std::vector<std::string>& keys,
+        std::int64_t page_size, const std::string& columns) {
+    if (!this->is_good || keys.empty() || page_size <= 0) {
+        return {};
+    }
+
+    std::string order{};
+    std::string params{};
+    for (std::size_t i{0}; i < keys.size(); ++i) {
+        order += (i ? ", " : "") + keys[i];
+        params += (i ? ", ?" : "?") + std::to_string(i + 1);
+    }
+
+    const std::string select = "SELECT " + columns + " FROM " + table;
+    const std::string first_query = select + " ORDER BY " + order + " LIMIT ?1;";
+    const std::string next_query = select + " WHERE (" + order + ") > (" + params + ") ORDER BY " + order
+        + " LIMIT ?" + std::to_string(keys.size() + 1) + ";";
+
+    sqlite3_stmt* first{};
+    sqlite3_stmt* next{};
+    if (sqlite3_prepare_v3(this->sqlite3_db, first_query.c_str(), -1, SQLITE_PREPARE_PERSISTENT, &first, nullptr) != SQLITE_OK
+        || sqlite3_prepare_v3(this->sqlite3_db, next_query.c_str(), -1, SQLITE_PREPARE_PERSISTENT, &next, nullptr) != SQLITE_OK) {
+        sqlite3_finalize(first);
+        sqlite3_finalize(next);
+        return {};
+    }
+
+    // the last key is read back from the result, so every key column has to be selected
+    const auto lower = [](std::string str) {
+        std::transform(str.begin(), str.end(), str.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        return str;
+    };
+    std::vector<int> key_index{};
+    for (const auto& key : keys) {
+        const std::string name = lower(key.substr(key.rfind('.') == std::string::npos ? 0 : key.rfind('.') + 1));
+        int index{-1};
+        for (int i{0}; i < sqlite3_column_count(first); ++i) {
+            if (lower(sqlite3_column_name(first, i)) == name) {
+                index = i;
+                break;
+            }
+        }
+        if (index < 0) {
+            sqlite3_finalize(first);
+            sqlite3_finalize(next);
+            return {};
+        }
+        key_index.push_back(index);
+    }
+
+    return SQLite3Scan{first, next, std::move(key_index), page_size};
+}
+
+inline sdatabase::SQLite3Scan::SQLite3Scan(sqlite3_stmt* first, sqlite3_stmt* next, std::vector<int> key_index, std::int64_t page_size)
+    : first(first), next(next), key_index(std::move(key_index)), last(this->key_index.size(), nullptr), page_size(page_size) {}
+
+inline sdatabase::SQLite3Scan::SQLite3Scan(SQLite3Scan&& other) noexcept {
+    *this = std::move(other);
+}
+
+inline sdatabase::SQLite3Scan& sdatabase::SQLite3Scan::operator=(SQLite3Scan&& other) noexcept {
+    if (this != &other) {
+        this->release();
+        this->first = std::exchange(other.first, nullptr);
+        this->next = std::exchange(other.next, nullptr);
+        this->current = std::exchange(other.current, nullptr);
+        this->key_index = std::move(other.key_index);
+        this->last = std::move(other.last);
+        other.last.clear();
+        this->page_size = other.page_size;
+        this->page_rows = other.page_rows;
+        this->row = std::move(other.row);
+        this->started = other.started;
+        this->done = other.done;
+        this->failed = other.failed;
+    }
+    return *this;
+}
+
+inline bool sdatabase::SQLite3Scan::good() const {
+    return this->first != nullptr && !this->failed;
+}
+
+inline bool sdatabase::SQLite3Scan::advance() {
+    if (this->done) {
+        return false;
+    }
+
+    if (this->page_rows == this->page_size) {
+        // still positioned on the last row of the full page, so its key can be copied out
+        for (std::size_t i{0}; i < this->key_index.size(); ++i) {
+            sqlite3_value_free(this->last[i]);
+            this->last[i] = sqlite3_value_dup(sqlite3_column_value(this->current, this->key_index[i]));
+        }
+        sqlite3_reset(this->current);
+
+        this->current = this->next;
+        for (std::size_t i{0}; i < this->last.size(); ++i) {
+            sqlite3_bind_value(this->current, static_cast<int>(i + 1), this->last[i]);
+        }
+        sqlite3_bind_int64(this->current, static_cast<int>(this->last.size() + 1), this->page_size);
+        this->page_rows = 0;
+    }
+
+    const int status = sqlite3_step(this->current);
+    if (status != SQLITE_ROW) {
+        this->done = true;
+        this->failed = status != SQLITE_DONE;
+        sqlite3_reset(this->current);
+        return false;
+    }
+
+    ++this->page_rows;
+    this->row.clear();
+    for (int i{0}; i < sqlite3_column_count(this->current); ++i) {
+        const unsigned char* value = sqlite3_column_text(this->current, i);
+        this->row[sqlite3_column_name(this->current, i)] = value ? reinterpret_cast<const char*>(value) : "";
+    }
+
+    return true;
+}
+
+inline sdatabase::SQLite3Scan::iterator sdatabase::SQLite3Scan::begin() {
+    if (!this->first) {
+        return {};
+    }
+    if (this->started) {
+        return this->done ? iterator{} : iterator{this};
+    }
+
+    this->started = true;
+    this->current = this->first;
+    sqlite3_bind_int64(this->current, 1, this->page_size);
+    return this->advance() ? iterator{this} : iterator{};
+}
+
+inline sdatabase::SQLite3Scan::iterator sdatabase::SQLite3Scan::end() {
+    return iterator{};
+}
+
+inline void sdatabase::SQLite3Scan::release() {
+    sqlite3_finalize(this->first);
+    sqlite3_finalize(this->next);
+    for (auto* value : this->last) {
+        sqlite3_value_free(value);
+    }
+    this->first = this->next = this->current = nullptr;
+    this->last.clear();
+}
+
+inline sdatabase::SQLite3Scan::~SQLite3Scan() {
+    this->release();
+}
+
+inline sdatabase::SQLite3Blob::SQLite3Blob(SQLite3Blob&& other) noexcept : blob(other.blob) {
+    other.blob = nullptr;
+}
+
+inline sdatabase::SQLite3Blob& sdatabase::SQLite3Blob::operator=(SQLite3Blob&& other) noexcept {
+    if (this != &other) {
+        this->close();
+        this->blob = other.blob;
+        other.blob = nullptr;
+    }
+    return *this;
+}
+
+inline bool sdatabase::SQLite3Blob::good() const {
+    return this->blob != nullptr;
+}
+
+inline int sdatabase::SQLite3Blob::size() const {
+    return this->blob ? sqlite3_blob_bytes(this->blob) : 0;
+}
+
+inline bool sdatabase::SQLite3Blob::read(void* buffer, int n, int offset) {
+    return this->blob && sqlite3_blob_read(this->blob, buffer, n, offset) == SQLITE_OK;
+}
+
+inline bool sdatabase::SQLite3Blob::write(const void* buffer, int n, int offset) {
+    return this->blob && sqlite3_blob_write(this->blob, buffer, n, offset) == SQLITE_OK;
+}
+
+inline bool sdatabase::SQLite3Blob::reopen(std::int64_t rowid) {
+    if (!this->blob) {
+        return false;
+    }
+    if (sqlite3_blob_reopen(this->blob, rowid) != SQLITE_OK) {
+        this->close();
+        return false;
+    }
+    return true;
+}
+
+inline bool sdatabase::SQLite3Blob::read_to(std::ostream& os, int chunk_size) {
+    if (!this->blob || chunk_size <= 0) {
+        return false;
+    }
+
+    std::vector<char> buffer(static_cast<std::size_t>(chunk_size));
+    const int total = this->size();
+    for (int offset{0}; offset < total; offset += chunk_size) {
+        const int n = total - offset < chunk_size ? total - offset : chunk_size;
+        if (!this->read(buffer.data(), n, offset)) {
+            return false;
+        }
+        os.write(buffer.data(), n);
+        if (!os) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+inline int sdatabase::SQLite3Blob::write_from(std::istream& is, int offset, int chunk_size) {
+    if (!this->blob || chunk_size <= 0) {
+        return -1;
+    }
+
+    std::vector<char> buffer(static_cast<std::size_t>(chunk_size));
+    const int total = this->size();
+    int written{0};
+    while (offset < total && is) {
+        const int want = total - offset < chunk_size ? total - offset : chunk_size;
+        is.read(buffer.data(), want);
+        const auto n = static_cast<int>(is.gcount());
+        if (n <= 0) {
+            break;
+        }
+        if (!this->write(buffer.data(), n, offset)) {
+            return -1;
+        }
+        offset += n;
+        written += n;
+    }
+
+    return written;
+}
+
+inline void sdatabase::SQLite3Blob::close() {
+    if (this->blob) {
+        sqlite3_blob_close(this->blob);
+        this->blob = nullptr;
+    }
+}
+
+inline sdatabase::SQLite3Blob::~SQLite3Blob() {
+    this->close();
+}
+
+inline void sdatabase::SQLite3Database::reset_profile() {
+    if (!this->profiler) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(this->profiler->mutex);
+    this->profiler->entries.clear();
+}
+
+#ifdef SDB_SQLITE3_SESSION
+inline sdatabase::SQLite3Session::SQLite3Session(SQLite3Session&& other) noexcept
+    : sqlite3_db(other.sqlite3_db), session(std::exchange(other.session, nullptr)), schema(std::move(other.schema)),
+      tables(std::move(other.tables)), all_tables(other.all_tables), enabled(other.enabled) {}
+
+inline sdatabase::SQLite3Session& sdatabase::SQLite3Session::operator=(SQLite3Session&& other) noexcept {
+    if (this != &other) {
+        this->close();
+        this->sqlite3_db = other.sqlite3_db;
+        this->session = std::exchange(other.session, nullptr);
+        this->schema = std::move(other.schema);
+        this->tables = std::move(other.tables);
+        this->all_tables = other.all_tables;
+        this->enabled = other.enabled;
+    }
+    return *this;
+}
+
+inline bool sdatabase::SQLite3Session::good() const {
+    return this->session != nullptr;
+}
+
+inline bool sdatabase::SQLite3Session::attach(const std::string& table) {
+    if (!this->session || sqlite3session_attach(this->session, table.empty() ? nullptr : table.c_str()) != SQLITE_OK) {
+        return false;
+    }
+
+    if (table.empty()) {
+        this->all_tables = true;
+    } else {
+        this->tables.push_back(table);
+    }
+    return true;
+}
+
+inline bool sdatabase::SQLite3Session::enable(bool enable) {
+    if (!this->session) {
+        return false;
+    }
+
+    this->enabled = sqlite3session_enable(this->session, enable ? 1 : 0) != 0;
+    return this->enabled == enable;
+}
+
+inline bool sdatabase::SQLite3Session::empty() const {
+    return !this->session || sqlite3session_isempty(this->session) != 0;
+}
+
+inline std::string sdatabase::SQLite3Session::changeset() {
+    return this->take(false, false);
+}
+
+inline std::string sdatabase::SQLite3Session::patchset() {
+    return this->take(true, false);
+}
+
+inline std::string sdatabase::SQLite3Session::take_changeset(bool patchset) {
+    return this->take(patchset, true);
+}
+
+inline std::string sdatabase::SQLite3Session::take(bool patchset, bool restart) {
+    if (!this->session) {
+        return {};
+    }
+
+    int size{};
+    void* data{};
+    const int ret = patchset ? sqlite3session_patchset(this->session, &size, &data) : sqlite3session_changeset(this->session, &size, &data);
+    std::string ret_data{};
+    if (ret == SQLITE_OK && data) {
+        ret_data.assign(static_cast<const char*>(data), static_cast<std::size_t>(size));
+    }
+    sqlite3_free(data);
+
+    // a session only accumulates, so starting over means a new session on the same tables
+    if (restart && ret == SQLITE_OK) {
+        sqlite3_session* next{};
+        bool ok = sqlite3session_create(this->sqlite3_db, this->schema.c_str(), &next) == SQLITE_OK;
+        ok = ok && (!this->all_tables || sqlite3session_attach(next, nullptr) == SQLITE_OK);
+        for (const auto& table : this->tables) {
+            ok = ok && sqlite3session_attach(next, table.c_str()) == SQLITE_OK;
+        }
+        if (ok) {
+            sqlite3session_enable(next, this->enabled ? 1 : 0);
+        } else if (next) {
+            sqlite3session_delete(next);
+            next = nullptr;
+        }
+
+        sqlite3session_delete(this->session);
+        this->session = next;
+    }
+
+    return ret_data;
+}
+
+inline void sdatabase::SQLite3Session::close() {
+    if (this->session) {
+        sqlite3session_delete(this->session);
+        this->session = nullptr;
+    }
+}
+
+inline sdatabase::SQLite3Session::~SQLite3Session() {
+    this->close();
+}
+
+#ifdef SDB_POSIX
+inline sdatabase::SQLite3ChangesetLog::SQLite3ChangesetLog(const std::string& path, bool sync) : sync(sync) {
+    this->fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+}
+
+inline bool sdatabase::SQLite3ChangesetLog::good() const {
+    return this->fd >= 0;
+}
+
+inline bool sdatabase::SQLite3ChangesetLog::append(const std::string& changeset) {
+    if (this->fd < 0 || changeset.size() > UINT32_MAX) {
+        return false;
+    }
+    if (changeset.empty()) {
+        return true;
+    }
+
+    // little-endian length and FNV-1a checksum, so logs can be shipped between hosts
+    std::uint64_t sum{14695981039346656037ULL};
+    for (unsigned char c : changeset) {
+        sum ^= c;
+        sum *= 1099511628211ULL;
+    }
+
+    std::string record{};
+    record.reserve(12 + changeset.size());
+    const auto size = static_cast<std::uint32_t>(changeset.size());
+    for (int i{0}; i < 4; ++i) {
+        record += static_cast<char>((size >> (8 * i)) & 0xff);
+    }
+    for (int i{0}; i < 8; ++i) {
+        record += static_cast<char>((sum >> (8 * i)) & 0xff);
+    }
+    record += changeset;
+
+    // one write with O_APPEND, so records from several loggers do not interleave
+    if (!detail::fd_sink(this->fd)(record.data(), record.size())) {
+        return false;
+    }
+#ifdef __APPLE__
+    return !this->sync || fcntl(this->fd, F_FULLFSYNC) == 0;
+#else
+    return !this->sync || fdatasync(this->fd) == 0;
+#endif
+}
+
+inline std::int64_t sdatabase::SQLite3ChangesetLog::read(const std::string& path, const std::function<bool(const std::string&)>& callback, std::int64_t offset) {
+    detail::MappedFile file{path};
+    if (!file.ok || offset < 0 || static_cast<std::size_t>(offset) > file.size) {
+        return -1;
+    }
+
+    const auto* data = reinterpret_cast<const unsigned char*>(file.data);
+    auto pos = static_cast<std::size_t>(offset);
+    while (file.size - pos >= 12) {
+        std::uint32_t size{};
+        std::uint64_t expected{};
+        for (int i{0}; i < 4; ++i) {
+            size |= static_cast<std::uint32_t>(data[pos + i]) << (8 * i);
+        }
+        for (int i{0}; i < 8; ++i) {
+            expected |= static_cast<std::uint64_t>(data[pos + 4 + i]) << (8 * i);
+        }
+        if (file.size - pos - 12 < size) {
+            break;
+        }
+
+        std::uint64_t sum{14695981039346656037ULL};
+        for (std::size_t i{0}; i < size; ++i) {
+            sum ^= data[pos + 12 + i];
+            sum *= 1099511628211ULL;
+        }
+        if (sum != expected || !callback(std::string(file.data + pos + 12, size))) {
+            break;
+        }
+        pos += 12 + size;
+    }
+    return static_cast<std::int64_t>(pos);
+}
+
+inline void sdatabase::SQLite3ChangesetLog::close() {
+    if (this->fd >= 0) {
+        ::close(this->fd);
+        this->fd = -1;
+    }
+}
+
+inline sdatabase::SQLite3ChangesetLog::~SQLite3ChangesetLog() {
+    this->close();
+}
+#endif
+
+inline sdatabase::SQLite3Session sdatabase::SQLite3Database::create_session(const std::string& schema) {
+    if (!this->is_good) {
+        return {};
+    }
+
+    sqlite3_session* session{};
+    if (sqlite3session_create(this->sqlite3_db, schema.c_str(), &session) != SQLITE_OK) {
+        return {};
+    }
+    return SQLite3Session{this->sqlite3_db, session, schema};
+}
+
+inline int sdatabase::SQLite3Database::conflict_callback(void* ctx, int type, sqlite3_changeset_iter* it) {
+    const auto& handler = *static_cast<const ConflictHandler*>(ctx);
+    if (!handler) {
+        return SQLITE_CHANGESET_ABORT;
+    }
+
+    ChangesetConflict conflict{ChangesetConflict::ForeignKey};
+    switch (type) {
+        case SQLITE_CHANGESET_DATA: conflict = ChangesetConflict::Data; break;
+        case SQLITE_CHANGESET_NOTFOUND: conflict = ChangesetConflict::NotFound; break;
+        case SQLITE_CHANGESET_CONFLICT: conflict = ChangesetConflict::Conflict; break;
+        case SQLITE_CHANGESET_CONSTRAINT: conflict = ChangesetConflict::Constraint; break;
+        default: break;
+    }
+
+    // a foreign key conflict is reported for the whole changeset, not for a change
+    const char* table{};
+    if (conflict != ChangesetConflict::ForeignKey) {
+        int columns{};
+        int op{};
+        sqlite3changeset_op(it, &table, &columns, &op, nullptr);
+    }
+
+    const ConflictAction action = handler(conflict, table ? table : "");
+    if (action == ConflictAction::Replace && (conflict == ChangesetConflict::Data || conflict == ChangesetConflict::Conflict)) {
+        return SQLITE_CHANGESET_REPLACE;
+    }
+    return action == ConflictAction::Abort ? SQLITE_CHANGESET_ABORT : SQLITE_CHANGESET_OMIT;
+}
+
+inline bool sdatabase::SQLite3Database::apply_changeset(const std::string& changeset, const ConflictHandler& on_conflict) {
+    if (!this->is_good || changeset.size() > INT32_MAX) {
+        return false;
+    }
+    if (changeset.empty()) {
+        return true;
+    }
+
+    // statements prepared while applying report their tables like exec() does
+    detail::SQLite3TableCollector tables{};
+    detail::table_collector = this->cache ? &tables : nullptr;
+    const int ret = sqlite3changeset_apply(this->sqlite3_db, static_cast<int>(changeset.size()), const_cast<char*>(changeset.data()),
+        nullptr, conflict_callback, const_cast<ConflictHandler*>(&on_conflict));
+    detail::table_collector = nullptr;
+
+    if (this->cache) {
+        this->cache->mark_dirty(tables);
+        if (sqlite3_get_autocommit(this->sqlite3_db)) {
+            this->cache->flush();
+        }
+    }
+
+    return ret == SQLITE_OK;
+}
+
+#ifdef SDB_POSIX
+inline std::int64_t sdatabase::SQLite3Database::apply_changeset_log(const std::string& path, const ConflictHandler& on_conflict, std::int64_t offset) {
+    if (!this->is_good) {
+        return -1;
+    }
+
+    return SQLite3ChangesetLog::read(path, [this, &on_conflict](const std::string& changeset) {
+        return this->apply_changeset(changeset, on_conflict);
+    }, offset);
+}
+#endif
+#endif
+#endif
+#ifdef SDB_POSTGRESQL
+inline sdatabase::PostgreSQLDatabase::PostgreSQLDatabase(const std::string& host,
+    const std::string& user, const std::string& password, const std::string& database, int port) {
+
+    this->open(host, user, password, database, port);
+}
+
+inline sdatabase::PostgreSQLDatabase::~PostgreSQLDatabase() {
+    if (this->is_good) {
+        this->close();
+    }
+}
+
+inline void sdatabase::PostgreSQLDatabase::open(const std::string& host,
+        const std::string& user, const std::string& password, const std::string& database, int port) {
+    if (this->is_good) {
+        return;
+    }
+
+    this->host = host;
+    this->user = user;
+    this->password = password;
+    this->database = database;
+    this->port = port;
+
+    this->pg_conn = PQconnectdb(this->conninfo().c_str());
+
+    if (PQstatus(pg_conn) != CONNECTION_OK || !pg_conn) {
+        PQfinish(pg_conn);
+        return;
+    }
+
+    PQsetNoticeProcessor(pg_conn, [](void*, const char* message) {
+    }, nullptr);
+
+    this->is_good = true;
+}
+
+inline bool sdatabase::PostgreSQLDatabase::exec(const std::string& query) {
+    if (!this->is_good) {
+        return false;
+    }
+
+    if (PQstatus(pg_conn) != CONNECTION_OK) {
+        throw std::runtime_error{"Connection to database failed: " + std::string(PQerrorMessage(pg_conn))};
+    }
+
+    detail::QueryProbe probe{query, this->slow_log != nullptr};
+
+    if (!this->validate(query)) {
+        throw std::runtime_error{"Invalid SQL statement in database '" + this->database + "': " + query + "\n"};
+    }
+
+    probe.prepared();
+
+    PGresult* res = PQexec(pg_conn, query.c_str());
+
+    probe.executed();
+
+    if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+        this->log_slow_query<>(probe, query, query, {}, PQresultErrorMessage(res));
+        PQclear(res);
+        return false;
+    }
+
+    PQclear(res);
+
+    this->log_slow_query<>(probe, query, query, {});
+
+    probe.succeeded();
+    return true;
+}
+
+inline bool sdatabase::PostgreSQLDatabase::validate(const std::string& query) {
+    if (!this->is_good) {
+        return false;
+    }
+
+    PGresult* res = PQprepare(pg_conn, "", query.c_str(), 0, nullptr);
+
+    if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+        PQclear(res);
+        return false;
+    }
+
+    PQclear(res);
+    return true;
+}
+
+inline std::vector<std::unordered_map<std::string, std::string>> sdatabase::PostgreSQLDatabase::query(const std::string& query) {
+    if (!this->is_good) {
+        return {};
+    }
+
+    detail::QueryProbe probe{query, this->slow_log != nullptr};
+
+    if (!this->validate(query)) {
+        throw std::runtime_error{"Invalid SQL statement: " + query + "\n"};
+    }
+
+    probe.prepared();
+
+    PGresult* res = PQexec(pg_conn, query.c_str());
+
+    probe.executed();
+
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+        this->log_slow_query<>(probe, query, query, {}, PQresultErrorMessage(res));
+        PQclear(res);
+        return {};
+    }
+
+    std::vector<std::unordered_map<std::string, std::string>> result;
+    std::uint64_t bytes{0};
+    int nrows = PQntuples(res);
+    int nfields = PQnfields(res);
+
+    for (int i = 0; i < nrows; ++i) {
+        std::unordered_map<std::string, std::string> row;
+        for (int j = 0; j < nfields; ++j) {
+            row[PQfname(res, j)] = PQgetvalue(res, i, j);
+            bytes += static_cast<std::uint64_t>(PQgetlength(res, i, j));
+        }
+        result.push_back(std::move(row));
+    }
+
+    probe.fetched(result.size(), bytes);
+
+    PQclear(res);
+
+    this->log_slow_query<>(probe, query, query, {});
+
+    probe.succeeded();
+    return result;
+}
+
+inline bool sdatabase::PostgreSQLDatabase::good() {
+    return this->is_good;
+}
+
+inline bool sdatabase::PostgreSQLDatabase::is_open() {
+    return this->good();
+}
+
+inline void sdatabase::PostgreSQLDatabase::close() {
+    this->stop_listener();
+    this->pool.reset();
+    if (this->is_good) {
+        PQfinish(this->pg_conn);
+        this->is_good = false;
+    }
+}
+
+inline bool sdatabase::PostgreSQLDatabase::empty() {
+    if (!this->is_good) {
+        return true;
+    }
+
+    const char* query = "SELECT COUNT(*) FROM information_schema.tables WHERE table_schema = 'public';";
+    PGresult* res = PQexec(pg_conn, query);
+
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+        PQclear(res);
+        return true;
+    }
+
+    bool is_empty = std::stoi(PQgetvalue(res, 0, 0)) == 0;
+    PQclear(res);
+    return is_empty;
+}
+
+inline std::int64_t sdatabase::PostgreSQLDatabase::get_last_insertion() {
+    if (!this->is_good) {
+        return -1;
+    }
+
+    const char* query = "SELECT LASTVAL();";
+    PGresult* res = PQexec(pg_conn, query);
+
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+        PQclear(res);
+        return -1;
+    }
+
+    std::int64_t last_insertion = std::stoll(PQgetvalue(res, 0, 0));
+    PQclear(res);
+    return last_insertion;
+}
+
+inline std::string sdatabase::PostgreSQLDatabase::convert_placeholders(const std::string& query) {
+    int i{1};
+    std::string nq{};
+    for (char ch : query) {
+        if (ch == '?') {
+            nq += "$" + std::to_string(i++);
+        } else {
+            nq += ch;
+        }
+    }
+    return nq;
+}
+
+inline std::string sdatabase::PostgreSQLDatabase::explain_analyze(const std::string& query, const Parameters& params) {
+    // only a SELECT, or a WITH whose parts do not write, is run again under ANALYZE; anything else is only planned
+    std::vector<std::string> words{};
+    for (std::size_t i{0}; i < query.size();) {
+        if (!std::isalpha(static_cast<unsigned char>(query[i]))) {
+            ++i;
+            continue;
+        }
+        std::string word{};
+        for (; i < query.size() && (std::isalnum(static_cast<unsigned char>(query[i])) || query[i] == '_'); ++i) {
+            word += static_cast<char>(std::toupper(static_cast<unsigned char>(query[i])));
+        }
+        words.push_back(std::move(word));
+    }
+    bool analyze = !words.empty() && (words.front() == "SELECT" || words.front() == "WITH");
+    for (std::size_t i{0}; analyze && words.front() == "WITH" && i < words.size(); ++i) {
+        analyze = words[i] != "INSERT" && words[i] != "UPDATE" && words[i] != "DELETE" && words[i] != "MERGE";
+    }
+
+    /* EXPLAIN ANALYZE runs the statement again, and a failing EXPLAIN aborts the transaction,
+     * so both run behind a savepoint (or in their own transaction) that is rolled back. */
+    PGTransactionStatusType status = PQtransactionStatus(pg_conn);
+    if (status != PQTRANS_IDLE && status != PQTRANS_INTRANS) {
+        return "";
+    }
+
+    const bool nested = status == PQTRANS_INTRANS;
+    PQclear(PQexec(pg_conn, nested ? "SAVEPOINT sdb_explain;" : "BEGIN;"));
+
+    const std::string explain = (analyze ? "EXPLAIN (ANALYZE, BUFFERS) " : "EXPLAIN ") + query;
+    PGresult* res = PQexecParams(pg_conn, explain.c_str(), static_cast<int>(params.values.size()), nullptr,
+        params.values.data(), params.lengths.data(), params.formats.data(), 0);
+
+    std::string ret{};
+    if (PQresultStatus(res) == PGRES_TUPLES_OK) {
+        for (int i = 0; i < PQntuples(res); ++i) {
+            if (!ret.empty()) {
+                ret += "\n";
+            }
+            ret += PQgetvalue(res, i, 0);
+        }
+    }
+    PQclear(res);
+
+    PQclear(PQexec(pg_conn, nested ? "ROLLBACK TO SAVEPOINT sdb_explain; RELEASE SAVEPOINT sdb_explain;" : "ROLLBACK;"));
+
+    return ret;
+}
+
+inline void sdatabase::PostgreSQLDatabase::set_slow_query_log(std::shared_ptr<SlowQueryLog> log) {
+    this->slow_log = std::move(log);
+}
+
+inline std::int64_t sdatabase::PostgreSQLDatabase::copy_out(const std::string& query, const ExportSink& sink, ExportFormat format, bool header) {
+    if (!this->is_good || !sink || format == ExportFormat::NDJSON) {
+        return -1;
+    }
+
+    std::string source{query};
+    while (!source.empty() && (source.back() == ';' || std::isspace(static_cast<unsigned char>(source.back())))) {
+        source.pop_back();
+    }
+    const bool is_query = source.find_first_of(" \t\r\n(") != std::string::npos;
+
+    std::string copy = "COPY " + (is_query ? "(" + source + ")" : source) + " TO STDOUT";
+    if (format == ExportFormat::CSV) {
+        copy += header ? " WITH (FORMAT csv, HEADER true)" : " WITH (FORMAT csv)";
+    } else if (format == ExportFormat::Binary) {
+        copy += " WITH (FORMAT binary)";
+    }
+
+    detail::QueryProbe probe{query, this->slow_log != nullptr};
+
+    PGresult* res = PQexec(this->pg_conn, copy.c_str());
+    probe.prepared();
+    if (PQresultStatus(res) != PGRES_COPY_OUT) {
+        PQclear(res);
+        return -1;
+    }
+    PQclear(res);
+
+    std::uint64_t bytes{0};
+    bool aborted{false};
+    bool started{false};
+    for (;;) {
+        char* buffer{};
+        const int n = PQgetCopyData(this->pg_conn, &buffer, 0);
+        if (n < 0) {
+            break;
+        }
+        if (!started) {
+            probe.executed();
+            started = true;
+        }
+
+        // after an abort the rest of the stream is drained so the connection stays usable
+        if (!aborted && !sink(buffer, static_cast<std::size_t>(n))) {
+            aborted = true;
+            if (PGcancel* cancel = PQgetCancel(this->pg_conn)) {
+                char error[256];
+                PQcancel(cancel, error, sizeof(error));
+                PQfreeCancel(cancel);
+            }
+        }
+        bytes += static_cast<std::uint64_t>(n);
+        PQfreemem(buffer);
+    }
+
+    std::int64_t rows{-1};
+    while (PGresult* end = PQgetResult(this->pg_conn)) {
+        if (PQresultStatus(end) == PGRES_COMMAND_OK && !aborted) {
+            rows = std::strtoll(PQcmdTuples(end), nullptr, 10);
+        }
+        PQclear(end);
+    }
+
+    if (!started) {
+        probe.executed();
+    }
+    probe.fetched(rows > 0 ? static_cast<std::uint64_t>(rows) : 0, bytes);
+
+    if (rows < 0) {
+        return -1;
+    }
+
+    this->log_slow_query<>(probe, query, source, {});
+    probe.succeeded();
+    return rows;
+}
+
+#ifdef SDB_POSIX
+inline std::int64_t sdatabase::PostgreSQLDatabase::copy_out(const std::string& query, int fd, ExportFormat format, bool header) {
+    return this->copy_out(query, detail::fd_sink(fd), format, header);
+}
+#endif
+
+inline sdatabase::ImportStats sdatabase::PostgreSQLDatabase::import_file(const std::string& table, const std::string& path, const ImportOptions& options) {
+    if (!this->is_good) {
+        ImportStats stats{};
+        stats.error = "database is not open";
+        return stats;
+    }
+
+    struct Writer {
+        PGconn* conn;
+        const std::string& table;
+        const ImportOptions& options;
+        std::string copy{};
+        std::string buffer{};
+        std::string row{};
+        std::vector<ColumnType> types{};
+        std::size_t in_batch{};
+        std::uint64_t uncommitted{};
+        bool copying{false};
+
+        bool fail(ImportStats& stats) {
+            stats.error = PQerrorMessage(conn);
+            return false;
+        }
+
+        bool begin(const std::vector<std::string>& columns, const std::vector<ColumnType>& column_types, ImportStats& stats) {
+            types = column_types;
+
+            // names come from the file, so they are always quoted; COPY goes through PQexec, which runs several statements
+            std::vector<std::string> names{};
+            for (const auto& column : columns) {
+                names.push_back(quote_identifier(conn, column));
+                if (names.back().empty()) {
+                    return fail(stats);
+                }
+            }
+            const std::string name = quote_identifier(conn, table);
+            if (name.empty()) {
+                return fail(stats);
+            }
+
+            std::string list{};
+            for (std::size_t i{0}; i < names.size(); ++i) {
+                list += (i ? ", " : "") + names[i];
+            }
+
+            if (options.create_table) {
+                if (columns.empty()) {
+                    stats.error = "create_table needs column names";
+                    return false;
+                }
+
+                std::string create = "CREATE TABLE IF NOT EXISTS " + name + " (";
+                for (std::size_t i{0}; i < names.size(); ++i) {
+                    create += (i ? ", " : "") + names[i];
+                    create += types[i] == ColumnType::Integer ? " bigint" : types[i] == ColumnType::Real ? " double precision"
+                            : types[i] == ColumnType::Boolean ? " boolean" : types[i] == ColumnType::Blob ? " bytea" : " text";
+                }
+
+                PGresult* res = PQexec(conn, (create + ");").c_str());
+                const bool ok = PQresultStatus(res) == PGRES_COMMAND_OK;
+                PQclear(res);
+                if (!ok) {
+                    return fail(stats);
+                }
+            }
+
+            copy = "COPY " + name + (list.empty() ? "" : " (" + list + ")") + " FROM STDIN WITH (FORMAT binary);";
+            return start(stats);
+        }
+
+        bool start(ImportStats& stats) {
+            PGresult* res = PQexec(conn, copy.c_str());
+            copying = PQresultStatus(res) == PGRES_COPY_IN;
+            PQclear(res);
+            if (!copying) {
+                return fail(stats);
+            }
+            buffer = detail::copy_binary_header();
+            return true;
+        }
+
+        bool flush(ImportStats& stats) {
+            if (!buffer.empty() && PQputCopyData(conn, buffer.data(), static_cast<int>(buffer.size())) != 1) {
+                return fail(stats);
+            }
+            buffer.clear();
+            return true;
+        }
+
+        bool end(ImportStats& stats) {
+            detail::copy_put_int16(buffer, -1);
+            bool ok = flush(stats) && PQputCopyEnd(conn, nullptr) == 1;
+            copying = false;
+            while (PGresult* res = PQgetResult(conn)) {
+                if (PQresultStatus(res) != PGRES_COMMAND_OK && ok) {
+                    stats.error = PQresultErrorMessage(res);
+                    ok = false;
+                }
+                PQclear(res);
+            }
+            if (ok) {
+                stats.rows += uncommitted;
+            }
+            uncommitted = 0;
+            return ok;
+        }
+
+        bool encode(const detail::ImportField* fields) {
+            row.clear();
+            detail::copy_put_int16(row, static_cast<std::int16_t>(types.size()));
+            for (std::size_t i{0}; i < types.size(); ++i) {
+                const auto& field = fields[i];
+                std::int64_t integer{};
+                double real{};
+                bool boolean{};
+
+                if (field.null) {
+                    detail::copy_put_int32(row, -1);
+                } else if (types[i] == ColumnType::Text || types[i] == ColumnType::Blob) {
+                    detail::copy_put_int32(row, static_cast<std::int32_t>(field.size));
+                    row.append(field.data, field.size);
+                } else if (types[i] == ColumnType::Integer && detail::import_integer(field, integer)) {
+                    detail::copy_put_int32(row, 8);
+                    detail::copy_put_int64(row, integer);
+                } else if (types[i] == ColumnType::Real && detail::import_real(field, real)) {
+                    std::int64_t bits{};
+                    std::memcpy(&bits, &real, sizeof(bits));
+                    detail::copy_put_int32(row, 8);
+                    detail::copy_put_int64(row, bits);
+                } else if (types[i] == ColumnType::Boolean && detail::import_boolean(field, boolean)) {
+                    detail::copy_put_int32(row, 1);
+                    row += static_cast<char>(boolean ? 1 : 0);
+                } else {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        bool write(const detail::ImportChunk& chunk, ImportStats& stats) {
+            constexpr std::size_t flush_size{1024 * 1024};
+            const std::size_t width = types.size();
+            for (std::size_t i{0}; i < chunk.rows; ++i) {
+                if (!encode(&chunk.fields[i * width])) {
+                    ++stats.skipped;
+                    continue;
+                }
+                buffer += row;
+                ++uncommitted;
+
+                if (buffer.size() >= flush_size && !flush(stats)) {
+                    return false;
+                }
+                if (++in_batch >= options.batch_size) {
+                    in_batch = 0;
+                    if (!end(stats) || !start(stats)) {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        }
+
+        bool finish(ImportStats& stats) {
+            return !copying || end(stats);
+        }
+
+        ~Writer() {
+            if (copying) {
+                PQputCopyEnd(conn, "import aborted");
+                while (PGresult* res = PQgetResult(conn)) {
+                    PQclear(res);
+                }
+            }
+        }
+    } writer{this->pg_conn, table, options};
+
+    return detail::run_import(path, options, writer);
+}
+
+inline sdatabase::PostgreSQLScan sdatabase::PostgreSQLDatabase::scan(const std::string& table, const std::vector<std::string>& keys,
+        int page_size, const std::string& columns) {
+    if (!this->is_good || keys.empty() || page_size <= 0) {
+        return {};
+    }
+
+    static std::atomic<std::uint64_t> counter{0};
+    const std::string name = "sdb_scan_" + std::to_string(++counter);
+
+    std::string order{};
+    std::string params{};
+    for (std::size_t i{0}; i < keys.size(); ++i) {
+        order += (i ? ", " : "") + keys[i];
+        params += (i ? ", $" : "$") + std::to_string(i + 1);
+    }
+
+    const std::string select = "SELECT " + columns + " FROM " + table;
+    const std::string first_query = select + " ORDER BY " + order + " LIMIT $1";
+    const std::string next_query = select + " WHERE (" + order + ") > (" + params + ") ORDER BY " + order
+        + " LIMIT $" + std::to_string(keys.size() + 1);
+
+    const auto prepare = [this](const std::string& statement, const std::string& query) {
+        PGresult* res = PQprepare(this->pg_conn, statement.c_str(), query.c_str(), 0, nullptr);
+        const bool ok = PQresultStatus(res) == PGRES_COMMAND_OK;
+        PQclear(res);
+        return ok;
+    };
+    const auto deallocate = [this](const std::string& statement) {
+        PQclear(PQexec(this->pg_conn, ("DEALLOCATE " + statement).c_str()));
+    };
+
+    if (!prepare(name + "_first", first_query)) {
+        return {};
+    }
+    if (!prepare(name + "_next", next_query)) {
+        deallocate(name + "_first");
+        return {};
+    }
+
+    // the last key is read back from the result, so every key column has to be selected
+    std::vector<int> key_index{};
+    PGresult* desc = PQdescribePrepared(this->pg_conn, (name + "_first").c_str());
+    for (const auto& key : keys) {
+        const std::string column = key.substr(key.rfind('.') == std::string::npos ? 0 : key.rfind('.') + 1);
+        key_index.push_back(PQresultStatus(desc) == PGRES_COMMAND_OK ? PQfnumber(desc, column.c_str()) : -1);
+    }
+    PQclear(desc);
+
+    if (std::find(key_index.begin(), key_index.end(), -1) != key_index.end()) {
+        deallocate(name + "_first");
+        deallocate(name + "_next");
+        return {};
+    }
+
+    return PostgreSQLScan{this->pg_conn, name + "_first", name + "_next", std::move(key_index), page_size};
+}
+
+inline sdatabase::PostgreSQLScan::PostgreSQLScan(PGconn* pg_conn, std::string first, std::string next, std::vector<int> key_index, int page_size)
+    : pg_conn(pg_conn), first(std::move(first)), next(std::move(next)), key_index(std::move(key_index)), page_size(page_size) {}
+
+inline sdatabase::PostgreSQLScan::PostgreSQLScan(PostgreSQLScan&& other) noexcept {
+    *this = std::move(other);
+}
+
+inline sdatabase::PostgreSQLScan& sdatabase::PostgreSQLScan::operator=(PostgreSQLScan&& other) noexcept {
+    if (this != &other) {
+        this->release();
+        this->pg_conn = std::exchange(other.pg_conn, nullptr);
+        this->first = std::move(other.first);
+        this->next = std::move(other.next);
+        this->key_index = std::move(other.key_index);
+        this->last = std::move(other.last);
+        this->page_size = other.page_size;
+        this->page = std::exchange(other.page, nullptr);
+        this->page_row = other.page_row;
+        this->row = std::move(other.row);
+        this->started = other.started;
+        this->done = other.done;
+        this->failed = other.failed;
+    }
+    return *this;
+}
+
+inline bool sdatabase::PostgreSQLScan::good() const {
+    return this->pg_conn != nullptr && !this->failed;
+}
+
+inline bool sdatabase::PostgreSQLScan::advance() {
+    if (this->done) {
+        return false;
+    }
+
+    if (!this->page || this->page_row + 1 >= PQntuples(this->page)) {
+        const std::string limit = std::to_string(this->page_size);
+        if (this->page) {
+            if (PQntuples(this->page) < this->page_size) {
+                this->done = true;
+                return false;
+            }
+
+            const int row = PQntuples(this->page) - 1;
+            this->last.clear();
+            for (int index : this->key_index) {
+                this->last.emplace_back(PQgetvalue(this->page, row, index));
+            }
+            PQclear(this->page);
+        }
+
+        std::vector<const char*> values{};
+        for (const auto& value : this->last) {
+            values.push_back(value.c_str());
+        }
+        values.push_back(limit.c_str());
+
+        const std::string& statement = this->last.empty() ? this->first : this->next;
+        this->page = PQexecPrepared(this->pg_conn, statement.c_str(), static_cast<int>(values.size()), values.data(), nullptr, nullptr, 0);
+        if (PQresultStatus(this->page) != PGRES_TUPLES_OK || PQntuples(this->page) == 0) {
+            this->failed = PQresultStatus(this->page) != PGRES_TUPLES_OK;
+            this->done = true;
+            return false;
+        }
+        this->page_row = 0;
+    } else {
+        ++this->page_row;
+    }
+
+    this->row.clear();
+    for (int i{0}; i < PQnfields(this->page); ++i) {
+        this->row[PQfname(this->page, i)] = PQgetvalue(this->page, this->page_row, i);
+    }
+
+    return true;
+}
+
+inline sdatabase::PostgreSQLScan::iterator sdatabase::PostgreSQLScan::begin() {
+    if (!this->pg_conn) {
+        return {};
+    }
+    if (this->started) {
+        return this->done ? iterator{} : iterator{this};
+    }
+
+    this->started = true;
+    return this->advance() ? iterator{this} : iterator{};
+}
+
+inline sdatabase::PostgreSQLScan::iterator sdatabase::PostgreSQLScan::end() {
+    return iterator{};
+}
+
+inline void sdatabase::PostgreSQLScan::release() {
+    PQclear(this->page);
+    this->page = nullptr;
+    if (this->pg_conn) {
+        PQclear(PQexec(this->pg_conn, ("DEALLOCATE " + this->first).c_str()));
+        PQclear(PQexec(this->pg_conn, ("DEALLOCATE " + this->next).c_str()));
+        this->pg_conn = nullptr;
+    }
+}
+
+inline sdatabase::PostgreSQLScan::~PostgreSQLScan() {
+    this->release();
+}
+
+inline int sdatabase::detail::wait_readable(const std::vector<int>& sockets, std::vector<bool>& ready, int timeout) {
+    ready.assign(sockets.size(), false);
+#ifdef SDB_POSIX
+    std::vector<pollfd> fds(sockets.size());
+    for (std::size_t i{0}; i < sockets.size(); ++i) {
+        fds[i] = pollfd{sockets[i], POLLIN, 0};
+    }
+    const int n = ::poll(fds.data(), fds.size(), timeout);
+    if (n < 0) {
+        return errno == EINTR ? 0 : -1;
+    }
+    for (std::size_t i{0}; i < sockets.size(); ++i) {
+        ready[i] = (fds[i].revents & (POLLIN | POLLERR | POLLHUP)) != 0;
+    }
+    return n;
+#else
+    // a socket with a pending error is reported as readable, like POLLERR
+    fd_set set;
+    FD_ZERO(&set);
+    int max{-1};
+    for (const int socket : sockets) {
+        if (socket >= 0) {
+            FD_SET(socket, &set);
+            max = std::max(max, socket);
+        }
+    }
+
+    timeval tv{timeout / 1000, (timeout % 1000) * 1000};
+    const int n = ::select(max + 1, &set, nullptr, nullptr, timeout < 0 ? nullptr : &tv);
+    if (n <= 0) {
+        return n;
+    }
+    for (std::size_t i{0}; i < sockets.size(); ++i) {
+        ready[i] = sockets[i] >= 0 && FD_ISSET(sockets[i], &set);
+    }
+    return n;
+#endif
+}
+
+inline sdatabase::detail::PostgreSQLConnectionPool& sdatabase::PostgreSQLDatabase::connection_pool() {
+    if (!this->pool) {
+        this->pool = std::make_unique<detail::PostgreSQLConnectionPool>(this->conninfo(), this->pool_size);
+    }
+    return *this->pool;
+}
+
+inline void sdatabase::PostgreSQLDatabase::set_pool_size(std::size_t size) {
+    this->pool_size = size ? size : 1;
+}
+
+inline void sdatabase::PostgreSQLDatabase::set_cursor_batch_size(int batch_size) {
+    this->cursor_batch_size = std::max(batch_size, 1);
+}
+
+inline void sdatabase::PostgreSQLDatabase::set_pool_timeout(std::chrono::milliseconds timeout) {
+    this->pool_timeout = std::max(timeout, std::chrono::milliseconds::zero());
+}
+
+inline std::vector<std::unordered_map<std::string, std::string>> sdatabase::PostgreSQLDatabase::rows_from_result(PGresult* res, std::uint64_t& bytes) {
+    std::vector<std::unordered_map<std::string, std::string>> result{};
+    const int nrows = PQntuples(res);
+    const int nfields = PQnfields(res);
+    result.reserve(static_cast<std::size_t>(nrows));
+
+    for (int i = 0; i < nrows; ++i) {
+        std::unordered_map<std::string, std::string> row;
+        for (int j = 0; j < nfields; ++j) {
+            row[PQfname(res, j)] = PQgetvalue(res, i, j);
+            bytes += static_cast<std::uint64_t>(PQgetlength(res, i, j));
+        }
+        result.push_back(std::move(row));
+    }
+
+    return result;
+}
+
+inline std::vector<std::vector<std::unordered_map<std::string, std::string>>> sdatabase::PostgreSQLDatabase::query_all(
+        const std::vector<std::string>& queries, std::size_t concurrency) {
+    std::vector<std::vector<std::unordered_map<std::string, std::string>>> results(queries.size());
+    if (!this->is_good || queries.empty()) {
+        return results;
+    }
+
+    struct Slot {
+        PGconn* conn{};
+        std::size_t index{};
+        bool busy{false};
+        bool ok{false};
+        std::unique_ptr<detail::QueryProbe> probe{};
+    };
+
+    auto& pool = this->connection_pool();
+    std::vector<Slot> slots{};
+    const std::size_t want = std::min({concurrency ? concurrency : 1, queries.size(), this->pool_size});
+    for (std::size_t i{0}; i < want; ++i) {
+        // wait for the first connection, then take whatever else is free right now
+        PGconn* conn = pool.acquire(i == 0 ? this->pool_timeout : std::chrono::milliseconds::zero());
+        if (!conn) {
+            break;
+        }
+        slots.push_back(Slot{conn});
+    }
+    if (slots.empty()) {
+        return results;
+    }
+
+    std::size_t next{0};
+    std::size_t done{0};
+    const auto dispatch = [&](Slot& slot) {
+        while (next < queries.size()) {
+            slot.index = next++;
+            slot.ok = false;
+            slot.probe = std::make_unique<detail::QueryProbe>(queries[slot.index], this->slow_log != nullptr);
+            slot.probe->prepared();
+            if (PQsendQueryParams(slot.conn, queries[slot.index].c_str(), 0, nullptr, nullptr, nullptr, nullptr, 0)) {
+                slot.busy = true;
+                return;
+            }
+            slot.probe.reset();
+            ++done;
+        }
+        slot.busy = false;
+    };
+
+    for (auto& slot : slots) {
+        dispatch(slot);
+    }
+
+    std::vector<int> sockets(slots.size());
+    std::vector<bool> ready{};
+    while (done < queries.size()) {
+        for (std::size_t i{0}; i < slots.size(); ++i) {
+            sockets[i] = slots[i].busy ? PQsocket(slots[i].conn) : -1;
+        }
+        if (detail::wait_readable(sockets, ready, -1) < 0) {
+            break;
+        }
+
+        for (std::size_t i{0}; i < slots.size(); ++i) {
+            Slot& slot = slots[i];
+            if (!slot.busy || !ready[i]) {
+                continue;
+            }
+
+            if (!PQconsumeInput(slot.conn)) {
+                // broken connection, the statement fails and the slot is retired
+                slot.busy = false;
+                slot.probe.reset();
+                ++done;
+                continue;
+            }
+
+            while (!PQisBusy(slot.conn)) {
+                PGresult* res = PQgetResult(slot.conn);
+                if (!res) {
+                    if (slot.ok) {
+                        this->log_slow_query<>(*slot.probe, queries[slot.index], queries[slot.index], {});
+                        slot.probe->succeeded();
+                    }
+                    slot.probe.reset();
+                    ++done;
+                    dispatch(slot);
+                    break;
+                }
+
+                slot.probe->executed();
+                if (PQresultStatus(res) == PGRES_TUPLES_OK) {
+                    std::uint64_t bytes{0};
+                    results[slot.index] = rows_from_result(res, bytes);
+                    slot.probe->fetched(results[slot.index].size(), bytes);
+                    slot.ok = true;
+                } else if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+                    results[slot.index].clear();
+                    slot.ok = false;
+                }
+                PQclear(res);
+            }
+        }
+
+        // statements left over after every slot failed
+        if (std::none_of(slots.begin(), slots.end(), [](const Slot& slot) { return slot.busy; })) {
+            break;
+        }
+    }
+
+    // a connection still busy after a poll failure is not idle, so release() closes it
+    for (auto& slot : slots) {
+        pool.release(slot.conn);
+    }
+
+    return results;
+}
+
+inline sdatabase::PostgreSQLCursor sdatabase::PostgreSQLDatabase::declare_cursor(const std::string& nq, const Parameters& params, int batch_size) {
+    auto& pool = this->connection_pool();
+    PGconn* conn = pool.acquire(this->pool_timeout);
+    if (!conn) {
+        return {};
+    }
+
+    static std::atomic<std::uint64_t> counter{0};
+    const std::string name = "sdb_cursor_" + std::to_string(++counter);
+
+    PGresult* res = PQexec(conn, "BEGIN");
+    bool ok = PQresultStatus(res) == PGRES_COMMAND_OK;
+    PQclear(res);
+
+    if (ok) {
+        const std::string declare = "DECLARE " + name + " NO SCROLL CURSOR FOR " + nq;
+        res = PQexecParams(conn, declare.c_str(), static_cast<int>(params.values.size()), nullptr,
+            params.values.data(), params.lengths.data(), params.formats.data(), 0);
+        ok = PQresultStatus(res) == PGRES_COMMAND_OK;
+        PQclear(res);
+    }
+
+    if (!ok) {
+        PQclear(PQexec(conn, "ROLLBACK"));
+        pool.release(conn);
+        return {};
+    }
+
+    return PostgreSQLCursor{&pool, conn, name, batch_size};
+}
+
+inline sdatabase::PostgreSQLCursor::PostgreSQLCursor(PostgreSQLCursor&& other) noexcept {
+    *this = std::move(other);
+}
+
+inline sdatabase::PostgreSQLCursor& sdatabase::PostgreSQLCursor::operator=(PostgreSQLCursor&& other) noexcept {
+    if (this != &other) {
+        this->close();
+        this->pool = std::exchange(other.pool, nullptr);
+        this->conn = std::exchange(other.conn, nullptr);
+        this->name = std::move(other.name);
+        this->batch_size = other.batch_size;
+        this->pending = std::exchange(other.pending, false);
+        this->done = other.done;
+        this->failed = other.failed;
+    }
+    return *this;
+}
+
+inline bool sdatabase::PostgreSQLCursor::good() const {
+    return this->conn != nullptr && !this->failed;
+}
+
+inline bool sdatabase::PostgreSQLCursor::exhausted() const {
+    return this->done || !this->conn;
+}
+
+inline bool sdatabase::PostgreSQLCursor::send_fetch() {
+    const std::string fetch = "FETCH FORWARD " + std::to_string(this->batch_size) + " FROM " + this->name;
+    this->pending = PQsendQuery(this->conn, fetch.c_str()) == 1;
+    return this->pending;
+}
+
+inline PGresult* sdatabase::PostgreSQLCursor::take_result() {
+    // blocks until the prefetched batch has arrived, then drains the trailing null result
+    PGresult* res = PQgetResult(this->conn);
+    while (PGresult* extra = PQgetResult(this->conn)) {
+        PQclear(extra);
+    }
+    this->pending = false;
+    return res;
+}
+
+inline std::vector<std::unordered_map<std::string, std::string>> sdatabase::PostgreSQLCursor::next() {
+    if (this->exhausted()) {
+        return {};
+    }
+
+    if (!this->pending && !this->send_fetch()) {
+        this->failed = this->done = true;
+        return {};
+    }
+
+    PGresult* res = this->take_result();
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+        PQclear(res);
+        this->failed = this->done = true;
+        return {};
+    }
+
+    if (PQntuples(res) < this->batch_size) {
+        this->done = true;
+    } else if (!this->send_fetch()) {
+        this->failed = this->done = true;
+    }
+
+    std::uint64_t bytes{0};
+    auto rows = PostgreSQLDatabase::rows_from_result(res, bytes);
+    PQclear(res);
+    return rows;
+}
+
+inline void sdatabase::PostgreSQLCursor::close() {
+    if (!this->conn) {
+        return;
+    }
+
+    if (this->pending) {
+        PQclear(this->take_result());
+    }
+
+    PQclear(PQexec(this->conn, ("CLOSE " + this->name).c_str()));
+    PQclear(PQexec(this->conn, "COMMIT"));
+    this->pool->release(this->conn);
+    this->conn = nullptr;
+    this->pool = nullptr;
+}
+
+inline sdatabase::PostgreSQLCursor::~PostgreSQLCursor() {
+    this->close();
+}
+
+inline std::string sdatabase::PostgreSQLDatabase::conninfo() const {
+    return "host=" + this->host + " user=" + this->user + " password=" + this->password + " dbname=" + this->database + " port=" + std::to_string(this->port);
+}
+
+inline std::string sdatabase::PostgreSQLDatabase::quote_identifier(PGconn* conn, const std::string& identifier) {
+    char* quoted = PQescapeIdentifier(conn, identifier.c_str(), identifier.size());
+    if (!quoted) {
+        return {};
+    }
+
+    std::string ret{quoted};
+    PQfreemem(quoted);
+    return ret;
+}
+
+inline void sdatabase::PostgreSQLDatabase::drain_notifications() {
+    if (this->notify->running || PQconsumeInput(this->pg_conn) == 0) {
+        return;
+    }
+
+    auto cache = this->notify->get_cache();
+    while (PGnotify* n = PQnotifies(this->pg_conn)) {
+        PostgreSQLNotification notification{n->relname, n->extra ? n->extra : "", n->be_pid};
+        PQfreemem(n);
+
+        if (cache) {
+            cache->invalidate(notification.channel);
+        }
+
+        std::lock_guard<std::mutex> lock(this->notify->mutex);
+        if (this->notify->inbox.size() >= detail::PostgreSQLNotifyState::max_inbox) {
+            this->notify->inbox.pop_front();
+        }
+        this->notify->inbox.push_back(std::move(notification));
+    }
+}
+
+inline bool sdatabase::PostgreSQLDatabase::listen(const std::string& channel) {
+    if (!this->is_good) {
+        return false;
+    }
+
+    auto& state = *this->notify;
+    std::unique_lock<std::mutex> lock(state.mutex);
+    if (state.channels.count(channel)) {
+        return true;
+    }
+
+    if (!state.running) {
+        lock.unlock();
+        const std::string query = "LISTEN " + quote_identifier(this->pg_conn, channel);
+        PGresult* res = PQexec(this->pg_conn, query.c_str());
+        const bool ok = PQresultStatus(res) == PGRES_COMMAND_OK;
+        PQclear(res);
+        if (ok) {
+            lock.lock();
+            state.channels.insert(channel);
+        }
+        return ok;
+    }
+
+    state.channels.insert(channel);
+    state.commands.emplace_back(true, channel);
+    const std::uint64_t ticket = ++state.queued;
+    state.wake_listener();
+
+    return state.cv.wait_for(lock, std::chrono::seconds{5}, [&state, ticket]() {
+        return state.applied >= ticket || !state.running;
+    }) && state.applied >= ticket;
+}
+
+inline bool sdatabase::PostgreSQLDatabase::unlisten(const std::string& channel) {
+    if (!this->is_good) {
+        return false;
+    }
+
+    auto& state = *this->notify;
+    std::unique_lock<std::mutex> lock(state.mutex);
+    if (!state.channels.erase(channel)) {
+        return true;
+    }
+
+    if (state.running) {
+        state.commands.emplace_back(false, channel);
+        ++state.queued;
+        state.wake_listener();
+        return true;
+    }
+
+    lock.unlock();
+    const std::string query = "UNLISTEN " + quote_identifier(this->pg_conn, channel);
+    PGresult* res = PQexec(this->pg_conn, query.c_str());
+    const bool ok = PQresultStatus(res) == PGRES_COMMAND_OK;
+    PQclear(res);
+    return ok;
+}
+
+inline std::vector<sdatabase::PostgreSQLNotification> sdatabase::PostgreSQLDatabase::poll_notifications(std::chrono::milliseconds timeout) {
+    if (!this->is_good || this->notify->running) {
+        return {};
+    }
+
+    this->drain_notifications();
+
+    bool empty{};
+    {
+        std::lock_guard<std::mutex> lock(this->notify->mutex);
+        empty = this->notify->inbox.empty();
+    }
+
+    if (empty && timeout.count() > 0) {
+        std::vector<bool> ready{};
+        const int socket = PQsocket(this->pg_conn);
+        if (socket >= 0 && detail::wait_readable({socket}, ready, static_cast<int>(timeout.count())) > 0) {
+            this->drain_notifications();
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(this->notify->mutex);
+    std::vector<PostgreSQLNotification> ret(std::make_move_iterator(this->notify->inbox.begin()),
+        std::make_move_iterator(this->notify->inbox.end()));
+    this->notify->inbox.clear();
+    return ret;
+}
+
+inline int sdatabase::PostgreSQLDatabase::notification_socket() {
+    return this->is_good ? PQsocket(this->pg_conn) : -1;
+}
+
+inline void sdatabase::PostgreSQLDatabase::listener_loop(detail::PostgreSQLNotifyState* state, PGconn* conn) {
+    const auto listen_all = [state, conn]() {
+        std::vector<std::string> channels{};
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            channels.assign(state->channels.begin(), state->channels.end());
+        }
+        for (const auto& channel : channels) {
+            PQclear(PQexec(conn, ("LISTEN " + quote_identifier(conn, channel)).c_str()));
+        }
+    };
+
+    listen_all();
+
+    std::chrono::milliseconds backoff{100};
+    while (!state->stop) {
+        std::vector<std::pair<bool, std::string>> commands{};
+        std::uint64_t queued{};
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            commands.swap(state->commands);
+            queued = state->queued;
+        }
+        for (const auto& [listen, channel] : commands) {
+            const std::string query = (listen ? "LISTEN " : "UNLISTEN ") + quote_identifier(conn, channel);
+            PQclear(PQexec(conn, query.c_str()));
+        }
+        if (!commands.empty()) {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            state->applied = queued;
+            state->cv.notify_all();
+        }
+
+#ifdef SDB_POSIX
+        // the wake pipe ends the wait as soon as a command is queued or stop is set
+        constexpr int timeout{1000};
+#else
+        // without a wake pipe, queued commands and stop are picked up on the next short timeout
+        constexpr int timeout{50};
+#endif
+        std::vector<bool> ready{};
+        detail::wait_readable({PQsocket(conn), state->wake[0]}, ready, timeout);
+#ifdef SDB_POSIX
+        if (ready[1]) {
+            char buffer[64];
+            (void)!::read(state->wake[0], buffer, sizeof(buffer));
+        }
+#endif
+
+        if (PQconsumeInput(conn) == 0 || PQstatus(conn) != CONNECTION_OK) {
+            // notifications sent while disconnected are lost, so nothing cached can be trusted
+            if (auto cache = state->get_cache()) {
+                cache->clear();
+            }
+
+            std::this_thread::sleep_for(backoff);
+            PQreset(conn);
+            if (PQstatus(conn) == CONNECTION_OK) {
+                backoff = std::chrono::milliseconds{100};
+                listen_all();
+                if (auto cache = state->get_cache()) {
+                    cache->clear();
+                }
+            } else {
+                backoff = std::min(backoff * 2, std::chrono::milliseconds{5000});
+            }
+            continue;
+        }
+
+        auto cache = state->get_cache();
+        while (PGnotify* n = PQnotifies(conn)) {
+            PostgreSQLNotification notification{n->relname, n->extra ? n->extra : "", n->be_pid};
+            PQfreemem(n);
+
+            if (cache) {
+                cache->invalidate(notification.channel);
+            }
+            if (state->handler) {
+                state->handler(notification);
+            }
+        }
+    }
+
+    PQfinish(conn);
+}
+
+inline bool sdatabase::PostgreSQLDatabase::start_listener(std::function<void(const PostgreSQLNotification&)> handler) {
+    auto& state = *this->notify;
+    if (!this->is_good || state.running) {
+        return false;
+    }
+
+    PGconn* conn = PQconnectdb(this->conninfo().c_str());
+    if (!conn || PQstatus(conn) != CONNECTION_OK) {
+        PQfinish(conn);
+        return false;
+    }
+    PQsetNoticeProcessor(conn, [](void*, const char*) {}, nullptr);
+
+#ifdef SDB_POSIX
+    if (::pipe(state.wake) != 0) {
+        PQfinish(conn);
+        return false;
+    }
+#endif
+
+    // this connection stops listening, so its notifications do not pile up unread
+    PQclear(PQexec(this->pg_conn, "UNLISTEN *"));
+    this->drain_notifications();
+
+    state.handler = std::move(handler);
+    state.stop = false;
+    state.running = true;
+    state.thread = std::thread(listener_loop, &state, conn);
+    return true;
+}
+
+inline void sdatabase::PostgreSQLDatabase::stop_listener() {
+    auto& state = *this->notify;
+    if (!state.running) {
+        return;
+    }
+
+    state.stop = true;
+    state.wake_listener();
+    state.thread.join();
+
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.running = false;
+        state.commands.clear();
+        state.applied = state.queued;
+        state.cv.notify_all();
+    }
+#ifdef SDB_POSIX
+    ::close(state.wake[0]);
+    ::close(state.wake[1]);
+#endif
+    state.wake[0] = state.wake[1] = -1;
+    state.handler = {};
+
+    if (!this->is_good) {
+        return;
+    }
+
+    std::vector<std::string> channels{};
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        channels.assign(state.channels.begin(), state.channels.end());
+    }
+    for (const auto& channel : channels) {
+        PQclear(PQexec(this->pg_conn, ("LISTEN " + quote_identifier(this->pg_conn, channel)).c_str()));
+    }
+    // notifications between the listener stopping and LISTEN above were missed
+    if (auto cache = state.get_cache()) {
+        cache->clear();
+    }
+}
+
+inline bool sdatabase::PostgreSQLDatabase::enable_result_cache(bool enable, std::size_t max_bytes) {
+    std::lock_guard<std::mutex> lock(this->notify->mutex);
+    this->notify->cache = enable ? std::make_shared<ResultCache>(max_bytes) : nullptr;
+    return true;
+}
+
+inline sdatabase::ResultCacheStats sdatabase::PostgreSQLDatabase::get_result_cache_stats() {
+    auto cache = this->notify->get_cache();
+    return cache ? cache->stats() : ResultCacheStats{};
+}
+
+inline void sdatabase::PostgreSQLDatabase::invalidate_result_cache(const std::string& channel) {
+    auto cache = this->notify->get_cache();
+    if (!cache) {
+        return;
+    }
+
+    if (channel.empty()) {
+        cache->clear();
+    } else {
+        cache->invalidate(channel);
+    }
+}
+
+inline Oid sdatabase::PostgreSQLDatabase::create_large_object() {
+    if (!this->is_good) {
+        return InvalidOid;
+    }
+
+    return lo_create(pg_conn, InvalidOid);
+}
+
+inline sdatabase::PostgreSQLLargeObject sdatabase::PostgreSQLDatabase::open_large_object(Oid oid, bool writable) {
+    if (!this->is_good) {
+        return {};
+    }
+
+    const int fd = lo_open(pg_conn, oid, writable ? (INV_READ | INV_WRITE) : INV_READ);
+    if (fd < 0) {
+        return {};
+    }
+
+    return PostgreSQLLargeObject{pg_conn, fd};
+}
+
+inline bool sdatabase::PostgreSQLDatabase::unlink_large_object(Oid oid) {
+    return this->is_good && lo_unlink(pg_conn, oid) == 1;
+}
+
+inline Oid sdatabase::PostgreSQLDatabase::import_large_object(const std::string& path) {
+    if (!this->is_good) {
+        return InvalidOid;
+    }
+
+    return lo_import(pg_conn, path.c_str());
+}
+
+inline bool sdatabase::PostgreSQLDatabase::export_large_object(Oid oid, const std::string& path) {
+    return this->is_good && lo_export(pg_conn, oid, path.c_str()) == 1;
+}
+
+inline std::int64_t sdatabase::PostgreSQLDatabase::read_bytea(const std::string& table, const std::string& column,
+        const std::string& key_column, const std::string& key, std::int64_t offset, void* buffer, std::int64_t size) {
+    if (!this->is_good) {
+        return -1;
+    }
+
+    const std::string query = "SELECT substring(" + column + " FROM $2::integer FOR $3::integer) FROM " + table + " WHERE " + key_column + " = $1;";
+    const std::string from = std::to_string(offset + 1);
+    const std::string count = std::to_string(size);
+    const char* values[] = {key.c_str(), from.c_str(), count.c_str()};
+
+    PGresult* res = PQexecParams(pg_conn, query.c_str(), 3, nullptr, values, nullptr, nullptr, 1);
+    if (PQresultStatus(res) != PGRES_TUPLES_OK || PQntuples(res) != 1 || PQgetisnull(res, 0, 0)) {
+        PQclear(res);
+        return -1;
+    }
+
+    const int n = PQgetlength(res, 0, 0);
+    std::memcpy(buffer, PQgetvalue(res, 0, 0), static_cast<std::size_t>(n));
+    PQclear(res);
+    return n;
+}
+
+inline bool sdatabase::PostgreSQLDatabase::read_bytea(const std::string& table, const std::string& column,
+        const std::string& key_column, const std::string& key, std::ostream& os, std::int64_t chunk_size) {
+    if (!this->is_good || chunk_size <= 0) {
+        return false;
+    }
+
+    /* Every substring() of a compressed value decompresses all of it, so slicing chunk by chunk
+     * would be quadratic. Fetch the value once as a binary result and write it out from there. */
+    const std::string query = "SELECT " + column + " FROM " + table + " WHERE " + key_column + " = $1;";
+    const char* values[] = {key.c_str()};
+
+    PGresult* res = PQexecParams(pg_conn, query.c_str(), 1, nullptr, values, nullptr, nullptr, 1);
+    if (PQresultStatus(res) != PGRES_TUPLES_OK || PQntuples(res) != 1 || PQgetisnull(res, 0, 0)) {
+        PQclear(res);
+        return false;
+    }
+
+    const char* data = PQgetvalue(res, 0, 0);
+    const std::int64_t size = PQgetlength(res, 0, 0);
+    for (std::int64_t offset{0}; offset < size && os; offset += chunk_size) {
+        os.write(data + offset, static_cast<std::streamsize>(std::min(chunk_size, size - offset)));
+    }
+    PQclear(res);
+    return static_cast<bool>(os);
+}
+
+inline bool sdatabase::PostgreSQLDatabase::write_bytea(const std::string& table, const std::string& column,
+        const std::string& key_column, const std::string& key, std::istream& is, std::int64_t size, std::size_t chunk_size) {
+    if (!this->is_good || size < 0 || size > INT32_MAX || chunk_size == 0) {
+        return false;
+    }
+
+    /* A stream that ends early fails the COPY, which aborts the caller's transaction,
+     * so inside one the upload runs behind a savepoint that is rolled back on failure. */
+    const PGTransactionStatusType status = PQtransactionStatus(pg_conn);
+    if (status != PQTRANS_IDLE && status != PQTRANS_INTRANS) {
+        return false;
+    }
+
+    const bool nested = status == PQTRANS_INTRANS;
+    if (nested) {
+        PGresult* res = PQexec(pg_conn, "SAVEPOINT sdb_write_bytea;");
+        const bool saved = PQresultStatus(res) == PGRES_COMMAND_OK;
+        PQclear(res);
+        if (!saved) {
+            return false;
+        }
+    }
+
+    const bool ok = this->upload_bytea(table, column, key_column, key, is, size, chunk_size);
+    if (nested) {
+        PQclear(PQexec(pg_conn, ok ? "RELEASE SAVEPOINT sdb_write_bytea;"
+            : "ROLLBACK TO SAVEPOINT sdb_write_bytea; RELEASE SAVEPOINT sdb_write_bytea;"));
+    }
+    return ok;
+}
+
+inline bool sdatabase::PostgreSQLDatabase::upload_bytea(const std::string& table, const std::string& column,
+        const std::string& key_column, const std::string& key, std::istream& is, std::int64_t size, std::size_t chunk_size) {
+    /* COPY is the only way to stream a single value to the server; stage it in a temporary table. */
+    PGresult* res = PQexec(pg_conn, "CREATE TEMP TABLE IF NOT EXISTS sdb_bytea_upload (data bytea); TRUNCATE sdb_bytea_upload;");
+    const bool staged = PQresultStatus(res) == PGRES_COMMAND_OK;
+    PQclear(res);
+    if (!staged) {
+        return false;
+    }
+
+    res = PQexec(pg_conn, "COPY sdb_bytea_upload (data) FROM STDIN (FORMAT binary);");
+    const bool copying = PQresultStatus(res) == PGRES_COPY_IN;
+    PQclear(res);
+    if (!copying) {
+        return false;
+    }
+
+    std::string buffer = detail::copy_binary_header();
+    detail::copy_put_int16(buffer, 1);
+    detail::copy_put_int32(buffer, static_cast<std::int32_t>(size));
+    bool ok = PQputCopyData(pg_conn, buffer.data(), static_cast<int>(buffer.size())) == 1;
+
+    buffer.resize(chunk_size);
+    for (std::int64_t left = size; ok && left > 0;) {
+        const auto want = static_cast<std::streamsize>(static_cast<std::int64_t>(chunk_size) < left ? static_cast<std::int64_t>(chunk_size) : left);
+        is.read(buffer.data(), want);
+        const std::streamsize n = is.gcount();
+        if (n <= 0) {
+            ok = false;
+            break;
+        }
+        ok = PQputCopyData(pg_conn, buffer.data(), static_cast<int>(n)) == 1;
+        left -= n;
+    }
+
+    if (ok) {
+        std::string trailer{};
+        detail::copy_put_int16(trailer, -1);
+        ok = PQputCopyData(pg_conn, trailer.data(), static_cast<int>(trailer.size())) == 1;
+    }
+
+    PQputCopyEnd(pg_conn, ok ? nullptr : "input ended early");
+    while ((res = PQgetResult(pg_conn)) != nullptr) {
+        ok = ok && PQresultStatus(res) == PGRES_COMMAND_OK;
+        PQclear(res);
+    }
+    if (!ok) {
+        return false;
+    }
+
+    const std::string query = "UPDATE " + table + " SET " + column + " = (SELECT data FROM sdb_bytea_upload) WHERE " + key_column + " = $1;";
+    const char* values[] = {key.c_str()};
+    res = PQexecParams(pg_conn, query.c_str(), 1, nullptr, values, nullptr, nullptr, 0);
+    ok = PQresultStatus(res) == PGRES_COMMAND_OK && std::string{PQcmdTuples(res)} != "0";
+    PQclear(res);
+
+    PQclear(PQexec(pg_conn, "TRUNCATE sdb_bytea_upload;"));
+    return ok;
+}
+
+inline sdatabase::PostgreSQLLargeObject::PostgreSQLLargeObject(PostgreSQLLargeObject&& other) noexcept : pg_conn(other.pg_conn), fd(other.fd) {
+    other.pg_conn = nullptr;
+    other.fd = -1;
+}
+
+inline sdatabase::PostgreSQLLargeObject& sdatabase::PostgreSQLLargeObject::operator=(PostgreSQLLargeObject&& other) noexcept {
+    if (this != &other) {
+        this->close();
+        this->pg_conn = other.pg_conn;
+        this->fd = other.fd;
+        other.pg_conn = nullptr;
+        other.fd = -1;
+    }
+    return *this;
+}
+
+inline bool sdatabase::PostgreSQLLargeObject::good() const {
+    return this->pg_conn && this->fd >= 0;
+}
+
+inline int sdatabase::PostgreSQLLargeObject::read(void* buffer, std::size_t n) {
+    return this->good() ? lo_read(pg_conn, fd, static_cast<char*>(buffer), n) : -1;
+}
+
+inline int sdatabase::PostgreSQLLargeObject::write(const void* buffer, std::size_t n) {
+    return this->good() ? lo_write(pg_conn, fd, static_cast<const char*>(buffer), n) : -1;
+}
+
+inline std::int64_t sdatabase::PostgreSQLLargeObject::seek(std::int64_t offset, int whence) {
+    return this->good() ? lo_lseek64(pg_conn, fd, offset, whence) : -1;
+}
+
+inline std::int64_t sdatabase::PostgreSQLLargeObject::tell() {
+    return this->good() ? lo_tell64(pg_conn, fd) : -1;
+}
+
+inline bool sdatabase::PostgreSQLLargeObject::truncate(std::int64_t size) {
+    return this->good() && lo_truncate64(pg_conn, fd, size) == 0;
+}
+
+inline bool sdatabase::PostgreSQLLargeObject::read_to(std::ostream& os, std::size_t chunk_size) {
+    if (!this->good() || chunk_size == 0) {
+        return false;
+    }
+
+    std::vector<char> buffer(chunk_size);
+    for (;;) {
+        const int n = this->read(buffer.data(), buffer.size());
+        if (n < 0) {
+            return false;
+        }
+        if (n == 0) {
+            return true;
+        }
+        os.write(buffer.data(), n);
+        if (!os) {
+            return false;
+        }
+    }
+}
+
+inline std::int64_t sdatabase::PostgreSQLLargeObject::write_from(std::istream& is, std::size_t chunk_size) {
+    if (!this->good() || chunk_size == 0) {
+        return -1;
+    }
+
+    std::vector<char> buffer(chunk_size);
+    std::int64_t written{0};
+    while (is) {
+        is.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        const std::streamsize n = is.gcount();
+        if (n <= 0) {
+            break;
+        }
+        if (this->write(buffer.data(), static_cast<std::size_t>(n)) != n) {
+            return -1;
+        }
+        written += n;
+    }
+
+    return written;
+}
+
+inline void sdatabase::PostgreSQLLargeObject::close() {
+    if (this->good()) {
+        lo_close(pg_conn, fd);
+    }
+    this->pg_conn = nullptr;
+    this->fd = -1;
+}
+
+inline sdatabase::PostgreSQLLargeObject::~PostgreSQLLargeObject() {
+    this->close();
+}
+#endif
+#if defined(SDB_SQLITE3) && defined(SDB_POSTGRESQL)
+inline sdatabase::ColumnType sdatabase::detail::sqlite_declared_type(const std::string& declared) {
+    std::string type{};
+    for (const char c : declared) {
+        type += static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+    }
+
+    // the affinity rules of SQLite, in the same order, with BOOL split out of NUMERIC
+    const auto has = [&type](const char* part) { return type.find(part) != std::string::npos; };
+    if (has("INT")) {
+        return ColumnType::Integer;
+    }
+    if (has("CHAR") || has("CLOB") || has("TEXT")) {
+        return ColumnType::Text;
+    }
+    if (has("BLOB")) {
+        return ColumnType::Blob;
+    }
+    if (has("REAL") || has("FLOA") || has("DOUB")) {
+        return ColumnType::Real;
+    }
+    if (has("BOOL")) {
+        return ColumnType::Boolean;
+    }
+    return ColumnType::Text;
+}
+
+inline bool sdatabase::detail::TableMigration::sqlite_schema(SQLite3Database& db, const std::string& table, std::vector<MigrationColumn>& columns) {
+    for (auto& it : db.query("PRAGMA table_info(" + table + ");")) {
+        MigrationColumn column{};
+        column.name = it["name"];
+        column.type = sqlite_declared_type(it["type"]);
+        column.not_null = it["notnull"] == "1";
+        column.primary_key = std::atoi(it["pk"].c_str());
+        columns.push_back(std::move(column));
+    }
+    return !columns.empty();
+}
+
+inline bool sdatabase::detail::TableMigration::postgresql_schema(PostgreSQLDatabase& db, const std::string& table, std::vector<MigrationColumn>& columns) {
+    const char* values[] = {table.c_str()};
+    PGresult* res = PQexecParams(db.pg_conn,
+        // indkey is an int2vector, whose subscripts start at 0, so the key position comes from WITH ORDINALITY
+        "SELECT a.attname, a.atttypid::int4, a.attnotnull, "
+        "coalesce((SELECT k.n FROM unnest(i.indkey) WITH ORDINALITY AS k(attnum, n) WHERE k.attnum = a.attnum), 0) "
+        "FROM pg_attribute a LEFT JOIN pg_index i ON i.indrelid = a.attrelid AND i.indisprimary "
+        "WHERE a.attrelid = $1::regclass AND a.attnum > 0 AND NOT a.attisdropped ORDER BY a.attnum;",
+        1, nullptr, values, nullptr, nullptr, 0);
+
+    if (PQresultStatus(res) == PGRES_TUPLES_OK) {
+        for (int row{0}; row < PQntuples(res); ++row) {
+            MigrationColumn column{};
+            column.name = PQgetvalue(res, row, 0);
+            switch (std::atoi(PQgetvalue(res, row, 1))) {
+                case 16: column.type = ColumnType::Boolean; break;
+                case 17: column.type = ColumnType::Blob; break;
+                case 20: case 21: case 23: column.type = ColumnType::Integer; break;
+                case 700: case 701: column.type = ColumnType::Real; break;
+                default: column.type = ColumnType::Text; break;
+            }
+            column.not_null = PQgetvalue(res, row, 2)[0] == 't';
+            column.primary_key = std::atoi(PQgetvalue(res, row, 3));
+            columns.push_back(std::move(column));
+        }
+    }
+    PQclear(res);
+    return !columns.empty();
+}
+
+inline std::string sdatabase::detail::TableMigration::create_statement(const std::string& table, const std::vector<MigrationColumn>& columns, bool postgresql) {
+    static constexpr const char* sqlite_types[] = {"TEXT", "INTEGER", "REAL", "BOOLEAN", "BLOB"};
+    static constexpr const char* postgresql_types[] = {"text", "bigint", "double precision", "boolean", "bytea"};
+
+    std::string ret = "CREATE TABLE IF NOT EXISTS " + table + " (";
+    std::vector<const MigrationColumn*> key{};
+    for (std::size_t i{0}; i < columns.size(); ++i) {
+        const auto& column = columns[i];
+        ret += (i ? ", " : "") + quote_name(column.name) + " ";
+        ret += (postgresql ? postgresql_types : sqlite_types)[static_cast<int>(column.type)];
+        ret += column.not_null ? " NOT NULL" : "";
+        if (column.primary_key > 0) {
+            key.push_back(&column);
+        }
+    }
+
+    if (!key.empty()) {
+        std::sort(key.begin(), key.end(), [](const MigrationColumn* a, const MigrationColumn* b) { return a->primary_key < b->primary_key; });
+        ret += ", PRIMARY KEY (";
+        for (std::size_t i{0}; i < key.size(); ++i) {
+            ret += (i ? ", " : "") + quote_name(key[i]->name);
+        }
+        ret += ")";
+    }
+    return ret + ");";
+}
+
+inline bool sdatabase::detail::TableMigration::encode_row(sqlite3_stmt* stmt, const std::vector<MigrationColumn>& columns, std::string& out) {
+    copy_put_int16(out, static_cast<std::int16_t>(columns.size()));
+    for (std::size_t i{0}; i < columns.size(); ++i) {
+        const int index = static_cast<int>(i);
+        const int type = sqlite3_column_type(stmt, index);
+        if (type == SQLITE_NULL) {
+            copy_put_int32(out, -1);
+            continue;
+        }
+
+        // SQLite columns may hold any type, so values are converted as the declared type requires
+        const auto text = [stmt, index]() {
+            const auto* data = reinterpret_cast<const char*>(sqlite3_column_text(stmt, index));
+            return ImportField{data, static_cast<std::size_t>(sqlite3_column_bytes(stmt, index)), false};
+        };
+
+        switch (columns[i].type) {
+            case ColumnType::Integer: {
+                std::int64_t value{};
+                if (type == SQLITE_INTEGER) {
+                    value = sqlite3_column_int64(stmt, index);
+                } else if (type == SQLITE_FLOAT) {
+                    const double real = sqlite3_column_double(stmt, index);
+                    if (real != std::trunc(real) || !(std::fabs(real) < 9.2e18)) {
+                        return false;
+                    }
+                    value = static_cast<std::int64_t>(real);
+                } else if (!import_integer(text(), value)) {
+                    return false;
+                }
+                copy_put_int32(out, 8);
+                copy_put_int64(out, value);
+                break;
+            }
+            case ColumnType::Real: {
+                double value{};
+                if (type == SQLITE_INTEGER || type == SQLITE_FLOAT) {
+                    value = sqlite3_column_double(stmt, index);
+                } else if (!import_real(text(), value)) {
+                    return false;
+                }
+                std::int64_t bits{};
+                std::memcpy(&bits, &value, sizeof(bits));
+                copy_put_int32(out, 8);
+                copy_put_int64(out, bits);
+                break;
+            }
+            case ColumnType::Boolean: {
+                bool value{};
+                if (type == SQLITE_INTEGER || type == SQLITE_FLOAT) {
+                    value = sqlite3_column_double(stmt, index) != 0;
+                } else if (!import_boolean(text(), value)) {
+                    return false;
+                }
+                copy_put_int32(out, 1);
+                out += static_cast<char>(value ? 1 : 0);
+                break;
+            }
+            case ColumnType::Blob:
+                if (type == SQLITE_BLOB) {
+                    const auto* data = static_cast<const char*>(sqlite3_column_blob(stmt, index));
+                    const int size = sqlite3_column_bytes(stmt, index);
+                    copy_put_int32(out, size);
+                    out.append(data ? data : "", static_cast<std::size_t>(size));
+                    break;
+                }
+                [[fallthrough]];
+            case ColumnType::Text: {
+                const ImportField field = text();
+                copy_put_int32(out, static_cast<std::int32_t>(field.size));
+                out.append(field.data ? field.data : "", field.size);
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+inline const char* sdatabase::detail::TableMigration::bind_row(sqlite3_stmt* stmt, const std::vector<MigrationColumn>& columns, const char* p, const char* end) {
+    const auto read = [](const char* at, int bytes) {
+        std::uint64_t value{};
+        for (int i{0}; i < bytes; ++i) {
+            value = value << 8 | static_cast<unsigned char>(at[i]);
+        }
+        return value;
+    };
+
+    if (end - p < 2 || static_cast<std::size_t>(read(p, 2)) != columns.size()) {
+        return nullptr;
+    }
+    p += 2;
+
+    for (std::size_t i{0}; i < columns.size(); ++i) {
+        const int index = static_cast<int>(i + 1);
+        if (end - p < 4) {
+            return nullptr;
+        }
+        const auto size = static_cast<std::int32_t>(read(p, 4));
+        p += 4;
+        if (size < 0) {
+            sqlite3_bind_null(stmt, index);
+            continue;
+        }
+        if (end - p < size) {
+            return nullptr;
+        }
+
+        switch (columns[i].type) {
+            case ColumnType::Integer:
+                if (size == 2) {
+                    sqlite3_bind_int64(stmt, index, static_cast<std::int16_t>(read(p, 2)));
+                } else if (size == 4) {
+                    sqlite3_bind_int64(stmt, index, static_cast<std::int32_t>(read(p, 4)));
+                } else if (size == 8) {
+                    sqlite3_bind_int64(stmt, index, static_cast<std::int64_t>(read(p, 8)));
+                } else {
+                    return nullptr;
+                }
+                break;
+            case ColumnType::Real:
+                if (size == 4) {
+                    const auto bits = static_cast<std::uint32_t>(read(p, 4));
+                    float value{};
+                    std::memcpy(&value, &bits, sizeof(value));
+                    sqlite3_bind_double(stmt, index, value);
+                } else if (size == 8) {
+                    const std::uint64_t bits = read(p, 8);
+                    double value{};
+                    std::memcpy(&value, &bits, sizeof(value));
+                    sqlite3_bind_double(stmt, index, value);
+                } else {
+                    return nullptr;
+                }
+                break;
+            case ColumnType::Boolean:
+                sqlite3_bind_int(stmt, index, size > 0 && p[0] != 0 ? 1 : 0);
+                break;
+            case ColumnType::Blob:
+                sqlite3_bind_blob64(stmt, index, p, static_cast<sqlite3_uint64>(size), SQLITE_STATIC);
+                break;
+            case ColumnType::Text:
+                sqlite3_bind_text64(stmt, index, p, static_cast<sqlite3_uint64>(size), SQLITE_STATIC, SQLITE_UTF8);
+                break;
+        }
+        p += size;
+    }
+    return p;
+}
+
+inline sdatabase::MigrationStats sdatabase::detail::TableMigration::to_postgresql(SQLite3Database& from, PostgreSQLDatabase& to,
+        const std::string& table, const MigrationOptions& options) {
+    MigrationStats stats{};
+    std::vector<MigrationColumn> columns{};
+    if (!from.is_good || !to.is_good) {
+        stats.error = "database is not open";
+        return stats;
+    }
+    if (!sqlite_schema(from, table, columns)) {
+        stats.error = "no such table: " + table;
+        return stats;
+    }
+
+    const std::string target = options.target.empty() ? table : options.target;
+    if (options.create_table) {
+        PGresult* res = PQexec(to.pg_conn, create_statement(target, columns, true).c_str());
+        const bool created = PQresultStatus(res) == PGRES_COMMAND_OK;
+        PQclear(res);
+        if (!created) {
+            stats.error = PQerrorMessage(to.pg_conn);
+            return stats;
+        }
+    }
+
+    std::string list{};
+    for (std::size_t i{0}; i < columns.size(); ++i) {
+        list += (i ? ", " : "") + quote_name(columns[i].name);
+    }
+
+    sqlite3_stmt* stmt = from.prepare("SELECT " + list + " FROM " + table + ";");
+    if (!stmt) {
+        stats.error = sqlite3_errmsg(from.sqlite3_db);
+        return stats;
+    }
+
+    PGresult* res = PQexec(to.pg_conn, ("COPY " + target + " (" + list + ") FROM STDIN WITH (FORMAT binary);").c_str());
+    const bool copying = PQresultStatus(res) == PGRES_COPY_IN;
+    PQclear(res);
+    if (!copying) {
+        sqlite3_finalize(stmt);
+        stats.error = PQerrorMessage(to.pg_conn);
+        return stats;
+    }
+
+    // the reader encodes rows while this thread sends the previous batch
+    BoundedQueue<std::string> queue{options.queue_depth};
+    std::uint64_t rows{};
+    std::string read_error{};
+    std::thread reader([&]() {
+        std::string batch = copy_binary_header();
+        std::size_t in_batch{};
+        bool aborted{false};
+        int status{};
+        while ((status = sqlite3_step(stmt)) == SQLITE_ROW) {
+            const std::size_t mark = batch.size();
+            if (!encode_row(stmt, columns, batch)) {
+                batch.resize(mark);
+                ++stats.skipped;
+                continue;
+            }
+            ++rows;
+            if (++in_batch >= options.batch_rows) {
+                if (!queue.push(std::move(batch))) {
+                    aborted = true;
+                    break;
+                }
+                batch.clear();
+                in_batch = 0;
+            }
+        }
+
+        if (!aborted && status != SQLITE_DONE) {
+            read_error = sqlite3_errmsg(from.sqlite3_db);
+        } else if (!aborted) {
+            copy_put_int16(batch, -1);
+            queue.push(std::move(batch));
+        }
+        queue.close();
+    });
 
-inline void sdatabase::SQLite3Database::open(const std::string& database) {
-    if (this->is_good) {
-        return;
+    bool ok{true};
+    std::string batch{};
+    while (queue.pop(batch)) {
+        stats.bytes += batch.size();
+        if (PQputCopyData(to.pg_conn, batch.data(), static_cast<int>(batch.size())) != 1) {
+            stats.error = PQerrorMessage(to.pg_conn);
+            ok = false;
+            queue.close();
+            break;
+        }
     }
+    reader.join();
+    sqlite3_finalize(stmt);
 
-    if (sqlite3_open(database.c_str(), &this->sqlite3_db)) {
-        return;
+    if (ok && !read_error.empty()) {
+        stats.error = read_error;
+        ok = false;
     }
 
-    this->is_good = true;
+    PQputCopyEnd(to.pg_conn, ok ? nullptr : "migration aborted");
+    while ((res = PQgetResult(to.pg_conn)) != nullptr) {
+        if (ok && PQresultStatus(res) != PGRES_COMMAND_OK) {
+            stats.error = PQresultErrorMessage(res);
+            ok = false;
+        }
+        PQclear(res);
+    }
+
+    stats.ok = ok;
+    stats.rows = ok ? rows : 0;
+    return stats;
 }
 
-inline bool sdatabase::SQLite3Database::exec(const std::string& query) {
-    if (!this->is_good) {
-        return false;
+inline sdatabase::MigrationStats sdatabase::detail::TableMigration::to_sqlite(PostgreSQLDatabase& from, SQLite3Database& to,
+        const std::string& table, const MigrationOptions& options) {
+    MigrationStats stats{};
+    std::vector<MigrationColumn> columns{};
+    if (!from.is_good || !to.is_good) {
+        stats.error = "database is not open";
+        return stats;
     }
-
-    if (!this->validate(query)) {
-        throw std::runtime_error{"Invalid SQL statement in database file '" + this->database + "': " + query + "\n"};
+    if (!postgresql_schema(from, table, columns)) {
+        stats.error = PQerrorMessage(from.pg_conn);
+        return stats;
     }
 
-    char* err{};
-
-    int ret = sqlite3_exec(sqlite3_db, query.c_str(), nullptr, nullptr, &err);
+    const std::string target = options.target.empty() ? table : options.target;
+    if (options.create_table && !to.exec(create_statement(target, columns, false))) {
+        stats.error = sqlite3_errmsg(to.sqlite3_db);
+        return stats;
+    }
 
-    if (ret != SQLITE_OK) {
-        sqlite3_free(err);
-        return false;
+    // types without a binary form handled here are sent as their text output
+    std::string select{};
+    std::string list{};
+    std::string params{};
+    for (std::size_t i{0}; i < columns.size(); ++i) {
+        const std::string name = quote_name(columns[i].name);
+        select += (i ? ", " : "") + name + (columns[i].type == ColumnType::Text ? "::text" : "");
+        list += (i ? ", " : "") + name;
+        params += i ? ", ?" : "?";
     }
 
-    return true;
-}
+    sqlite3_stmt* insert = to.prepare("INSERT INTO " + target + " (" + list + ") VALUES (" + params + ");");
+    if (!insert) {
+        stats.error = sqlite3_errmsg(to.sqlite3_db);
+        return stats;
+    }
 
-inline bool sdatabase::SQLite3Database::validate(const std::string& query) {
-    if (!this->is_good) {
-        return false;
+    const bool own_transaction = sqlite3_get_autocommit(to.sqlite3_db) != 0;
+    if (own_transaction && !to.exec("BEGIN;")) {
+        sqlite3_finalize(insert);
+        stats.error = sqlite3_errmsg(to.sqlite3_db);
+        return stats;
     }
 
-    sqlite3_stmt* stmt;
+    PGresult* res = PQexec(from.pg_conn, ("COPY (SELECT " + select + " FROM " + table + ") TO STDOUT WITH (FORMAT binary);").c_str());
+    const bool copying = PQresultStatus(res) == PGRES_COPY_OUT;
+    PQclear(res);
+    if (!copying) {
+        sqlite3_finalize(insert);
+        if (own_transaction) {
+            to.exec("ROLLBACK;");
+        }
+        stats.error = PQerrorMessage(from.pg_conn);
+        return stats;
+    }
 
-    int ret = sqlite3_prepare_v2(sqlite3_db, query.c_str(), -1, &stmt, nullptr);
+    // the reader receives the next batch while this thread inserts the previous one
+    BoundedQueue<std::string> queue{options.queue_depth};
+    std::string read_error{};
+    PGconn* conn = from.pg_conn;
+    std::thread reader([&]() {
+        std::string batch{};
+        std::size_t in_batch{};
+        bool aborted{false};
+        bool header{true};
+        for (;;) {
+            char* buffer{};
+            const int n = PQgetCopyData(conn, &buffer, 0);
+            if (n < 0) {
+                if (n == -2 && !aborted) {
+                    read_error = PQerrorMessage(conn);
+                }
+                break;
+            }
 
-    if (ret != SQLITE_OK) {
-        return false;
-    }
+            // the stream is drained after an abort so the connection stays usable
+            const char* p = buffer;
+            std::size_t size = static_cast<std::size_t>(n);
+            if (header && size >= 19) {
+                const auto extension = static_cast<std::size_t>(static_cast<unsigned char>(p[15]) << 24 | static_cast<unsigned char>(p[16]) << 16
+                    | static_cast<unsigned char>(p[17]) << 8 | static_cast<unsigned char>(p[18]));
+                const std::size_t skip = std::min(size, 19 + extension);
+                p += skip;
+                size -= skip;
+                header = false;
+            }
+            const bool trailer = size == 2 && static_cast<unsigned char>(p[0]) == 0xff && static_cast<unsigned char>(p[1]) == 0xff;
+            if (!aborted && !trailer && size > 0) {
+                batch.append(p, size);
+                if (++in_batch >= options.batch_rows) {
+                    if (!queue.push(std::move(batch))) {
+                        aborted = true;
+                        if (PGcancel* cancel = PQgetCancel(conn)) {
+                            char error[256];
+                            PQcancel(cancel, error, sizeof(error));
+                            PQfreeCancel(cancel);
+                        }
+                    }
+                    batch.clear();
+                    in_batch = 0;
+                }
+            }
+            PQfreemem(buffer);
+        }
 
-    sqlite3_finalize(stmt);
+        while (PGresult* end = PQgetResult(conn)) {
+            if (!aborted && read_error.empty() && PQresultStatus(end) != PGRES_COMMAND_OK) {
+                read_error = PQresultErrorMessage(end);
+            }
+            PQclear(end);
+        }
+        if (!aborted && read_error.empty() && !batch.empty()) {
+            queue.push(std::move(batch));
+        }
+        queue.close();
+    });
 
-    return true;
-}
+    bool ok{true};
+    std::string batch{};
+    while (ok && queue.pop(batch)) {
+        stats.bytes += batch.size();
+        const char* end = batch.data() + batch.size();
+        for (const char* p = batch.data(); p < end;) {
+            p = bind_row(insert, columns, p, end);
+            if (!p) {
+                stats.error = "malformed COPY data";
+                ok = false;
+                break;
+            }
 
-inline std::vector<std::unordered_map<std::string, std::string>> sdatabase::SQLite3Database::query(const std::string& query) {
-    if (!this->is_good) {
-        return {};
+            const int ret = sqlite3_step(insert);
+            sqlite3_reset(insert);
+            if (ret != SQLITE_DONE) {
+                stats.error = sqlite3_errmsg(to.sqlite3_db);
+                ok = false;
+                break;
+            }
+            ++stats.rows;
+        }
+        if (!ok) {
+            queue.close();
+        }
     }
+    reader.join();
+    sqlite3_finalize(insert);
 
-    if (!this->validate(query)) {
-        throw std::runtime_error{"Invalid SQL statement: " + query + "\n"};
+    if (ok && !read_error.empty()) {
+        stats.error = read_error;
+        ok = false;
     }
 
-    char* err{};
-
-    int status = sqlite3_exec(sqlite3_db, query.c_str(), sdatabase::callback, nullptr, &err);
-
-    if (status != SQLITE_OK) {
-        sqlite3_free(err);
-        return {};
+    if (own_transaction) {
+        if (ok && !to.exec("COMMIT;")) {
+            stats.error = sqlite3_errmsg(to.sqlite3_db);
+            ok = false;
+        }
+        if (!ok) {
+            to.exec("ROLLBACK;");
+        }
     }
 
-    return std::move(tmp);
+    stats.ok = ok;
+    stats.rows = ok ? stats.rows : 0;
+    return stats;
 }
 
-inline bool sdatabase::SQLite3Database::good() {
-    return this->is_good;
+inline sdatabase::MigrationStats sdatabase::migrate_table(SQLite3Database& from, PostgreSQLDatabase& to, const std::string& table, const MigrationOptions& options) {
+    return detail::TableMigration::to_postgresql(from, to, table, options);
 }
 
-inline bool sdatabase::SQLite3Database::is_open() {
-    return this->good();
+inline sdatabase::MigrationStats sdatabase::migrate_table(PostgreSQLDatabase& from, SQLite3Database& to, const std::string& table, const MigrationOptions& options) {
+    return detail::TableMigration::to_sqlite(from, to, table, options);
 }
 
-inline void sdatabase::SQLite3Database::close() {
-    if (this->is_good) {
-        sqlite3_close(this->sqlite3_db);
-        this->is_good = false;
+inline sdatabase::SQLite3CDC::SQLite3CDC(SQLite3Database& source, PostgreSQLDatabase& target, CDCOptions options) : options(std::move(options)) {
+    if (!source.is_good || !target.is_good || source.capture || source.database.empty() || source.database == ":memory:") {
+        return;
     }
-}
 
-inline bool sdatabase::SQLite3Database::empty() {
-    return std::ifstream(this->database).peek() == std::ifstream::traits_type::eof();
-}
-
-inline sdatabase::SQLite3Database::~SQLite3Database() {
-    if (this->is_good) {
-        this->close();
+    // changes are published from the WAL hook, which only runs in WAL mode
+    auto mode = source.query("PRAGMA journal_mode;");
+    if (mode.empty() || mode.front()["journal_mode"] != "wal") {
+        return;
     }
-}
 
-inline std::int64_t sdatabase::SQLite3Database::get_last_insertion() {
-    if (!this->is_good) {
-        return -1;
+    this->reader = std::make_unique<SQLite3Database>(source.database);
+    if (!this->reader->good()) {
+        return;
     }
+    this->reader->exec("PRAGMA busy_timeout = 5000;");
+    this->reader->exec("PRAGMA query_only = true;");
 
-    return sqlite3_last_insert_rowid(this->sqlite3_db);
+    this->options.batch_size = std::max<std::size_t>(this->options.batch_size, 1);
+    this->pool = &target.connection_pool();
+    this->capture = std::make_unique<detail::SQLite3ChangeCapture>(this->options.queue_capacity, this->options.tables);
+    this->source = &source;
+    source.capture = this->capture.get();
+    source.install_hooks();
+
+    this->running = true;
+    this->worker = std::thread(&SQLite3CDC::run, this);
 }
-#endif
-#ifdef SDB_POSTGRESQL
-inline sdatabase::PostgreSQLDatabase::PostgreSQLDatabase(const std::string& host,
-    const std::string& user, const std::string& password, const std::string& database, int port) {
 
-    this->open(host, user, password, database, port);
+inline bool sdatabase::SQLite3CDC::good() const {
+    return this->running;
 }
 
-inline sdatabase::PostgreSQLDatabase::~PostgreSQLDatabase() {
-    if (this->is_good) {
-        this->close();
-    }
+inline void sdatabase::SQLite3CDC::fail(const std::string& message) {
+    std::lock_guard<std::mutex> lock(this->stats_mutex);
+    this->error = message;
 }
 
-inline void sdatabase::PostgreSQLDatabase::open(const std::string& host,
-        const std::string& user, const std::string& password, const std::string& database, int port) {
-    if (this->is_good) {
-        return;
+inline sdatabase::SQLite3CDC::Table& sdatabase::SQLite3CDC::table(std::uint32_t id) {
+    if (const auto it = this->tables.find(id); it != this->tables.end()) {
+        return it->second;
     }
 
-    this->host = host;
-    this->user = user;
-    this->password = password;
-    this->database = database;
-    this->port = port;
-
-    const std::string conninfo = ("host=" + host + " user=" + user + " password=" + password + " dbname=" + database + " port=" + std::to_string(port));
-    this->pg_conn = PQconnectdb(conninfo.c_str());
+    Table& table = this->tables[id];
+    table.name = this->capture->name(id);
 
-    if (PQstatus(pg_conn) != CONNECTION_OK || !pg_conn) {
-        PQfinish(pg_conn);
-        return;
+    int keys{0};
+    for (auto& it : this->reader->query("PRAGMA table_info(" + detail::quote_name(table.name) + ");")) {
+        if (it["pk"] != "0") {
+            ++keys;
+            table.key = table.columns.size();
+            table.supported = detail::SQLite3ChangeCapture::lower(it["type"]) == "integer";
+        }
+        table.columns.push_back(it["name"]);
+    }
+    table.supported = table.supported && keys == 1;
+    if (!table.supported) {
+        this->fail("table " + table.name + " has no INTEGER PRIMARY KEY and is not mirrored");
+        return table;
     }
 
-    PQsetNoticeProcessor(pg_conn, [](void*, const char* message) {
-    }, nullptr);
+    std::string list{};
+    std::string update{};
+    for (std::size_t i{0}; i < table.columns.size(); ++i) {
+        const std::string column = detail::quote_name(table.columns[i]);
+        list += (i ? ", " : "") + column;
+        if (i != table.key) {
+            update += (update.empty() ? "" : ", ") + column + " = EXCLUDED." + column;
+        }
+    }
 
-    this->is_good = true;
+    const std::string name = detail::quote_name(table.name);
+    const std::string key = detail::quote_name(table.columns[table.key]);
+    table.select = this->reader->prepare("SELECT " + list + " FROM " + name + " WHERE " + key + " = ?;");
+    table.supported = table.select != nullptr;
+    table.insert = "INSERT INTO " + name + " (" + list + ") VALUES ";
+    table.conflict = " ON CONFLICT (" + key + ") " + (update.empty() ? "DO NOTHING;" : "DO UPDATE SET " + update + ";");
+    table.remove = "DELETE FROM " + name + " WHERE " + key + " = ANY($1::bigint[]);";
+    return table;
 }
 
-inline bool sdatabase::PostgreSQLDatabase::exec(const std::string& query) {
-    if (!this->is_good) {
-        return false;
-    }
+inline bool sdatabase::SQLite3CDC::apply(const std::unordered_map<std::uint32_t, std::unordered_set<std::int64_t>>& dirty, std::uint64_t& rows) {
+    std::vector<Statement> statements(1);
+    statements.back().query = "BEGIN;";
 
-    if (PQstatus(pg_conn) != CONNECTION_OK) {
-        throw std::runtime_error{"Connection to database failed: " + std::string(PQerrorMessage(pg_conn))};
-    }
+    // one read transaction, so the batch is a consistent snapshot of the source
+    this->reader->exec("BEGIN;");
+    for (const auto& [id, keys] : dirty) {
+        Table& table = this->table(id);
+        if (!table.supported) {
+            continue;
+        }
 
-    if (!this->validate(query)) {
-        throw std::runtime_error{"Invalid SQL statement in database '" + this->database + "': " + query + "\n"};
-    }
+        const std::size_t width = table.columns.size();
+        const std::size_t rows_per_statement = std::max<std::size_t>(1, 65535 / width);
+        std::string deleted{};
+        Statement* insert{};
+        std::size_t inserted{};
 
-    PGresult* res = PQexec(pg_conn, query.c_str());
+        for (const std::int64_t key : keys) {
+            sqlite3_bind_int64(table.select, 1, key);
+            if (sqlite3_step(table.select) != SQLITE_ROW) {
+                sqlite3_reset(table.select);
+                deleted += (deleted.empty() ? "{" : ",") + std::to_string(key);
+                ++rows;
+                continue;
+            }
 
-    if (PQresultStatus(res) != PGRES_COMMAND_OK) {
-        PQclear(res);
-        return false;
+            if (!insert || inserted == rows_per_statement) {
+                if (insert) {
+                    insert->query += table.conflict;
+                }
+                insert = &statements.emplace_back();
+                insert->query = table.insert;
+                inserted = 0;
+            }
+
+            insert->query += inserted ? ", (" : "(";
+            for (std::size_t i{0}; i < width; ++i) {
+                const int column = static_cast<int>(i);
+                insert->query += (i ? ", $" : "$") + std::to_string(insert->values.size() + 1);
+                const int type = sqlite3_column_type(table.select, column);
+                if (type == SQLITE_NULL) {
+                    insert->values.push_back(nullptr);
+                    insert->lengths.push_back(0);
+                    insert->formats.push_back(0);
+                    continue;
+                }
+
+                // blobs go as binary bytea, everything else as text for the server to parse into the column type
+                const bool blob = type == SQLITE_BLOB;
+                const auto* data = blob ? static_cast<const char*>(sqlite3_column_blob(table.select, column))
+                    : reinterpret_cast<const char*>(sqlite3_column_text(table.select, column));
+                const auto& value = insert->storage.emplace_back(data ? data : "", static_cast<std::size_t>(sqlite3_column_bytes(table.select, column)));
+                insert->values.push_back(value.c_str());
+                insert->lengths.push_back(static_cast<int>(value.size()));
+                insert->formats.push_back(blob ? 1 : 0);
+            }
+            insert->query += ")";
+            ++inserted;
+            ++rows;
+            sqlite3_reset(table.select);
+        }
+        if (insert) {
+            insert->query += table.conflict;
+        }
+
+        if (!deleted.empty()) {
+            Statement& remove = statements.emplace_back();
+            remove.query = table.remove;
+            const auto& value = remove.storage.emplace_back(deleted + "}");
+            remove.values.push_back(value.c_str());
+            remove.lengths.push_back(static_cast<int>(value.size()));
+            remove.formats.push_back(0);
+        }
     }
+    this->reader->exec("COMMIT;");
 
-    PQclear(res);
-    return true;
+    statements.emplace_back().query = "COMMIT;";
+    return this->send(statements);
 }
 
-inline bool sdatabase::PostgreSQLDatabase::validate(const std::string& query) {
-    if (!this->is_good) {
+inline bool sdatabase::SQLite3CDC::send(std::vector<Statement>& statements) {
+    if (!this->conn && !(this->conn = this->pool->acquire(std::chrono::milliseconds::zero()))) {
+        this->fail("could not connect to PostgreSQL");
         return false;
     }
 
-    PGresult* res = PQprepare(pg_conn, "", query.c_str(), 0, nullptr);
-
-    if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+    bool ok{true};
+    std::string message{};
+    const auto execute = [](PGconn* conn, const Statement& statement) {
+        return statement.values.empty() ? PQsendQuery(conn, statement.query.c_str())
+            : PQsendQueryParams(conn, statement.query.c_str(), static_cast<int>(statement.values.size()), nullptr,
+                statement.values.data(), statement.lengths.data(), statement.formats.data(), 0);
+    };
+    const auto check = [&ok, &message](PGresult* res) {
+        const auto status = PQresultStatus(res);
+        if (ok && status != PGRES_COMMAND_OK && status != PGRES_TUPLES_OK) {
+            message = PQresultErrorMessage(res);
+            ok = false;
+        }
         PQclear(res);
-        return false;
+    };
+
+#ifdef LIBPQ_HAS_PIPELINING
+    // every statement of the batch goes out before the first result is read
+    if (PQenterPipelineMode(this->conn) != 1) {
+        message = PQerrorMessage(this->conn);
+        ok = false;
+    }
+    for (std::size_t i{0}; ok && i < statements.size(); ++i) {
+        if (execute(this->conn, statements[i]) != 1) {
+            message = PQerrorMessage(this->conn);
+            ok = false;
+        }
+    }
+    if (PQpipelineStatus(this->conn) != PQ_PIPELINE_OFF) {
+        if (PQpipelineSync(this->conn) == 1) {
+            for (;;) {
+                PGresult* res = PQgetResult(this->conn);
+                if (!res) {
+                    continue; // end of one statement's results
+                }
+                if (PQresultStatus(res) == PGRES_PIPELINE_SYNC) {
+                    PQclear(res);
+                    break;
+                }
+                check(res);
+            }
+        } else {
+            message = PQerrorMessage(this->conn);
+            ok = false;
+        }
+        PQexitPipelineMode(this->conn);
+    }
+#else
+    for (std::size_t i{0}; ok && i < statements.size(); ++i) {
+        if (execute(this->conn, statements[i]) != 1) {
+            message = PQerrorMessage(this->conn);
+            ok = false;
+            break;
+        }
+        while (PGresult* res = PQgetResult(this->conn)) {
+            check(res);
+        }
     }
+#endif
 
-    PQclear(res);
-    return true;
+    if (!ok) {
+        if (PQstatus(this->conn) == CONNECTION_OK && PQtransactionStatus(this->conn) != PQTRANS_IDLE) {
+            PQclear(PQexec(this->conn, "ROLLBACK;"));
+        }
+        if (PQstatus(this->conn) != CONNECTION_OK) {
+            this->pool->release(std::exchange(this->conn, nullptr));
+        }
+        this->fail(message.empty() ? "batch failed" : message);
+    }
+    return ok;
 }
 
-inline std::vector<std::unordered_map<std::string, std::string>> sdatabase::PostgreSQLDatabase::query(const std::string& query) {
-    if (!this->is_good) {
-        return {};
-    }
+inline void sdatabase::SQLite3CDC::run() {
+    using clock = std::chrono::steady_clock;
+    const auto now_ns = []() {
+        return static_cast<std::int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now().time_since_epoch()).count());
+    };
+    const std::int64_t interval_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(this->options.flush_interval).count();
 
-    if (!this->validate(query)) {
-        throw std::runtime_error{"Invalid SQL statement: " + query + "\n"};
-    }
+    std::unordered_map<std::uint32_t, std::unordered_set<std::int64_t>> dirty{};
+    std::uint64_t count{};
+    std::int64_t oldest{};
+    std::int64_t window_start = now_ns();
+    std::uint64_t window_rows{};
+    std::vector<detail::SQLite3Change> overflow{};
 
-    PGresult* res = PQexec(pg_conn, query.c_str());
+    const auto add = [&](const detail::SQLite3Change& change) {
+        dirty[change.table].insert(change.rowid);
+        oldest = count++ ? std::min(oldest, change.commit_ns) : change.commit_ns;
+    };
 
-    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
-        PQclear(res);
-        return {};
-    }
+    for (;;) {
+        const bool stopping = !this->running.load(std::memory_order_acquire);
 
-    std::vector<std::unordered_map<std::string, std::string>> result;
-    int nrows = PQntuples(res);
-    int nfields = PQnfields(res);
+        detail::SQLite3Change change{};
+        while (count < this->options.batch_size && this->capture->ring.pop(change)) {
+            add(change);
+        }
+        {
+            std::lock_guard<std::mutex> lock(this->capture->overflow_mutex);
+            overflow.swap(this->capture->overflow);
+        }
+        for (const auto& it : overflow) {
+            add(it);
+        }
+        overflow.clear();
 
-    for (int i = 0; i < nrows; ++i) {
-        std::unordered_map<std::string, std::string> row;
-        for (int j = 0; j < nfields; ++j) {
-            row[PQfname(res, j)] = PQgetvalue(res, i, j);
+        const bool due = count >= this->options.batch_size || (count > 0 && (stopping || now_ns() - oldest >= interval_ns));
+        if (!due) {
+            if (stopping) {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
         }
-        result.push_back(std::move(row));
-    }
 
-    PQclear(res);
-    return result;
-}
+        std::uint64_t rows{};
+        if (!this->apply(dirty, rows)) {
+            this->failed_batches.fetch_add(1, std::memory_order_relaxed);
+            if (stopping) {
+                break;
+            }
+            // the changes stay queued in dirty and are retried with the current rows
+            std::this_thread::sleep_for(this->options.flush_interval);
+            continue;
+        }
 
-inline bool sdatabase::PostgreSQLDatabase::good() {
-    return this->is_good;
-}
+        const std::int64_t done = now_ns();
+        const std::int64_t lag = done - oldest;
+        this->lag_ns.store(lag, std::memory_order_relaxed);
+        if (lag > this->max_lag_ns.load(std::memory_order_relaxed)) {
+            this->max_lag_ns.store(lag, std::memory_order_relaxed);
+        }
+        this->applied.fetch_add(rows, std::memory_order_relaxed);
+        this->batches.fetch_add(1, std::memory_order_relaxed);
+        this->consumed.fetch_add(count, std::memory_order_release);
 
-inline bool sdatabase::PostgreSQLDatabase::is_open() {
-    return this->good();
-}
+        window_rows += rows;
+        if (done - window_start >= 1000000000) {
+            std::lock_guard<std::mutex> lock(this->stats_mutex);
+            this->throughput = static_cast<double>(window_rows) * 1e9 / static_cast<double>(done - window_start);
+            this->error.clear();
+            window_start = done;
+            window_rows = 0;
+        } else {
+            std::lock_guard<std::mutex> lock(this->stats_mutex);
+            this->error.clear();
+        }
 
-inline void sdatabase::PostgreSQLDatabase::close() {
-    if (this->is_good) {
-        PQfinish(this->pg_conn);
-        this->is_good = false;
+        dirty.clear();
+        count = 0;
     }
+
+    for (auto& [id, table] : this->tables) {
+        sqlite3_finalize(table.select);
+    }
+    this->tables.clear();
+    this->pool->release(std::exchange(this->conn, nullptr));
 }
 
-inline bool sdatabase::PostgreSQLDatabase::empty() {
-    if (!this->is_good) {
-        return true;
+inline bool sdatabase::SQLite3CDC::flush(std::chrono::milliseconds timeout) {
+    if (!this->capture) {
+        return false;
     }
 
-    const char* query = "SELECT COUNT(*) FROM information_schema.tables WHERE table_schema = 'public';";
-    PGresult* res = PQexec(pg_conn, query);
+    const std::uint64_t target = this->capture->captured.load(std::memory_order_acquire);
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (this->consumed.load(std::memory_order_acquire) < target) {
+        if (std::chrono::steady_clock::now() >= deadline || !this->running.load(std::memory_order_acquire)) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
 
-    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
-        PQclear(res);
-        return true;
+inline sdatabase::CDCStats sdatabase::SQLite3CDC::stats() const {
+    CDCStats stats{};
+    if (!this->capture) {
+        return stats;
     }
 
-    bool is_empty = std::stoi(PQgetvalue(res, 0, 0)) == 0;
-    PQclear(res);
-    return is_empty;
+    stats.captured = this->capture->captured.load(std::memory_order_acquire);
+    stats.overflowed = this->capture->overflowed.load(std::memory_order_relaxed);
+    stats.applied = this->applied.load(std::memory_order_relaxed);
+    const std::uint64_t consumed = this->consumed.load(std::memory_order_acquire);
+    stats.pending = stats.captured > consumed ? stats.captured - consumed : 0;
+    stats.batches = this->batches.load(std::memory_order_relaxed);
+    stats.failed_batches = this->failed_batches.load(std::memory_order_relaxed);
+    stats.lag = std::chrono::nanoseconds(this->lag_ns.load(std::memory_order_relaxed));
+    stats.max_lag = std::chrono::nanoseconds(this->max_lag_ns.load(std::memory_order_relaxed));
+
+    std::lock_guard<std::mutex> lock(this->stats_mutex);
+    stats.throughput = this->throughput;
+    stats.error = this->error;
+    return stats;
 }
 
-inline std::int64_t sdatabase::PostgreSQLDatabase::get_last_insertion() {
-    if (!this->is_good) {
-        return -1;
+inline void sdatabase::SQLite3CDC::stop() {
+    if (this->source) {
+        this->source->capture = nullptr;
+        this->source->install_hooks();
+        this->source = nullptr;
     }
 
-    const char* query = "SELECT LASTVAL();";
-    PGresult* res = PQexec(pg_conn, query);
-
-    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
-        PQclear(res);
-        return -1;
+    this->running = false;
+    if (this->worker.joinable()) {
+        this->worker.join();
     }
+}
 
-    std::int64_t last_insertion = std::stoll(PQgetvalue(res, 0, 0));
-    PQclear(res);
-    return last_insertion;
+inline sdatabase::SQLite3CDC::~SQLite3CDC() {
+    this->stop();
 }
 #endif
@@ -0,0 +1,204 @@
+/* sdatabase - Simple database abstraction for SQLite3 and PostgreSQL
+ * Licensed under the MIT license
+ * Copyright (c) 2024-2025 Jacob Nilsson
+ *
+ * Bulk loader for CSV and NDJSON files, built on import_file().
+ *
+ * Usage: sdb-import [options] TABLE FILE
+ *   --backend sqlite3|postgresql  (default sqlite3)
+ *   --format csv|ndjson           (default from the file extension)
+ *   --delimiter C                 CSV field delimiter, \t for tab (default ,)
+ *   --no-header                   the first CSV record is data
+ *   --columns a,b,c               target columns (default from the header or first object)
+ *   --types text,integer,...      text, integer, real, boolean or blob per column (default text)
+ *   --batch-size N                rows per transaction or COPY (default 100000)
+ *   --threads N                   parser threads (default one per hardware thread)
+ *   --chunk-size N                bytes per parse task (default 8388608)
+ *   --create                      create the table if it does not exist
+ *   --sqlite-path PATH            (default sdb-import.db)
+ *   --wal                         switch the SQLite3 database to journal_mode = WAL (persists in the file)
+ *   --pg-host, --pg-port, --pg-user, --pg-password, --pg-database
+ */
+
+#include <sdatabase.hpp>
+
+#include <chrono>
+#include <iostream>
+
+namespace {
+    struct Options {
+        std::string backend{"sqlite3"};
+        std::string table{};
+        std::string path{};
+        std::string format{};
+        sdatabase::ImportOptions import{};
+        std::string sqlite_path{"sdb-import.db"};
+        bool wal{false};
+        std::string pg_host{"localhost"};
+        int pg_port{5432};
+        std::string pg_user{"postgres"};
+        std::string pg_password{};
+        std::string pg_database{"postgres"};
+    };
+
+    std::vector<std::string> split(const std::string& list) {
+        std::vector<std::string> ret{};
+        std::size_t start{0};
+        for (;;) {
+            const std::size_t comma = list.find(',', start);
+            ret.push_back(list.substr(start, comma - start));
+            if (comma == std::string::npos) {
+                return ret;
+            }
+            start = comma + 1;
+        }
+    }
+
+    sdatabase::ColumnType column_type(const std::string& name) {
+        if (name == "text") {
+            return sdatabase::ColumnType::Text;
+        }
+        if (name == "integer") {
+            return sdatabase::ColumnType::Integer;
+        }
+        if (name == "real") {
+            return sdatabase::ColumnType::Real;
+        }
+        if (name == "boolean") {
+            return sdatabase::ColumnType::Boolean;
+        }
+        if (name == "blob") {
+            return sdatabase::ColumnType::Blob;
+        }
+        throw std::runtime_error{"Unknown column type: " + name};
+    }
+
+    Options parse(int argc, char** argv) {
+        Options options{};
+        std::vector<std::string> positional{};
+        for (int i{1}; i < argc; ++i) {
+            const std::string arg = argv[i];
+            auto value = [&]() -> std::string {
+                if (i + 1 >= argc) {
+                    throw std::runtime_error{"Missing value for " + arg};
+                }
+                return argv[++i];
+            };
+
+            if (arg == "--backend") {
+                options.backend = value();
+            } else if (arg == "--format") {
+                options.format = value();
+            } else if (arg == "--delimiter") {
+                const std::string delimiter = value();
+                options.import.delimiter = delimiter == "\\t" ? '\t' : delimiter.at(0);
+            } else if (arg == "--no-header") {
+                options.import.header = false;
+            } else if (arg == "--columns") {
+                options.import.columns = split(value());
+            } else if (arg == "--types") {
+                for (const auto& it : split(value())) {
+                    options.import.types.push_back(column_type(it));
+                }
+            } else if (arg == "--batch-size") {
+                options.import.batch_size = std::stoul(value());
+            } else if (arg == "--threads") {
+                options.import.threads = std::stoul(value());
+            } else if (arg == "--chunk-size") {
+                options.import.chunk_size = std::stoul(value());
+            } else if (arg == "--create") {
+                options.import.create_table = true;
+            } else if (arg == "--sqlite-path") {
+                options.sqlite_path = value();
+            } else if (arg == "--wal") {
+                options.wal = true;
+            } else if (arg == "--pg-host") {
+                options.pg_host = value();
+            } else if (arg == "--pg-port") {
+                options.pg_port = std::stoi(value());
+            } else if (arg == "--pg-user") {
+                options.pg_user = value();
+            } else if (arg == "--pg-password") {
+                options.pg_password = value();
+            } else if (arg == "--pg-database") {
+                options.pg_database = value();
+            } else if (arg.size() > 1 && arg[0] == '-') {
+                throw std::runtime_error{"Unknown option: " + arg};
+            } else {
+                positional.push_back(arg);
+            }
+        }
+
+        if (positional.size() != 2) {
+            throw std::runtime_error{"Usage: sdb-import [options] TABLE FILE"};
+        }
+        options.table = positional[0];
+        options.path = positional[1];
+
+        if (options.format.empty()) {
+            const std::size_t dot = options.path.rfind('.');
+            const std::string extension = dot == std::string::npos ? "" : options.path.substr(dot + 1);
+            options.format = extension == "ndjson" || extension == "jsonl" ? "ndjson" : "csv";
+        }
+        if (options.format == "ndjson") {
+            options.import.format = sdatabase::ImportFormat::NDJSON;
+        } else if (options.format != "csv") {
+            throw std::runtime_error{"Unknown format: " + options.format};
+        }
+        return options;
+    }
+
+    template <typename Database>
+    int run(Database& db, const Options& options) {
+        if (!db.good()) {
+            std::cerr << "Could not open the database\n";
+            return 1;
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        const sdatabase::ImportStats stats = db.import_file(options.table, options.path, options.import);
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << "rows: " << stats.rows << "\n"
+                  << "skipped: " << stats.skipped << "\n"
+                  << "bytes: " << stats.bytes << "\n"
+                  << "seconds: " << seconds << "\n"
+                  << "rows/s: " << (seconds > 0 ? static_cast<double>(stats.rows) / seconds : 0.0) << "\n"
+                  << "MB/s: " << (seconds > 0 ? static_cast<double>(stats.bytes) / seconds / 1e6 : 0.0) << "\n";
+
+        if (!stats.ok) {
+            std::cerr << "Import failed: " << stats.error << "\n";
+            return 1;
+        }
+        return 0;
+    }
+}
+
+int main(int argc, char** argv) {
+    Options options{};
+    try {
+        options = parse(argc, argv);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+
+    if (options.backend == "sqlite3") {
+        sdatabase::SQLite3Database db{options.sqlite_path};
+        // WAL is a property of the file, so only switch when asked; synchronous only lasts for this connection
+        if (options.wal) {
+            db.exec("PRAGMA journal_mode = WAL;");
+        }
+        db.exec("PRAGMA synchronous = NORMAL;");
+        return run(db, options);
+    }
+#ifdef SDB_POSTGRESQL
+    if (options.backend == "postgresql") {
+        sdatabase::PostgreSQLDatabase db{options.pg_host, options.pg_user, options.pg_password, options.pg_database, options.pg_port};
+        return run(db, options);
+    }
+#endif
+
+    std::cerr << "Unsupported backend: " << options.backend << "\n";
+    return 1;
+}